@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Memory allocation through struct coho_allocator, and a bump arena
+ * that can serve as one.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "internal.h"
+
+#define ARENA_ALIGN		16
+#define ARENA_ROUND(n)		(((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER		ARENA_ROUND(sizeof(struct coho_arena_chunk))
+#define ARENA_DATA(c)		((unsigned char *)(c) + ARENA_HEADER)
+
+/*
+ * Chunk of arena memory.
+ * Its data follows the header, which is padded to ARENA_ALIGN bytes.
+ */
+struct coho_arena_chunk {
+	struct coho_arena_chunk *next;
+	size_t size;
+};
+
+static void *arena_alloc(void *, size_t);
+static void arena_free(void *, void *, size_t);
+static void *arena_realloc(void *, void *, size_t, size_t);
+static void *default_alloc(void *, size_t);
+static void default_free(void *, void *, size_t);
+static void *default_realloc(void *, void *, size_t, size_t);
+static int mul_overflows(size_t, size_t);
+
+/*
+ * Sets a to use the arena for all allocations.
+ * Memory is only released by coho_arena_reset() and coho_arena_free().
+ */
+void coho_arena_allocator(struct coho_allocator *a, struct coho_arena *arena)
+{
+	a->alloc = arena_alloc;
+	a->realloc = arena_realloc;
+	a->free = arena_free;
+	a->ud = arena;
+	a->held = 0;
+}
+
+void coho_arena_free(struct coho_arena *arena)
+{
+	struct coho_arena_chunk *c, *next;
+
+	for (c = arena->head; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	arena->head = NULL;
+	arena->current = NULL;
+	arena->used = 0;
+	arena->last = NULL;
+}
+
+/*
+ * Initializes an empty arena.
+ * Memory is obtained from malloc() in chunks of at least chunk_size
+ * bytes.
+ */
+void coho_arena_init(struct coho_arena *arena, size_t chunk_size)
+{
+	arena->head = NULL;
+	arena->current = NULL;
+	arena->used = 0;
+	arena->last = NULL;
+	arena->chunk_size = chunk_size;
+}
+
+/*
+ * Discards every allocation made from the arena.
+ * Its chunks are kept for reuse.
+ */
+void coho_arena_reset(struct coho_arena *arena)
+{
+	arena->current = arena->head;
+	arena->used = 0;
+	arena->last = NULL;
+}
+
+void coho_allocator_init(struct coho_allocator *a)
+{
+	a->alloc = default_alloc;
+	a->realloc = default_realloc;
+	a->free = default_free;
+	a->ud = NULL;
+	a->held = 0;
+}
+
+/*
+ * Allocates an array of n elements of the given size.
+ * Returns NULL if n * size overflows or allocation fails.
+ */
+void *coho_mem_alloc(struct coho_allocator *a, size_t n, size_t size)
+{
+	void *p;
+
+	if (mul_overflows(n, size))
+		return NULL;
+	if ((p = a->alloc(a->ud, n * size)) != NULL)
+		a->held += n * size;
+	return p;
+}
+
+/*
+ * Frees an array of n elements of the given size.
+ * Does nothing if p is NULL.
+ */
+void coho_mem_free(struct coho_allocator *a, void *p, size_t n, size_t size)
+{
+	if (p == NULL)
+		return;
+	a->free(a->ud, p, n * size);
+	a->held -= n * size;
+}
+
+/*
+ * Resizes an array of oldn elements to newn, like reallocarray().
+ * If p is NULL, allocates a new array.
+ * Returns NULL, leaving p intact, on failure.
+ */
+void *coho_mem_realloc(struct coho_allocator *a, void *p, size_t oldn,
+    size_t newn, size_t size)
+{
+	void *np;
+
+	if (p == NULL)
+		return coho_mem_alloc(a, newn, size);
+	if (mul_overflows(newn, size))
+		return NULL;
+	if ((np = a->realloc(a->ud, p, oldn * size, newn * size)) != NULL)
+		a->held += newn * size - oldn * size;
+	return np;
+}
+
+/*
+ * Returns the capacity of a scratch array for n elements: at least
+ * 16, doubled from cap as often as needed.
+ */
+size_t coho_scratch_cap(size_t cap, size_t n)
+{
+	if (cap < 16)
+		cap = 16;
+	while (cap < n)
+		cap *= 2;
+	return cap;
+}
+
+static void *arena_alloc(void *ud, size_t size)
+{
+	struct coho_arena *arena = ud;
+	struct coho_arena_chunk *c = arena->current;
+	unsigned char *p;
+	size_t sz;
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	if (c == NULL || arena->used + size > c->size) {
+		if (c != NULL && c->next != NULL && c->next->size >= size) {
+			c = c->next;
+		} else {
+			sz = size > arena->chunk_size ? size : arena->chunk_size;
+			if (sz > SIZE_MAX - ARENA_HEADER)
+				return NULL;
+			if ((c = malloc(ARENA_HEADER + sz)) == NULL)
+				return NULL;
+			c->size = sz;
+			if (arena->current == NULL) {
+				c->next = arena->head;
+				arena->head = c;
+			} else {
+				c->next = arena->current->next;
+				arena->current->next = c;
+			}
+		}
+		arena->current = c;
+		arena->used = 0;
+	}
+
+	p = ARENA_DATA(c) + arena->used;
+	arena->used += size;
+	arena->last = p;
+	return p;
+}
+
+/*
+ * Only the most recent allocation is actually released.
+ */
+static void arena_free(void *ud, void *p, size_t size)
+{
+	struct coho_arena *arena = ud;
+
+	(void)size;
+	if (p == arena->last) {
+		arena->used = (unsigned char *)p - ARENA_DATA(arena->current);
+		arena->last = NULL;
+	}
+}
+
+/*
+ * The most recent allocation is resized in place when the current
+ * chunk has room.
+ */
+static void *arena_realloc(void *ud, void *p, size_t old, size_t size)
+{
+	struct coho_arena *arena = ud;
+	size_t off;
+	void *np;
+
+	if (p == arena->last) {
+		off = (unsigned char *)p - ARENA_DATA(arena->current);
+		if (off + ARENA_ROUND(size ? size : 1) <=
+		    arena->current->size) {
+			arena->used = off + ARENA_ROUND(size ? size : 1);
+			return p;
+		}
+	}
+
+	if ((np = arena_alloc(ud, size)) == NULL)
+		return NULL;
+	memcpy(np, p, old < size ? old : size);
+	return np;
+}
+
+static void *default_alloc(void *ud, size_t size)
+{
+	(void)ud;
+	return malloc(size);
+}
+
+static void default_free(void *ud, void *p, size_t size)
+{
+	(void)ud;
+	(void)size;
+	free(p);
+}
+
+static void *default_realloc(void *ud, void *p, size_t old, size_t size)
+{
+	(void)ud;
+	(void)old;
+	return realloc(p, size);
+}
+
+/*
+ * Returns 1 if n * size does not fit in a size_t, else 0.
+ */
+static int mul_overflows(size_t n, size_t size)
+{
+	return n > 0 && SIZE_MAX / n < size;
+}
@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Parses many SMILES strings into one table of atom and bond columns,
+ * optionally using several threads.
+ *
+ * Threads parse chunks of consecutive strings, sized by their total
+ * length.  Each thread starts with its own contiguous share of the
+ * chunks, taking them from the front, and once out of work steals
+ * chunks from the back of the others' shares.  Results are collected
+ * per thread and then copied into place in input order.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "coho.h"
+
+#define CHUNKS_PER_THREAD	32
+
+/*
+ * Range of strings parsed as one unit of work.
+ */
+struct chunk {
+	size_t begin;
+	size_t end;
+};
+
+/*
+ * Location of a molecule's results within its worker's columns.
+ */
+struct slot {
+	int worker;
+	size_t atom;
+	size_t bond;
+};
+
+struct pool;
+
+struct worker {
+	struct pool *pool;
+	int id;
+	pthread_t thread;
+	int started;
+
+	struct coho_smiles x;
+	struct coho_smiles_columns columns;
+	size_t atom_count;
+	size_t bond_count;
+	int nomem;
+
+	/* Chunks not yet taken are chunks[head] up to chunks[tail]. */
+	pthread_mutex_t lock;
+	size_t head;
+	size_t tail;
+};
+
+struct pool {
+	struct coho_smiles_batch *b;
+	const char *const *smiles;
+	size_t *lengths;
+	struct chunk *chunks;
+	struct slot *slots;
+	struct worker *workers;
+	int nworkers;
+};
+
+static int add(struct coho_smiles_batch *, const char *, size_t);
+static void clear(struct coho_smiles_batch *);
+static void *merge(void *);
+static size_t next_cap(size_t, size_t);
+static void parse_one(struct worker *, size_t);
+static int reserve_molecules(struct coho_smiles_batch *, size_t);
+static void run(struct pool *, void *(*)(void *));
+static size_t split(struct pool *, size_t);
+static int take(struct worker *, struct chunk *);
+static void *work(void *);
+
+void coho_smiles_batch_free(struct coho_smiles_batch *b)
+{
+	struct coho_allocator *a = &b->x.allocator;
+
+	coho_mem_free(a, b->atom_offsets, b->molecules_cap + 1,
+	    sizeof(b->atom_offsets[0]));
+	coho_mem_free(a, b->bond_offsets, b->molecules_cap + 1,
+	    sizeof(b->bond_offsets[0]));
+	coho_mem_free(a, b->status, b->molecules_cap, sizeof(b->status[0]));
+	coho_mem_free(a, b->error_positions, b->molecules_cap,
+	    sizeof(b->error_positions[0]));
+	coho_smiles_columns_free(&b->columns);
+	coho_smiles_free(&b->x);
+}
+
+void coho_smiles_batch_init(struct coho_smiles_batch *b)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_smiles_batch_init_with_allocator(b, &a);
+}
+
+void coho_smiles_batch_init_with_allocator(struct coho_smiles_batch *b,
+    const struct coho_allocator *allocator)
+{
+	coho_smiles_init_with_allocator(&b->x, allocator);
+	coho_smiles_columns_init(&b->columns, &b->x.allocator);
+	b->count = 0;
+	b->atom_offsets = NULL;
+	b->bond_offsets = NULL;
+	b->status = NULL;
+	b->error_positions = NULL;
+	b->molecules_cap = 0;
+}
+
+/*
+ * Parses sz bytes of SMILES strings separated by newlines or NUL bytes.
+ * A carriage return before a newline is ignored, as is a separator at
+ * the end of the buffer.
+ * Returns COHO_OK, even if some strings could not be parsed, or
+ * COHO_NOMEM if memory could not be allocated.
+ */
+int coho_smiles_read_batch(struct coho_smiles_batch *b, const char *buf,
+    size_t sz)
+{
+	const char *p, *end, *eol;
+	size_t n;
+
+	clear(b);
+
+	p = buf;
+	end = buf + sz;
+	while (p < end) {
+		for (eol = p; eol < end && *eol != '\n' && *eol != '\0'; eol++)
+			;
+		n = eol - p;
+		if (n > 0 && *eol == '\n' && p[n - 1] == '\r')
+			n--;
+		if (add(b, p, n))
+			return COHO_NOMEM;
+		p = eol + 1;
+	}
+	return COHO_OK;
+}
+
+/*
+ * Parses n SMILES strings.
+ * The length of smiles[i] is lengths[i] or, if lengths is NULL or
+ * lengths[i] is zero, is found with strlen().
+ * Returns COHO_OK, even if some strings could not be parsed, or
+ * COHO_NOMEM if memory could not be allocated.
+ */
+int coho_smiles_read_batch_array(struct coho_smiles_batch *b,
+    const char *const *smiles, const size_t *lengths, size_t n)
+{
+	size_t i, len;
+
+	clear(b);
+
+	if (reserve_molecules(b, n))
+		return COHO_NOMEM;
+
+	for (i = 0; i < n; i++) {
+		len = lengths != NULL ? lengths[i] : 0;
+		if (len == 0)
+			len = strlen(smiles[i]);
+		if (add(b, smiles[i], len))
+			return COHO_NOMEM;
+	}
+	return COHO_OK;
+}
+
+/*
+ * Parses n SMILES strings, like coho_smiles_read_batch_array(), using
+ * up to nthreads threads.
+ * Each thread uses its own parsing context, with the allocator and
+ * flags of b->x, so the allocator must be safe to call from several
+ * threads at once.
+ * The results are identical to those of coho_smiles_read_batch_array().
+ */
+int coho_smiles_read_batch_threads(struct coho_smiles_batch *b,
+    const char *const *smiles, const size_t *lengths, size_t n,
+    int nthreads)
+{
+	struct coho_allocator *a = &b->x.allocator;
+	struct pool pool;
+	struct worker *w;
+	size_t i, nchunks, atoms, bonds;
+	int k, rc = COHO_NOMEM;
+
+	if (nthreads <= 1 || n < 2)
+		return coho_smiles_read_batch_array(b, smiles, lengths, n);
+	if ((size_t)nthreads > n)
+		nthreads = n;
+
+	clear(b);
+	if (reserve_molecules(b, n))
+		return COHO_NOMEM;
+
+	pool.b = b;
+	pool.smiles = smiles;
+	pool.nworkers = nthreads;
+	pool.lengths = coho_mem_alloc(a, n, sizeof(pool.lengths[0]));
+	pool.chunks = coho_mem_alloc(a, n, sizeof(pool.chunks[0]));
+	pool.slots = coho_mem_alloc(a, n, sizeof(pool.slots[0]));
+	pool.workers = coho_mem_alloc(a, nthreads, sizeof(pool.workers[0]));
+	if (pool.lengths == NULL || pool.chunks == NULL ||
+	    pool.slots == NULL || pool.workers == NULL)
+		goto done;
+
+	for (i = 0; i < n; i++) {
+		pool.lengths[i] = lengths != NULL ? lengths[i] : 0;
+		if (pool.lengths[i] == 0)
+			pool.lengths[i] = strlen(smiles[i]);
+	}
+	nchunks = split(&pool, n);
+
+	for (k = 0; k < nthreads; k++) {
+		w = &pool.workers[k];
+		w->pool = &pool;
+		w->id = k;
+		coho_smiles_init_with_allocator(&w->x, a);
+		w->x.flags = b->x.flags;
+		coho_smiles_columns_init(&w->columns, &w->x.allocator);
+		w->atom_count = 0;
+		w->bond_count = 0;
+		w->nomem = 0;
+		pthread_mutex_init(&w->lock, NULL);
+		w->head = nchunks * k / nthreads;
+		w->tail = nchunks * (k + 1) / nthreads;
+	}
+
+	run(&pool, work);
+
+	for (k = 0; k < nthreads; k++) {
+		if (pool.workers[k].nomem)
+			goto free_workers;
+	}
+
+	/* Offsets hold per-molecule counts until now. */
+	atoms = bonds = 0;
+	for (i = 0; i < n; i++) {
+		atoms += b->atom_offsets[i + 1];
+		bonds += b->bond_offsets[i + 1];
+		b->atom_offsets[i + 1] = atoms;
+		b->bond_offsets[i + 1] = bonds;
+	}
+	b->count = n;
+
+	if (coho_smiles_columns_reserve(&b->columns,
+	    next_cap(b->columns.cap, atoms > bonds ? atoms : bonds)))
+		goto free_workers;
+	run(&pool, merge);
+	rc = COHO_OK;
+
+free_workers:
+	for (k = 0; k < nthreads; k++) {
+		w = &pool.workers[k];
+		coho_smiles_columns_free(&w->columns);
+		coho_smiles_free(&w->x);
+		pthread_mutex_destroy(&w->lock);
+	}
+done:
+	coho_mem_free(a, pool.lengths, n, sizeof(pool.lengths[0]));
+	coho_mem_free(a, pool.chunks, n, sizeof(pool.chunks[0]));
+	coho_mem_free(a, pool.slots, n, sizeof(pool.slots[0]));
+	coho_mem_free(a, pool.workers, nthreads, sizeof(pool.workers[0]));
+	if (rc != COHO_OK)
+		clear(b);
+	return rc;
+}
+
+/*
+ * Parses one SMILES string and appends its results.
+ * An empty string is recorded as a failed parse.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int add(struct coho_smiles_batch *b, const char *smiles, size_t sz)
+{
+	struct coho_smiles *x = &b->x;
+	size_t i, atoms, bonds, need;
+	int rc;
+
+	if (reserve_molecules(b, b->count + 1))
+		return -1;
+
+	i = b->count;
+	atoms = b->atom_offsets[i];
+	bonds = b->bond_offsets[i];
+
+	if (sz == 0) {
+		rc = COHO_ERROR;
+		x->error_position = 0;
+	} else if ((rc = coho_smiles_read(x, smiles, sz)) == COHO_NOMEM) {
+		return -1;
+	}
+
+	if (rc == COHO_OK) {
+		need = atoms + x->atom_count > bonds + x->bond_count ?
+		    atoms + x->atom_count : bonds + x->bond_count;
+		if (coho_smiles_columns_reserve(&b->columns,
+		    next_cap(b->columns.cap, need)))
+			return -1;
+		coho_smiles_columns_set(&b->columns, atoms, bonds, x);
+		atoms += x->atom_count;
+		bonds += x->bond_count;
+	}
+
+	b->status[i] = rc;
+	b->error_positions[i] = rc == COHO_OK ? -1 : x->error_position;
+	b->atom_offsets[i + 1] = atoms;
+	b->bond_offsets[i + 1] = bonds;
+	b->count++;
+	return 0;
+}
+
+/*
+ * Discards the results of the previous batch.
+ */
+static void clear(struct coho_smiles_batch *b)
+{
+	b->count = 0;
+	if (b->atom_offsets != NULL) {
+		b->atom_offsets[0] = 0;
+		b->bond_offsets[0] = 0;
+	}
+}
+
+/*
+ * Copies the results of a share of the molecules from the worker
+ * columns into the batch.
+ */
+static void *merge(void *arg)
+{
+	struct worker *w = arg;
+	struct pool *pool = w->pool;
+	struct coho_smiles_batch *b = pool->b;
+	struct slot *s;
+	size_t i, begin, end;
+
+	begin = b->count * w->id / pool->nworkers;
+	end = b->count * (w->id + 1) / pool->nworkers;
+
+	for (i = begin; i < end; i++) {
+		s = &pool->slots[i];
+		if (b->status[i] != COHO_OK)
+			continue;
+		coho_smiles_columns_copy(&b->columns, b->atom_offsets[i],
+		    b->bond_offsets[i], &pool->workers[s->worker].columns,
+		    s->atom, s->bond,
+		    b->atom_offsets[i + 1] - b->atom_offsets[i],
+		    b->bond_offsets[i + 1] - b->bond_offsets[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Returns a capacity of at least need, growing cap geometrically.
+ */
+static size_t next_cap(size_t cap, size_t need)
+{
+	if (cap >= need)
+		return cap;
+	if (cap < 64)
+		cap = 64;
+	while (cap < need)
+		cap *= 2;
+	return cap;
+}
+
+/*
+ * Parses string i of a threaded batch.
+ * Its status is stored in place, and its atom and bond counts in the
+ * batch offsets, while its atoms and bonds are added to the worker's
+ * columns.
+ */
+static void parse_one(struct worker *w, size_t i)
+{
+	struct pool *pool = w->pool;
+	struct coho_smiles_batch *b = pool->b;
+	struct coho_smiles *x = &w->x;
+	size_t need;
+	int rc;
+
+	b->atom_offsets[i + 1] = 0;
+	b->bond_offsets[i + 1] = 0;
+
+	if (pool->lengths[i] == 0) {
+		rc = COHO_ERROR;
+		x->error_position = 0;
+	} else {
+		rc = coho_smiles_read(x, pool->smiles[i], pool->lengths[i]);
+	}
+
+	if (rc == COHO_OK) {
+		need = w->atom_count + x->atom_count >
+		    w->bond_count + x->bond_count ?
+		    w->atom_count + x->atom_count :
+		    w->bond_count + x->bond_count;
+		if (coho_smiles_columns_reserve(&w->columns,
+		    next_cap(w->columns.cap, need)))
+			rc = COHO_NOMEM;
+	}
+	if (rc == COHO_NOMEM) {
+		w->nomem = 1;
+		b->status[i] = rc;
+		return;
+	}
+
+	if (rc == COHO_OK) {
+		coho_smiles_columns_set(&w->columns, w->atom_count,
+		    w->bond_count, x);
+		pool->slots[i].worker = w->id;
+		pool->slots[i].atom = w->atom_count;
+		pool->slots[i].bond = w->bond_count;
+		w->atom_count += x->atom_count;
+		w->bond_count += x->bond_count;
+		b->atom_offsets[i + 1] = x->atom_count;
+		b->bond_offsets[i + 1] = x->bond_count;
+	}
+	b->status[i] = rc;
+	b->error_positions[i] = rc == COHO_OK ? -1 : x->error_position;
+}
+
+/*
+ * Ensures room for the results of n molecules.
+ * Returns 0 on success or -1 if memory could not be allocated, in
+ * which case the existing results are unchanged.
+ */
+static int reserve_molecules(struct coho_smiles_batch *b, size_t n)
+{
+	struct coho_allocator *a = &b->x.allocator;
+	size_t *ao, *bo;
+	int *st, *ep;
+	size_t cap, old = b->molecules_cap;
+
+	if (old >= n)
+		return 0;
+	cap = next_cap(old, n);
+
+	ao = coho_mem_alloc(a, cap + 1, sizeof(ao[0]));
+	bo = coho_mem_alloc(a, cap + 1, sizeof(bo[0]));
+	st = coho_mem_alloc(a, cap, sizeof(st[0]));
+	ep = coho_mem_alloc(a, cap, sizeof(ep[0]));
+	if (ao == NULL || bo == NULL || st == NULL || ep == NULL) {
+		coho_mem_free(a, ao, cap + 1, sizeof(ao[0]));
+		coho_mem_free(a, bo, cap + 1, sizeof(bo[0]));
+		coho_mem_free(a, st, cap, sizeof(st[0]));
+		coho_mem_free(a, ep, cap, sizeof(ep[0]));
+		return -1;
+	}
+
+	ao[0] = 0;
+	bo[0] = 0;
+	if (old > 0) {
+		memcpy(ao, b->atom_offsets, (b->count + 1) * sizeof(ao[0]));
+		memcpy(bo, b->bond_offsets, (b->count + 1) * sizeof(bo[0]));
+		memcpy(st, b->status, b->count * sizeof(st[0]));
+		memcpy(ep, b->error_positions, b->count * sizeof(ep[0]));
+	}
+
+	coho_mem_free(a, b->atom_offsets, old + 1, sizeof(ao[0]));
+	coho_mem_free(a, b->bond_offsets, old + 1, sizeof(bo[0]));
+	coho_mem_free(a, b->status, old, sizeof(st[0]));
+	coho_mem_free(a, b->error_positions, old, sizeof(ep[0]));
+
+	b->atom_offsets = ao;
+	b->bond_offsets = bo;
+	b->status = st;
+	b->error_positions = ep;
+	b->molecules_cap = cap;
+	return 0;
+}
+
+/*
+ * Runs fn for every worker, each on its own thread except the first,
+ * which runs on the calling thread.
+ * A worker whose thread can't be created runs on the calling thread
+ * afterwards.
+ */
+static void run(struct pool *pool, void *(*fn)(void *))
+{
+	struct worker *w;
+	int k;
+
+	for (k = 1; k < pool->nworkers; k++) {
+		w = &pool->workers[k];
+		w->started = pthread_create(&w->thread, NULL, fn, w) == 0;
+	}
+
+	fn(&pool->workers[0]);
+
+	for (k = 1; k < pool->nworkers; k++) {
+		w = &pool->workers[k];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		else
+			fn(w);
+	}
+}
+
+/*
+ * Divides the n strings into chunks of roughly equal total length,
+ * about CHUNKS_PER_THREAD per worker.
+ * A string longer than that forms a chunk by itself.
+ * Returns the number of chunks.
+ */
+static size_t split(struct pool *pool, size_t n)
+{
+	size_t i, nchunks, total, target, len;
+
+	total = 0;
+	for (i = 0; i < n; i++)
+		total += pool->lengths[i];
+	target = total / ((size_t)pool->nworkers * CHUNKS_PER_THREAD) + 1;
+
+	nchunks = 0;
+	len = 0;
+	for (i = 0; i < n; i++) {
+		if (len > 0 && len + pool->lengths[i] > target) {
+			pool->chunks[nchunks++].end = i;
+			len = 0;
+		}
+		if (len == 0)
+			pool->chunks[nchunks].begin = i;
+		len += pool->lengths[i] + 1;
+	}
+	pool->chunks[nchunks++].end = n;
+	return nchunks;
+}
+
+/*
+ * Takes the next chunk from the front of the worker's own share or,
+ * failing that, the last chunk of another worker's share.
+ * Returns 1 if a chunk was taken or 0 if no work remains.
+ */
+static int take(struct worker *w, struct chunk *c)
+{
+	struct pool *pool = w->pool;
+	struct worker *v;
+	int k, found = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) {
+		*c = pool->chunks[w->head++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	for (k = 1; !found && k < pool->nworkers; k++) {
+		v = &pool->workers[(w->id + k) % pool->nworkers];
+		pthread_mutex_lock(&v->lock);
+		if (v->head < v->tail) {
+			*c = pool->chunks[--v->tail];
+			found = 1;
+		}
+		pthread_mutex_unlock(&v->lock);
+	}
+	return found;
+}
+
+/*
+ * Parses chunks until none remain.
+ */
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	struct chunk c;
+	size_t i;
+
+	while (take(w, &c)) {
+		for (i = c.begin; i < c.end; i++)
+			parse_one(w, i);
+	}
+	return NULL;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Canonical ranking of atoms.
+ *
+ * Atoms are first ranked by invariants that don't depend on the order
+ * in which they were written: degree, element, isotope, charge,
+ * hydrogen count, aromaticity, whether they are chiral, and atom class.
+ * Ranks are then refined: each atom is given a hash of its rank and
+ * those of its neighbors, and atoms of equal rank are split by hash,
+ * until the number of distinct ranks stops growing.  Atoms still tied
+ * are told apart by ranking one atom of the lowest tied rank ahead of
+ * the others and refining again, until every rank is distinct.  For
+ * symmetric atoms the choice doesn't change the string written unless
+ * stereo marks tell the atoms apart, as in meso compounds, so then
+ * coho_smiles_write_canonical() tries each choice (see coho_rank_atoms()).
+ * Otherwise it matters only where refinement failed to separate atoms
+ * that are not symmetric, which is rare.
+ *
+ * Chirality marks and bond stereo are not invariants, since they
+ * depend on the order of neighbors, so only whether atoms are chiral
+ * and bonds marked '/' or '\' is used.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "coho.h"
+#include "internal.h"
+
+static int compare_keys(const void *, const void *);
+static uint64_t hash(const struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+static int rank_keys(struct coho_smiles_writer *, int);
+static int refine(struct coho_smiles_writer *, const struct coho_smiles *,
+    int);
+
+/*
+ * Stores the canonical rank of each atom of x, from 0 up to the number
+ * of atoms, in w->ranks, and the atoms in order of rank in w->order.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_smiles_canonical_ranks(struct coho_smiles_writer *w,
+    const struct coho_smiles *x)
+{
+	if (coho_smiles_writer_reserve(w, x->atom_count, x->bond_count))
+		return COHO_NOMEM;
+	coho_rank_atoms(w, x, NULL, 0, NULL);
+	return COHO_OK;
+}
+
+/*
+ * Ranks the atoms of x as coho_smiles_canonical_ranks() does, once the
+ * writer has room for x.
+ * Each tie broken is a level: at level i, the atom ranked first is
+ * atom path[i] of the lowest tied rank, counting from 0 in order of
+ * index, for i less than npath, and its first atom at deeper levels.
+ * If sizes is not NULL, the number of atoms tied at each level is
+ * stored in it.
+ * Returns the number of levels.
+ */
+int coho_rank_atoms(struct coho_smiles_writer *w,
+    const struct coho_smiles *x, const int *path, int npath, int *sizes)
+{
+	const struct coho_smiles_atom *a;
+	struct coho_smiles_rank_key *k, t;
+	uint64_t degree, hydrogens;
+	int i, j, n = x->atom_count, classes, tied, chosen, level;
+
+	for (i = 0; i < n; i++) {
+		a = &x->atoms[i];
+		k = &w->keys[i];
+		degree = x->neighbor_offsets[i + 1] - x->neighbor_offsets[i];
+		hydrogens = coho_smiles_hydrogen_count(x, i);
+		k->hi = (degree & 0xff) << 56 |
+		    (uint64_t)(a->atomic_number & 0xff) << 48 |
+		    (uint64_t)((a->isotope + 1) & 0xfffff) << 28 |
+		    (uint64_t)((a->charge + 128) & 0xff) << 20 |
+		    (hydrogens & 0xff) << 12 |
+		    (uint64_t)(a->is_aromatic != 0) << 1 |
+		    (a->chirality[0] != '\0');
+		k->lo = (uint64_t)(a->atom_class + 1);
+		k->atom = i;
+	}
+	coho_sort(w->keys, n, sizeof(w->keys[0]), compare_keys);
+	classes = refine(w, x, rank_keys(w, n));
+
+	for (level = 0; classes < n; level++) {
+		/*
+		 * The keys are sorted by rank, and tied atoms by index.
+		 * Rank the chosen atom of the lowest tied rank first,
+		 * moving its key to the front of the tie.  The others are
+		 * sorted again by refine().
+		 */
+		for (i = 0; w->keys[i + 1].hi != w->keys[i].hi; i++)
+			;
+		for (j = i + 1; j < n && w->keys[j].hi == w->keys[i].hi; j++)
+			;
+		if (sizes != NULL)
+			sizes[level] = j - i;
+		if (level < npath && path[level] > 0) {
+			t = w->keys[i];
+			w->keys[i] = w->keys[i + path[level]];
+			w->keys[i + path[level]] = t;
+		}
+		chosen = w->keys[i].atom;
+		tied = w->ranks[chosen];
+		for (i = 0; i < n; i++) {
+			k = &w->keys[i];
+			w->ranks[k->atom] = 2 * w->ranks[k->atom] +
+			    (w->ranks[k->atom] == tied && k->atom != chosen);
+			k->hi = w->ranks[k->atom];
+		}
+		classes = refine(w, x, classes + 1);
+	}
+
+	for (i = 0; i < n; i++)
+		w->order[w->ranks[i]] = i;
+	return level;
+}
+
+static int compare_keys(const void *p, const void *q)
+{
+	const struct coho_smiles_rank_key *a = p, *b = q;
+
+	if (a->hi != b->hi)
+		return a->hi < b->hi ? -1 : 1;
+	if (a->lo != b->lo)
+		return a->lo < b->lo ? -1 : 1;
+	return a->atom - b->atom;
+}
+
+/*
+ * Returns a hash of the rank of atom v and the ranks of its neighbors
+ * and the bonds to them, which doesn't depend on their order.
+ */
+static uint64_t hash(const struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int v)
+{
+	const struct coho_smiles_bond *b;
+	uint64_t h, u;
+	int i;
+
+	h = mix(w->ranks[v]);
+	for (i = x->neighbor_offsets[v]; i < x->neighbor_offsets[v + 1];
+	    i++) {
+		b = &x->bonds[x->neighbor_bonds[i]];
+		u = w->ranks[x->neighbor_atoms[i]];
+		h += mix(u << 8 | (b->stereo != 0) << 3 | b->order);
+	}
+	return h;
+}
+
+/*
+ * Ranks the atoms of the first n keys, which must be sorted, giving
+ * atoms with equal keys the same rank, and sets the high part of each
+ * key to the rank.
+ * Returns the number of distinct ranks.
+ */
+static int rank_keys(struct coho_smiles_writer *w, int n)
+{
+	struct coho_smiles_rank_key *k = w->keys;
+	uint64_t hi = 0;
+	int i, rank = 0;
+
+	for (i = 0; i < n; i++) {
+		if (i > 0 && (k[i].hi != hi || k[i].lo != k[i - 1].lo))
+			rank++;
+		hi = k[i].hi;
+		k[i].hi = rank;
+		w->ranks[k[i].atom] = rank;
+	}
+	return n > 0 ? rank + 1 : 0;
+}
+
+/*
+ * Splits ranks by the ranks of neighbors until no more can be split.
+ * classes is the number of distinct ranks to begin with.
+ * Only the keys of tied atoms need be hashed and sorted again.
+ * Returns the number of distinct ranks.
+ */
+static int refine(struct coho_smiles_writer *w, const struct coho_smiles *x,
+    int classes)
+{
+	struct coho_smiles_rank_key *k = w->keys;
+	int i, j, m, n = x->atom_count, prev;
+
+	do {
+		prev = classes;
+		for (i = 0; i < n; i = j) {
+			for (j = i + 1; j < n && k[j].hi == k[i].hi; j++)
+				;
+			if (j - i == 1)
+				continue;
+			for (m = i; m < j; m++)
+				k[m].lo = hash(w, x, k[m].atom);
+			coho_sort(k + i, j - i, sizeof(k[0]), compare_keys);
+		}
+		classes = rank_keys(w, n);
+	} while (classes > prev);
+	return classes;
+}
@@ -18,6 +18,7 @@ enum coho_status {
 	COHO_OK,
 	COHO_ERROR,
 	COHO_NOMEM,
+	COHO_STOPPED,
 };
 
 /* Compatibility functions {{{
@@ -31,6 +32,49 @@ void *reallocarray(void *, size_t, size_t);
 
 /* }}} */
 
+/* Memory allocation {{{
+*/
+
+/*
+ * Allocation callbacks.
+ * realloc and free are passed the current size of the block.
+ * held is maintained by the library and counts the bytes currently
+ * allocated through this allocator.
+ */
+struct coho_allocator {
+	void *(*alloc)(void *, size_t);
+	void *(*realloc)(void *, void *, size_t, size_t);
+	void (*free)(void *, void *, size_t);
+	void *ud;
+	size_t held;
+};
+
+struct coho_arena_chunk;
+
+/*
+ * Bump allocator.
+ */
+struct coho_arena {
+	struct coho_arena_chunk *head;
+	struct coho_arena_chunk *current;
+	size_t used;			/* bytes used in current */
+	void *last;			/* most recent allocation */
+	size_t chunk_size;
+};
+
+void coho_allocator_init(struct coho_allocator *);
+void coho_arena_allocator(struct coho_allocator *, struct coho_arena *);
+void coho_arena_free(struct coho_arena *);
+void coho_arena_init(struct coho_arena *, size_t);
+void coho_arena_reset(struct coho_arena *);
+
+void *coho_mem_alloc(struct coho_allocator *, size_t, size_t);
+void coho_mem_free(struct coho_allocator *, void *, size_t, size_t);
+void *coho_mem_realloc(struct coho_allocator *, void *, size_t, size_t,
+    size_t);
+
+/* }}} */
+
 /* SMILES parsing {{{
 */
 enum {
@@ -75,18 +119,172 @@ struct coho_smiles_bond {
 	int length;
 };
 
+/*
+ * Packed atom, 16 bytes.
+ * Fields holding an optional value store it plus one, with zero
+ * meaning unset.  The symbol is not copied; it is found at
+ * symbol_offset bytes past the start of the atom in the SMILES string.
+ */
+struct coho_smiles_packed_atom {
+	int position;
+	unsigned int isotope:17;		/* isotope + 1 */
+	unsigned int atomic_number:7;
+	unsigned int hydrogen_count:4;		/* hydrogen_count + 1 */
+	unsigned int is_bracket:1;
+	unsigned int is_organic:1;
+	unsigned int is_aromatic:1;
+	unsigned int atom_class:27;		/* atom_class + 1 */
+	unsigned int symbol_offset:3;
+	unsigned int symbol_length:2;
+	signed char charge;
+	signed char implicit_hydrogen_count;
+	unsigned char chirality;		/* 0: none, 1: @, 2: @@ */
+	unsigned char length;
+};
+
+/*
+ * Packed bond, 16 bytes.
+ */
+struct coho_smiles_packed_bond {
+	int atom0;
+	int atom1;
+	int position;
+	unsigned int order:3;
+	unsigned int stereo:2;
+	unsigned int is_implicit:1;
+	unsigned int is_ring:1;
+	unsigned int length:1;
+};
+
+/*
+ * Struct-of-arrays view of atoms and bonds.
+ * Element i of each atom array describes atom i, and likewise for
+ * bonds.
+ */
+struct coho_smiles_columns {
+	unsigned char *atomic_number;
+	signed char *charge;
+	signed char *hydrogen_count;
+	signed char *implicit_hydrogen_count;
+	unsigned char *is_aromatic;
+	int *isotope;
+
+	int *atom0;
+	int *atom1;
+	unsigned char *order;
+
+	size_t cap;
+	struct coho_allocator *allocator;
+};
+
+/*
+ * Open ring bond numbered 100 or more (see the %(nnn) ring bond syntax).
+ */
+struct coho_smiles_ring {
+	int number;
+	int slot;
+	int aromatic;
+	struct coho_smiles_bond bond;
+};
+
 struct coho_smiles_paren {
 	int position;
 	struct coho_smiles_bond bond;
 };
 
+#define COHO_SMILES_INLINE	128
+
+/*
+ * Storage for the atoms, bonds and parentheses of strings of up to
+ * COHO_SMILES_INLINE of each, kept within the context so that short
+ * strings need not allocate them.
+ */
+struct coho_smiles_inline {
+	struct coho_smiles_atom atoms[COHO_SMILES_INLINE];
+	struct coho_smiles_bond bonds[COHO_SMILES_INLINE];
+	struct coho_smiles_paren paren_stack[COHO_SMILES_INLINE];
+};
+
+/*
+ * Flags controlling coho_smiles_read().
+ */
+enum {
+	COHO_SMILES_PRESCAN = 0x01,
+	COHO_SMILES_PACKED = 0x02,	/* fill packed_atoms, packed_bonds */
+	COHO_SMILES_COLUMNS = 0x04,	/* fill columns */
+	COHO_SMILES_EXACT = 0x08,	/* size arrays from a counting pass */
+	COHO_SMILES_NO_SPANS = 0x10,	/* leave positions and lengths unset */
+	COHO_SMILES_NO_SYMBOLS = 0x20,	/* leave atom symbols empty */
+	COHO_SMILES_NO_CHIRALITY = 0x40, /* leave chirality strings empty */
+	COHO_SMILES_NO_HYDROGENS = 0x80, /* skip implicit hydrogen counts */
+};
+
+/*
+ * Results of coho_smiles_scan().
+ */
+struct coho_smiles_scan {
+	int illegal;			/* offset of first illegal byte or -1 */
+	int atoms;			/* upper bound on number of atoms */
+	int rings;			/* ring bond digits outside brackets */
+	int parens;			/* opening parentheses */
+};
+
+/*
+ * Bitmasks stored by coho_smiles_scan_masks(), one bit per byte: bit
+ * i % 32 of word i / 32 is set if byte i is of the kind.  Arrays left
+ * NULL are not stored; the rest must hold a word for every 32 bytes.
+ */
+struct coho_smiles_scan_masks {
+	unsigned long *brackets;	/* bracket atoms, [ and ] included */
+	unsigned long *rings;		/* digits outside bracket atoms */
+	unsigned long *parens;		/* ( */
+	unsigned long *close_parens;	/* ) */
+};
+
+/*
+ * Callbacks of coho_smiles_read_events(), any of which may be NULL.
+ * Each is passed ud.  A nonzero return stops the parse.
+ */
+struct coho_smiles_handler {
+	void *ud;
+	int (*on_atom)(void *, const struct coho_smiles_atom *, int);
+	int (*on_bond)(void *, const struct coho_smiles_bond *);
+	int (*on_ring_open)(void *, int, const struct coho_smiles_bond *);
+	int (*on_branch_open)(void *, int);
+	int (*on_branch_close)(void *, int);
+	int (*on_component)(void *, int);
+};
+
+/*
+ * Token of a SMILES string, as read by the lexer.
+ */
+struct coho_smiles_token {
+	unsigned int type;
+	int position;
+	const char *s;
+	size_t n;
+	int intval;
+	int flags;
+};
+
 struct coho_smiles {
+	int flags;
+	struct coho_allocator allocator;
+
 	const char *smiles;
+	int smiles_base;	/* position of smiles[0] in the string */
 	int position;
 	int end;
 	char error[32];
 	int error_position;
 
+	/*
+	 * The token at the current position, once read, so that each
+	 * byte is classified only once (see lex() in smiles.c).
+	 */
+	struct coho_smiles_token token;
+	int token_inbracket;
+
 	int atom_count;
 	int bond_count;
 
@@ -96,16 +294,474 @@ struct coho_smiles {
 	struct coho_smiles_bond *bonds;
 	size_t bonds_cap;
 
+	/*
+	 * Neighbors of atom i, in the order they appear in the SMILES,
+	 * are neighbor_atoms[neighbor_offsets[i]] up to but not including
+	 * neighbor_atoms[neighbor_offsets[i + 1]].
+	 * neighbor_bonds holds the index of the corresponding bonds.
+	 */
+	int *neighbor_offsets;
+	int *neighbor_atoms;
+	int *neighbor_bonds;
+
+	/*
+	 * Compact copies of atoms and bonds, filled on request
+	 * (see COHO_SMILES_PACKED and COHO_SMILES_COLUMNS).
+	 */
+	struct coho_smiles_packed_atom *packed_atoms;
+	struct coho_smiles_packed_bond *packed_bonds;
+	size_t packed_cap;
+	struct coho_smiles_columns columns;
+
+	int *bond_slots;
+	int bonds_unsorted;
+
+	/*
+	 * Ring bonds 0-99 are stored by number, with bit n % 32 of
+	 * ring_open[n / 32] set while ring bond n is open, and of
+	 * ring_aromatic[n / 32] set if it was opened at an aromatic atom.
+	 * Higher-numbered open ring bonds are kept in a list.
+	 */
 	struct coho_smiles_bond ring_bonds[100];
+	int ring_slots[100];
+	unsigned long ring_open[4];
+	unsigned long ring_aromatic[4];
+	struct coho_smiles_ring *big_rings;
+	size_t big_rings_cap;
+	int big_ring_count;
 	size_t open_ring_closures;
 
 	struct coho_smiles_paren *paren_stack;
 	int paren_stack_count;
 	size_t paren_stack_cap;
+
+	/*
+	 * atoms, bonds and paren_stack may point into storage,
+	 * so the context must not be copied or moved.
+	 */
+	struct coho_smiles_inline storage;
+
+	/* See coho_smiles_set_trim(). */
+	int trim_after;
+	size_t trim_above;
+	int trim_count;
+
+	/*
+	 * Parser state kept between calls to coho_smiles_feed(),
+	 * and the bytes fed so far.
+	 */
+	int state;
+	int last_atom;
+	struct coho_smiles_bond open_bond;
+	struct coho_smiles_bond next_bond;
+	char *stream;
+	size_t stream_len;
+	size_t stream_cap;
+	int streaming;
+	int stream_status;
+
+	/* See coho_smiles_validate() and coho_smiles_read_events(). */
+	int validating;
+	int last_position;
+	int last_aromatic;
+	const struct coho_smiles_handler *handler;
+	int stopped;
 };
 
+/*
+ * Results of parsing many SMILES strings.
+ * The atoms of molecule i are atoms atom_offsets[i] up to but not
+ * including atom_offsets[i + 1] of columns, and likewise for bonds.
+ * Bond atom numbers are relative to the first atom of the molecule.
+ * Molecules that could not be parsed have no atoms or bonds.
+ */
+struct coho_smiles_batch {
+	struct coho_smiles x;
+	struct coho_smiles_columns columns;
+
+	size_t count;			/* number of molecules */
+	size_t *atom_offsets;
+	size_t *bond_offsets;
+	int *status;			/* result of coho_smiles_read() */
+	int *error_positions;		/* -1 if parsed successfully */
+	size_t molecules_cap;
+};
+
+void coho_smiles_batch_free(struct coho_smiles_batch *);
+void coho_smiles_batch_init(struct coho_smiles_batch *);
+void coho_smiles_batch_init_with_allocator(struct coho_smiles_batch *,
+    const struct coho_allocator *);
+int coho_smiles_read_batch(struct coho_smiles_batch *, const char *, size_t);
+int coho_smiles_read_batch_array(struct coho_smiles_batch *,
+    const char *const *, const size_t *, size_t);
+int coho_smiles_read_batch_threads(struct coho_smiles_batch *,
+    const char *const *, const size_t *, size_t, int);
+
+const char *coho_smiles_element_symbol(int);
+int coho_smiles_feed(struct coho_smiles *, const char *, size_t);
+int coho_smiles_finish(struct coho_smiles *);
 void coho_smiles_free(struct coho_smiles *);
+int coho_smiles_hydrogen_count(const struct coho_smiles *, int);
 void coho_smiles_init(struct coho_smiles *);
+void coho_smiles_init_with_allocator(struct coho_smiles *,
+    const struct coho_allocator *);
+size_t coho_smiles_memory(const struct coho_smiles *);
+int coho_smiles_organic_hydrogen_count(const struct coho_smiles *, int);
+void coho_smiles_set_trim(struct coho_smiles *, int, size_t);
+void coho_smiles_shrink(struct coho_smiles *);
 int coho_smiles_read(struct coho_smiles *, const char *, size_t);
+int coho_smiles_read_events(struct coho_smiles *, const char *, size_t,
+    const struct coho_smiles_handler *);
+int coho_smiles_scan(struct coho_smiles_scan *, const char *, size_t);
+int coho_smiles_scan_masks(struct coho_smiles_scan *, const char *, size_t,
+    struct coho_smiles_scan_masks *);
+int coho_smiles_validate(struct coho_smiles *, const char *, size_t);
+
+void coho_smiles_columns_copy(struct coho_smiles_columns *, size_t, size_t,
+    const struct coho_smiles_columns *, size_t, size_t, size_t, size_t);
+void coho_smiles_columns_free(struct coho_smiles_columns *);
+void coho_smiles_columns_init(struct coho_smiles_columns *,
+    struct coho_allocator *);
+int coho_smiles_columns_reserve(struct coho_smiles_columns *, size_t);
+void coho_smiles_columns_set(struct coho_smiles_columns *, size_t, size_t,
+    const struct coho_smiles *);
+void coho_smiles_pack_atom(struct coho_smiles_packed_atom *,
+    const struct coho_smiles_atom *, const char *);
+void coho_smiles_pack_bond(struct coho_smiles_packed_bond *,
+    const struct coho_smiles_bond *);
+void coho_smiles_unpack_atom(struct coho_smiles_atom *,
+    const struct coho_smiles_packed_atom *, const char *);
+void coho_smiles_unpack_bond(struct coho_smiles_bond *,
+    const struct coho_smiles_packed_bond *);
+
+/* }}} */
+
+/* SMILES files {{{ */
+
+/*
+ * Records of a SMILES file: a string of sz bytes, usually mapped from a
+ * file, and the range of it still to be read.
+ */
+struct coho_smiles_file {
+	const char *data;
+	size_t size;
+	size_t pos;		/* offset of next line */
+	size_t end;		/* lines starting here or later are excluded */
+	int is_mapped;
+};
+
+/*
+ * One line of a SMILES file.
+ * The fields point into the file's data and are not NUL-terminated.
+ */
+struct coho_smiles_record {
+	const char *smiles;
+	size_t smiles_length;
+	const char *name;	/* rest of line, empty if absent */
+	size_t name_length;
+	size_t offset;		/* offset of line in file */
+	size_t file;		/* see coho_smiles_read_files() */
+};
+
+/*
+ * Index of the records of a SMILES file.
+ * offsets[k] is the offset of record k * interval.
+ */
+struct coho_smiles_index {
+	struct coho_allocator allocator;
+
+	size_t *offsets;
+	size_t cap;		/* offsets allocated */
+	size_t count;		/* number of offsets */
+	size_t interval;
+	size_t records;		/* number of records */
+
+	/* Indexed file, for detecting changes. */
+	size_t size;
+	long long mtime;
+	long mtime_nsec;
+};
+
+/*
+ * Options for coho_smiles_read_files().
+ */
+struct coho_smiles_ingest {
+	int nthreads;		/* parsing threads */
+	int queue_depth;	/* files read at once */
+	int buffers;		/* number of read buffers */
+	size_t buffer_size;
+	int flags;		/* flags of each parsing context */
+	int io_uring;		/* use io_uring if available */
+};
+
+void coho_smiles_file_close(struct coho_smiles_file *);
+void coho_smiles_file_init(struct coho_smiles_file *, const char *, size_t);
+int coho_smiles_file_next(struct coho_smiles_file *,
+    struct coho_smiles_record *);
+int coho_smiles_file_open(struct coho_smiles_file *, const char *);
+void coho_smiles_file_range(struct coho_smiles_file *, size_t, size_t);
+int coho_smiles_index_build(struct coho_smiles_index *, const char *, size_t);
+int coho_smiles_index_build_with_allocator(struct coho_smiles_index *,
+    const char *, size_t, const struct coho_allocator *);
+void coho_smiles_index_free(struct coho_smiles_index *);
+void coho_smiles_index_init(struct coho_smiles_index *);
+void coho_smiles_index_init_with_allocator(struct coho_smiles_index *,
+    const struct coho_allocator *);
+int coho_smiles_index_range(const struct coho_smiles_index *,
+    struct coho_smiles_file *, size_t, size_t);
+int coho_smiles_index_read(struct coho_smiles_index *, const char *,
+    const char *);
+int coho_smiles_index_read_with_allocator(struct coho_smiles_index *,
+    const char *, const char *, const struct coho_allocator *);
+int coho_smiles_index_seek(const struct coho_smiles_index *,
+    struct coho_smiles_file *, size_t);
+int coho_smiles_index_write(const struct coho_smiles_index *, const char *);
+void coho_smiles_ingest_init(struct coho_smiles_ingest *);
+int coho_smiles_read_files(const struct coho_smiles_ingest *,
+    const char *const *, size_t,
+    int (*)(void *, struct coho_smiles *, const struct coho_smiles_record *,
+    int), void *);
+int coho_smiles_read_files_with_allocator(const struct coho_smiles_ingest *,
+    const struct coho_allocator *, const char *const *, size_t,
+    int (*)(void *, struct coho_smiles *, const struct coho_smiles_record *,
+    int), void *);
+int coho_smiles_read_gz(const char *, int, int,
+    int (*)(void *, struct coho_smiles *, const struct coho_smiles_record *,
+    int), void *);
+int coho_smiles_read_gz_with_allocator(const char *, int, int,
+    const struct coho_allocator *,
+    int (*)(void *, struct coho_smiles *, const struct coho_smiles_record *,
+    int), void *);
+
+/* }}} */
+
+/* SMILES writing {{{ */
+
+/*
+ * Sort key of an atom while its canonical rank is computed.
+ */
+struct coho_smiles_rank_key {
+	unsigned long long hi;
+	unsigned long long lo;
+	int atom;
+};
+
+/*
+ * Atom on the stack of the writer's depth-first search.
+ */
+struct coho_smiles_write_frame {
+	int atom;
+	int next;		/* next neighbor to visit */
+	int children;		/* children not yet written */
+	int paren;		/* closes a branch when done */
+};
+
+/*
+ * Reusable state for writing SMILES.
+ * smiles holds the string last written, NUL-terminated.  The arrays
+ * are sized for the largest molecule written so far and kept, so that
+ * once warmed up a writer allocates nothing.
+ */
+struct coho_smiles_writer {
+	struct coho_allocator allocator;
+
+	char *smiles;
+	size_t length;
+
+	int *ranks;			/* rank of each atom */
+	struct coho_smiles_rank_key *keys;
+	int *order;			/* atoms by rank */
+	int *parent_bonds;		/* bond to parent in the tree, or -1 */
+	int *child_counts;
+	struct coho_smiles_write_frame *stack;
+
+	/*
+	 * Choices of tie-break tried when writing canonically, and the
+	 * smallest string written so far (see write.c).
+	 */
+	int *tie_path;
+	int *tie_sizes;
+	int *best_path;
+	char *best;
+	size_t atoms_cap;
+
+	/*
+	 * Neighbors of atom i of the molecule being written, sorted by
+	 * rank when writing canonically, start at its neighbor offset
+	 * (see struct coho_smiles).
+	 */
+	int *neighbor_atoms;
+	int *neighbor_bonds;
+
+	/*
+	 * ring_digits[i] is -1 unless bond i closes a ring, else 0 until
+	 * its ring bond digit is written, then the digit.
+	 */
+	int *ring_digits;
+	unsigned char *digits_used;
+
+	/* Bonds whose stereo marks are reversed together (see write.c). */
+	int *stereo_groups;
+	unsigned char *stereo_flips;
+	size_t bonds_cap;
+};
+
+int coho_smiles_canonical_ranks(struct coho_smiles_writer *,
+    const struct coho_smiles *);
+int coho_smiles_write(struct coho_smiles_writer *, const struct coho_smiles *);
+int coho_smiles_write_canonical(struct coho_smiles_writer *,
+    const struct coho_smiles *);
+void coho_smiles_writer_free(struct coho_smiles_writer *);
+void coho_smiles_writer_init(struct coho_smiles_writer *);
+void coho_smiles_writer_init_with_allocator(struct coho_smiles_writer *,
+    const struct coho_allocator *);
+int coho_smiles_writer_reserve(struct coho_smiles_writer *, size_t, size_t);
+
+/* }}} */
+
+/* Fingerprints {{{ */
+
+/*
+ * Number of 64-bit words in a fingerprint of length bits.
+ * Bit k of a fingerprint is bit k % 64 of word k / 64.
+ */
+#define COHO_FINGERPRINT_WORDS(length)	(((length) + 63) / 64)
+
+/*
+ * Identifier of a circular substructure and the number of times it
+ * occurs in a molecule.
+ */
+struct coho_fingerprint_count {
+	unsigned long long id;
+	int count;
+};
+
+/*
+ * Reusable state for computing circular fingerprints of radius radius,
+ * folded to length bits.  The arrays are sized for the largest molecule
+ * seen so far and kept, so that once warmed up no memory is allocated.
+ * A fingerprint may be used by one thread at a time.
+ */
+struct coho_fingerprint {
+	struct coho_allocator allocator;
+	int radius;
+	size_t length;
+
+	/*
+	 * Identifiers of each atom's substructure at the current radius,
+	 * and of all atoms at all radii so far.
+	 */
+	unsigned long long *ids;
+	unsigned long long *next_ids;
+	unsigned long long *features;
+	size_t feature_count;
+	unsigned long long *pairs;	/* neighbors of one atom */
+
+	/* Neighbor lists, as in struct coho_smiles. */
+	int *neighbor_offsets;
+	int *neighbor_atoms;
+	int *neighbor_bonds;
+	unsigned char *bond_orders;
+	unsigned char *ring_bonds;	/* whether each bond is in a ring */
+
+	/* Depth-first search for ring bonds. */
+	int *visits;
+	int *lows;
+	int *parent_bonds;
+	int *next;
+	int *stack;
+
+	size_t atoms_cap;
+	size_t bonds_cap;
+};
+
+int coho_fingerprint_batch(struct coho_fingerprint *,
+    const struct coho_smiles_batch *, size_t, size_t, unsigned long long *);
+int coho_fingerprint_bits(struct coho_fingerprint *,
+    const struct coho_smiles *, unsigned long long *);
+int coho_fingerprint_counts(struct coho_fingerprint *,
+    const struct coho_smiles *, struct coho_fingerprint_count *, size_t,
+    size_t *);
+void coho_fingerprint_free(struct coho_fingerprint *);
+void coho_fingerprint_init(struct coho_fingerprint *, int, size_t);
+void coho_fingerprint_init_with_allocator(struct coho_fingerprint *, int,
+    size_t, const struct coho_allocator *);
+int coho_fingerprint_reserve(struct coho_fingerprint *, size_t, size_t);
+
+/* }}} */
+
+/* Similarity search {{{ */
+
+/*
+ * Popcount kernels of similarity search.
+ */
+enum {
+	COHO_FINGERPRINT_KERNEL_SCALAR,
+	COHO_FINGERPRINT_KERNEL_POPCNT,
+	COHO_FINGERPRINT_KERNEL_AVX2,
+	COHO_FINGERPRINT_KERNEL_AVX512,
+};
+
+/*
+ * Fingerprints of length bits, sorted by number of bits set, in one
+ * block of memory laid out as stored on disk, so that it can be mapped.
+ * Fingerprint i starts at fingerprints + i * stride, on a 64-byte
+ * boundary, and was number ids[i] of those the store was built from.
+ * Fingerprints with p bits set are numbers offsets[p] up to but not
+ * including offsets[p + 1].
+ */
+struct coho_fingerprint_store {
+	struct coho_allocator allocator;
+
+	const unsigned long long *fingerprints;
+	const unsigned long long *ids;
+	const unsigned long long *offsets;
+	size_t count;
+	size_t length;
+	size_t stride;			/* words, a multiple of 8 */
+	int kernel;			/* COHO_FINGERPRINT_KERNEL_* */
+
+	void *data;			/* allocation or mapping */
+	size_t size;
+	int is_mapped;
+};
+
+/*
+ * Fingerprint found by a search, and its Tanimoto similarity to the
+ * query.
+ */
+struct coho_fingerprint_hit {
+	size_t id;
+	double similarity;
+};
+
+/*
+ * Results of a search, most similar first.  The array is kept between
+ * searches.
+ */
+struct coho_fingerprint_hits {
+	struct coho_allocator allocator;
+	struct coho_fingerprint_hit *hits;
+	size_t count;
+	size_t cap;
+};
+
+void coho_fingerprint_hits_free(struct coho_fingerprint_hits *);
+void coho_fingerprint_hits_init(struct coho_fingerprint_hits *);
+void coho_fingerprint_hits_init_with_allocator(struct coho_fingerprint_hits *,
+    const struct coho_allocator *);
+int coho_fingerprint_search(const struct coho_fingerprint_store *,
+    const unsigned long long *, double, size_t, int,
+    struct coho_fingerprint_hits *);
+int coho_fingerprint_store_build(struct coho_fingerprint_store *,
+    const unsigned long long *, size_t, size_t);
+void coho_fingerprint_store_free(struct coho_fingerprint_store *);
+void coho_fingerprint_store_init(struct coho_fingerprint_store *);
+void coho_fingerprint_store_init_with_allocator(
+    struct coho_fingerprint_store *, const struct coho_allocator *);
+int coho_fingerprint_store_open(struct coho_fingerprint_store *,
+    const char *);
+int coho_fingerprint_store_write(const struct coho_fingerprint_store *,
+    const char *);
 
 /* }}} */
@@ -3,6 +3,11 @@ PREFIX = /usr/local
 CFLAGS = -fPIC -Wall -Wextra -std=c99 -pedantic -O2
 AR = ar
 CC = cc
+LDLIBS = -lpthread $(ZLIB)
+
+# Reading gzip-compressed files requires zlib; clear both to build without.
+GZ = gz.c
+ZLIB = -lz
 
 CYTHON = cython
 PYTHON = python3
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Splits SMILES files into records without copying them.
+ * Each line holds a SMILES string, optionally followed by whitespace
+ * and a name.  Blank lines are skipped.
+ * Files are mapped into memory; lines are found with memchr(), which
+ * the C library vectorizes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+
+static void advise(struct coho_smiles_file *, size_t, size_t, int);
+static int is_space(int);
+
+void coho_smiles_file_close(struct coho_smiles_file *f)
+{
+	if (f->is_mapped)
+		munmap((void *)f->data, f->size);
+	coho_smiles_file_init(f, NULL, 0);
+}
+
+/*
+ * Sets f to read records from the sz bytes at buf, which must remain
+ * valid while f is in use.
+ */
+void coho_smiles_file_init(struct coho_smiles_file *f, const char *buf,
+    size_t sz)
+{
+	f->data = buf;
+	f->size = sz;
+	f->pos = 0;
+	f->end = sz;
+	f->is_mapped = 0;
+}
+
+/*
+ * Stores the next record in r.
+ * Returns 1 if a record was found or 0 if none remain.
+ */
+int coho_smiles_file_next(struct coho_smiles_file *f,
+    struct coho_smiles_record *r)
+{
+	const char *line, *eol, *p, *end;
+
+	while (f->pos < f->end) {
+		line = f->data + f->pos;
+		eol = memchr(line, '\n', f->size - f->pos);
+		if (eol == NULL)
+			eol = f->data + f->size;
+		f->pos = eol - f->data + 1;
+
+		for (p = line; p < eol && is_space(*p); p++)
+			;
+		if (p == eol)
+			continue;
+
+		r->offset = line - f->data;
+		r->file = 0;
+		r->smiles = p;
+		while (p < eol && !is_space(*p))
+			p++;
+		r->smiles_length = p - r->smiles;
+
+		while (p < eol && is_space(*p))
+			p++;
+		for (end = eol; end > p && is_space(end[-1]); end--)
+			;
+		r->name = p;
+		r->name_length = end - p;
+		return 1;
+	}
+
+	f->pos = f->end;
+	return 0;
+}
+
+/*
+ * Maps the file at path into memory.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_smiles_file_open(struct coho_smiles_file *f, const char *path)
+{
+	struct stat st;
+	void *p;
+	int fd, saved;
+
+	coho_smiles_file_init(f, NULL, 0);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1)
+		goto fail;
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	coho_smiles_file_init(f, p, st.st_size);
+	f->is_mapped = 1;
+	advise(f, 0, f->size, POSIX_MADV_SEQUENTIAL);
+	return 0;
+
+fail:
+	saved = errno;
+	close(fd);
+	errno = saved;
+	return -1;
+}
+
+/*
+ * Restricts f to the records whose lines start at offsets from begin up
+ * to but not including end.
+ * Dividing a file at arbitrary offsets thus assigns each record to
+ * exactly one part.
+ */
+void coho_smiles_file_range(struct coho_smiles_file *f, size_t begin,
+    size_t end)
+{
+	const char *eol;
+
+	if (end > f->size)
+		end = f->size;
+	if (begin > end)
+		begin = end;
+
+	f->pos = begin;
+	f->end = end;
+
+	/* Skip the rest of a line that starts before begin. */
+	if (begin > 0 && f->data[begin - 1] != '\n') {
+		eol = memchr(f->data + begin, '\n', f->size - begin);
+		f->pos = eol != NULL ? (size_t)(eol - f->data) + 1 : f->size;
+	}
+
+	advise(f, begin, end, POSIX_MADV_WILLNEED);
+}
+
+/*
+ * Passes advice about bytes [begin, end) of a mapped file to the
+ * kernel.
+ */
+static void advise(struct coho_smiles_file *f, size_t begin, size_t end,
+    int advice)
+{
+	size_t page;
+
+	if (!f->is_mapped || begin >= end)
+		return;
+	page = sysconf(_SC_PAGESIZE);
+	begin -= begin % page;
+	posix_madvise((char *)f->data + begin, end - begin, advice);
+}
+
+static int is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
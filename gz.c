@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reads gzip-compressed SMILES files, decompressing and parsing at the
+ * same time.
+ *
+ * One thread decompresses into a ring of buffers, each ending at a line
+ * boundary; the partial line at the end of one buffer is carried over
+ * to the start of the next.  Parser threads take filled buffers in turn,
+ * split them into records, and return them for reuse.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "coho.h"
+
+#define GZ_BUFSIZE	(1 << 20)
+#define GZ_BUFFERS(n)	(2 * (n) + 2)
+
+struct buffer {
+	char *data;
+	size_t len;
+	size_t cap;
+	size_t offset;		/* offset of data in uncompressed file */
+};
+
+struct reader {
+	gzFile gz;
+	int flags;
+	const struct coho_allocator *callbacks;	/* for each context */
+	struct coho_allocator allocator;	/* for the buffers */
+	int (*fn)(void *, struct coho_smiles *,
+	    const struct coho_smiles_record *, int);
+	void *ud;
+
+	pthread_mutex_t lock;
+	pthread_cond_t filled_cond;
+	pthread_cond_t free_cond;
+
+	struct buffer *buffers;
+	int nbuffers;
+	int *filled;		/* ring of filled buffers, in file order */
+	int filled_head;
+	int filled_count;
+	int *free;		/* stack of empty buffers */
+	int free_count;
+
+	/* Partial line left over by the last buffer filled. */
+	char *carry;
+	size_t carry_len;
+	size_t carry_cap;
+	size_t offset;		/* offset of carry in uncompressed file */
+
+	int done;		/* no more buffers will be filled */
+	int stop;
+	int error;		/* errno value of first failure */
+	int result;		/* nonzero return value of fn */
+};
+
+static void *decompress(void *);
+static int fill(struct reader *, struct buffer *, int *);
+static void finish(struct reader *, int, int);
+static int grow(struct reader *, char **, size_t *, size_t);
+static void *parse(void *);
+
+/*
+ * Reads the SMILES file at path, which may be compressed with gzip,
+ * calling fn for every record with the context used to parse it and
+ * the result of coho_smiles_read().
+ * Records are parsed by up to nthreads threads, each with its own
+ * context using the given flags, while another thread decompresses.
+ * fn is therefore called from several threads at once and in no
+ * particular order; record offsets are those in the uncompressed file.
+ * If fn returns nonzero, reading stops, although other threads finish
+ * the buffers they are parsing.
+ * Returns 0 once every record has been read, the nonzero value returned
+ * by fn, or -1 on failure, setting errno.
+ */
+int coho_smiles_read_gz(const char *path, int nthreads, int flags,
+    int (*fn)(void *, struct coho_smiles *,
+    const struct coho_smiles_record *, int), void *ud)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	return coho_smiles_read_gz_with_allocator(path, nthreads, flags, &a,
+	    fn, ud);
+}
+
+/*
+ * Reads the SMILES file at path like coho_smiles_read_gz(), allocating
+ * memory, including that of each thread's context, through allocator.
+ * The allocator must therefore be safe to call from several threads at
+ * once.
+ */
+int coho_smiles_read_gz_with_allocator(const char *path, int nthreads,
+    int flags, const struct coho_allocator *allocator,
+    int (*fn)(void *, struct coho_smiles *,
+    const struct coho_smiles_record *, int), void *ud)
+{
+	struct coho_allocator *a;
+	struct reader r;
+	pthread_t decompressor, *parsers;
+	int *started;
+	int i, rc = -1;
+
+	if (nthreads < 1)
+		nthreads = 1;
+
+	memset(&r, 0, sizeof(r));
+	r.flags = flags;
+	r.fn = fn;
+	r.ud = ud;
+	r.nbuffers = GZ_BUFFERS(nthreads);
+	r.callbacks = allocator;
+	r.allocator = *allocator;
+	a = &r.allocator;
+
+	parsers = coho_mem_alloc(a, nthreads, sizeof(parsers[0]));
+	started = coho_mem_alloc(a, nthreads, sizeof(started[0]));
+	r.buffers = coho_mem_alloc(a, r.nbuffers, sizeof(r.buffers[0]));
+	r.filled = coho_mem_alloc(a, r.nbuffers, sizeof(r.filled[0]));
+	r.free = coho_mem_alloc(a, r.nbuffers, sizeof(r.free[0]));
+	if (parsers == NULL || started == NULL || r.buffers == NULL ||
+	    r.filled == NULL || r.free == NULL) {
+		errno = ENOMEM;
+		goto done;
+	}
+	memset(r.buffers, 0, r.nbuffers * sizeof(r.buffers[0]));
+
+	for (i = 0; i < r.nbuffers; i++) {
+		if (grow(&r, &r.buffers[i].data, &r.buffers[i].cap,
+		    GZ_BUFSIZE))
+			goto done;
+		r.free[r.free_count++] = i;
+	}
+
+	errno = 0;
+	if ((r.gz = gzopen(path, "rb")) == NULL) {
+		if (errno == 0)
+			errno = ENOMEM;
+		goto done;
+	}
+	gzbuffer(r.gz, 1 << 17);
+
+	pthread_mutex_init(&r.lock, NULL);
+	pthread_cond_init(&r.filled_cond, NULL);
+	pthread_cond_init(&r.free_cond, NULL);
+
+	if ((errno = pthread_create(&decompressor, NULL, decompress, &r)))
+		goto destroy;
+	for (i = 1; i < nthreads; i++)
+		started[i] = pthread_create(&parsers[i], NULL, parse, &r) == 0;
+	parse(&r);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(parsers[i], NULL);
+	}
+	pthread_join(decompressor, NULL);
+
+	if (r.error) {
+		errno = r.error;
+		rc = -1;
+	} else {
+		rc = r.result;
+	}
+
+destroy:
+	pthread_cond_destroy(&r.free_cond);
+	pthread_cond_destroy(&r.filled_cond);
+	pthread_mutex_destroy(&r.lock);
+	gzclose(r.gz);
+done:
+	if (r.buffers != NULL) {
+		for (i = 0; i < r.nbuffers; i++)
+			coho_mem_free(a, r.buffers[i].data,
+			    r.buffers[i].cap, 1);
+	}
+	coho_mem_free(a, r.buffers, r.nbuffers, sizeof(r.buffers[0]));
+	coho_mem_free(a, r.filled, r.nbuffers, sizeof(r.filled[0]));
+	coho_mem_free(a, r.free, r.nbuffers, sizeof(r.free[0]));
+	coho_mem_free(a, r.carry, r.carry_cap, 1);
+	coho_mem_free(a, started, nthreads, sizeof(started[0]));
+	coho_mem_free(a, parsers, nthreads, sizeof(parsers[0]));
+	return rc;
+}
+
+/*
+ * Fills empty buffers until the end of the file or until reading stops.
+ */
+static void *decompress(void *arg)
+{
+	struct reader *r = arg;
+	struct buffer *b;
+	int i, eof = 0;
+
+	while (!eof) {
+		pthread_mutex_lock(&r->lock);
+		while (r->free_count == 0 && !r->stop)
+			pthread_cond_wait(&r->free_cond, &r->lock);
+		if (r->stop) {
+			pthread_mutex_unlock(&r->lock);
+			break;
+		}
+		i = r->free[--r->free_count];
+		pthread_mutex_unlock(&r->lock);
+
+		b = &r->buffers[i];
+		if (fill(r, b, &eof)) {
+			finish(r, errno, 0);
+			break;
+		}
+
+		pthread_mutex_lock(&r->lock);
+		if (b->len > 0) {
+			r->filled[(r->filled_head + r->filled_count) %
+			    r->nbuffers] = i;
+			r->filled_count++;
+			pthread_cond_signal(&r->filled_cond);
+		} else {
+			r->free[r->free_count++] = i;
+		}
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->done = 1;
+	pthread_cond_broadcast(&r->filled_cond);
+	pthread_mutex_unlock(&r->lock);
+	return NULL;
+}
+
+/*
+ * Fills b with the carried-over partial line and as much of the file as
+ * fits, up to the last complete line.
+ * A line longer than b is read whole by enlarging b.
+ * Sets *eof once the whole file has been read.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int fill(struct reader *r, struct buffer *b, int *eof)
+{
+	size_t keep, want;
+	int n, zerr;
+
+	if (grow(r, &b->data, &b->cap, r->carry_len + GZ_BUFSIZE))
+		return -1;
+	if (r->carry_len > 0)
+		memcpy(b->data, r->carry, r->carry_len);
+	b->len = r->carry_len;
+	b->offset = r->offset;
+
+	for (;;) {
+		while (b->len < b->cap) {
+			want = b->cap - b->len;
+			if (want > INT_MAX)
+				want = INT_MAX;
+			if ((n = gzread(r->gz, b->data + b->len, want)) < 0) {
+				gzerror(r->gz, &zerr);
+				if (zerr != Z_ERRNO)
+					errno = zerr == Z_MEM_ERROR ?
+					    ENOMEM : EIO;
+				return -1;
+			}
+			if (n == 0) {
+				*eof = 1;
+				break;
+			}
+			b->len += n;
+		}
+
+		if (*eof) {
+			keep = b->len;
+			break;
+		}
+		for (keep = b->len; keep > 0 && b->data[keep - 1] != '\n';
+		    keep--)
+			;
+		if (keep > 0)
+			break;
+		if (grow(r, &b->data, &b->cap, 2 * b->cap))
+			return -1;
+	}
+
+	r->carry_len = b->len - keep;
+	if (grow(r, &r->carry, &r->carry_cap, r->carry_len))
+		return -1;
+	if (r->carry_len > 0)
+		memcpy(r->carry, b->data + keep, r->carry_len);
+	r->offset = b->offset + keep;
+	b->len = keep;
+	return 0;
+}
+
+/*
+ * Stops reading, recording the first failure or nonzero result of the
+ * callback.
+ */
+static void finish(struct reader *r, int error, int result)
+{
+	pthread_mutex_lock(&r->lock);
+	if (!r->stop) {
+		r->error = error;
+		r->result = result;
+		r->stop = 1;
+	}
+	pthread_cond_broadcast(&r->filled_cond);
+	pthread_cond_broadcast(&r->free_cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Ensures that the buffer at *p has room for at least need bytes.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int grow(struct reader *r, char **p, size_t *cap, size_t need)
+{
+	char *np;
+
+	if (*cap >= need)
+		return 0;
+	if ((np = coho_mem_realloc(&r->allocator, *p, *cap, need, 1)) ==
+	    NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*p = np;
+	*cap = need;
+	return 0;
+}
+
+/*
+ * Parses filled buffers until none remain or reading stops.
+ */
+static void *parse(void *arg)
+{
+	struct reader *r = arg;
+	struct coho_smiles x;
+	struct coho_smiles_file f;
+	struct coho_smiles_record rec;
+	struct buffer *b;
+	int i, rc, result;
+
+	coho_smiles_init_with_allocator(&x, r->callbacks);
+	x.flags = r->flags;
+
+	for (;;) {
+		pthread_mutex_lock(&r->lock);
+		while (r->filled_count == 0 && !r->done && !r->stop)
+			pthread_cond_wait(&r->filled_cond, &r->lock);
+		if (r->filled_count == 0 || r->stop) {
+			pthread_mutex_unlock(&r->lock);
+			break;
+		}
+		i = r->filled[r->filled_head];
+		r->filled_head = (r->filled_head + 1) % r->nbuffers;
+		r->filled_count--;
+		pthread_mutex_unlock(&r->lock);
+
+		b = &r->buffers[i];
+		coho_smiles_file_init(&f, b->data, b->len);
+		while (coho_smiles_file_next(&f, &rec)) {
+			rec.offset += b->offset;
+			rc = coho_smiles_read(&x, rec.smiles,
+			    rec.smiles_length);
+			if (rc == COHO_NOMEM) {
+				finish(r, ENOMEM, 0);
+				break;
+			}
+			if ((result = r->fn(r->ud, &x, &rec, rc)) != 0) {
+				finish(r, 0, result);
+				break;
+			}
+		}
+
+		pthread_mutex_lock(&r->lock);
+		r->free[r->free_count++] = i;
+		pthread_cond_signal(&r->free_cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	coho_smiles_free(&x);
+	return NULL;
+}
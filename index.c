@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Indexes of the records of SMILES files, for finding a record by
+ * number.
+ *
+ * The offset of every interval-th record is kept.  On disk, an index is
+ * a header followed by those offsets, each stored as its difference from
+ * the one before in a variable-length encoding of 7 bits per byte.
+ * Header fields are 8-byte little-endian integers:
+ *
+ *	magic "COHOIDX1"
+ *	size of the indexed file
+ *	modification time of the indexed file, seconds
+ *	modification time of the indexed file, nanoseconds
+ *	number of records
+ *	interval
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coho.h"
+
+#define MAGIC		"COHOIDX1"
+#define HEADER_FIELDS	5
+
+static int get_u64(FILE *, uint64_t *);
+static int put_u64(FILE *, uint64_t);
+static int stale(const struct coho_smiles_index *, const char *);
+
+/*
+ * Indexes the records of the SMILES file at path, keeping the offset of
+ * every interval-th record.
+ * The file's size and modification time, kept in the index, are taken
+ * before it is read, and checked again after, so that offsets aren't
+ * paired with the stamp of another version of the file.
+ * Fails with errno set to ESTALE if the file changed in between.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_smiles_index_build(struct coho_smiles_index *idx, const char *path,
+    size_t interval)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	return coho_smiles_index_build_with_allocator(idx, path, interval, &a);
+}
+
+/*
+ * Indexes the file at path like coho_smiles_index_build(), obtaining
+ * the index's memory from allocator.
+ */
+int coho_smiles_index_build_with_allocator(struct coho_smiles_index *idx,
+    const char *path, size_t interval, const struct coho_allocator *allocator)
+{
+	struct coho_smiles_file f;
+	struct coho_smiles_record r;
+	struct stat st;
+	size_t *p, cap;
+	int changed;
+
+	coho_smiles_index_init_with_allocator(idx, allocator);
+	if (interval == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (stat(path, &st) == -1 || coho_smiles_file_open(&f, path) == -1)
+		return -1;
+
+	idx->interval = interval;
+	idx->size = st.st_size;
+	idx->mtime = st.st_mtim.tv_sec;
+	idx->mtime_nsec = st.st_mtim.tv_nsec;
+
+	while (coho_smiles_file_next(&f, &r)) {
+		if (idx->records++ % interval != 0)
+			continue;
+		if (idx->count == idx->cap) {
+			cap = idx->cap ? 2 * idx->cap : 256;
+			p = coho_mem_realloc(&idx->allocator, idx->offsets,
+			    idx->cap, cap, sizeof(*p));
+			if (p == NULL) {
+				coho_smiles_file_close(&f);
+				errno = ENOMEM;
+				goto fail;
+			}
+			idx->offsets = p;
+			idx->cap = cap;
+		}
+		idx->offsets[idx->count++] = r.offset;
+	}
+
+	changed = f.size != idx->size;
+	coho_smiles_file_close(&f);
+	if (changed) {
+		errno = ESTALE;
+		goto fail;
+	}
+	if (stale(idx, path))
+		goto fail;
+	return 0;
+
+fail:
+	coho_smiles_index_free(idx);
+	return -1;
+}
+
+void coho_smiles_index_free(struct coho_smiles_index *idx)
+{
+	struct coho_allocator a = idx->allocator;
+
+	coho_mem_free(&idx->allocator, idx->offsets, idx->cap,
+	    sizeof(idx->offsets[0]));
+	coho_smiles_index_init_with_allocator(idx, &a);
+}
+
+void coho_smiles_index_init(struct coho_smiles_index *idx)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_smiles_index_init_with_allocator(idx, &a);
+}
+
+/*
+ * Initializes an empty index that obtains its memory from allocator.
+ */
+void coho_smiles_index_init_with_allocator(struct coho_smiles_index *idx,
+    const struct coho_allocator *allocator)
+{
+	idx->allocator = *allocator;
+	idx->allocator.held = 0;
+	idx->offsets = NULL;
+	idx->cap = 0;
+	idx->count = 0;
+	idx->interval = 0;
+	idx->records = 0;
+	idx->size = 0;
+	idx->mtime = 0;
+	idx->mtime_nsec = 0;
+}
+
+/*
+ * Restricts f, which must hold the indexed file, to records first up to
+ * but not including last.
+ * Returns 0 on success or -1 if the records are out of range.
+ */
+int coho_smiles_index_range(const struct coho_smiles_index *idx,
+    struct coho_smiles_file *f, size_t first, size_t last)
+{
+	size_t end;
+
+	if (first > last || last > idx->records || f->size != idx->size)
+		return -1;
+
+	if (last == idx->records) {
+		end = f->size;
+	} else {
+		coho_smiles_index_seek(idx, f, last);
+		end = f->pos;
+	}
+	coho_smiles_index_seek(idx, f, first);
+	f->end = end;
+	return 0;
+}
+
+/*
+ * Reads the index at path of the SMILES file at smiles_path.
+ * Fails with errno set to ESTALE if the SMILES file has changed since
+ * it was indexed, or to EINVAL if the index is malformed.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_smiles_index_read(struct coho_smiles_index *idx, const char *path,
+    const char *smiles_path)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	return coho_smiles_index_read_with_allocator(idx, path, smiles_path,
+	    &a);
+}
+
+/*
+ * Reads the index at path like coho_smiles_index_read(), obtaining its
+ * memory from allocator.
+ */
+int coho_smiles_index_read_with_allocator(struct coho_smiles_index *idx,
+    const char *path, const char *smiles_path,
+    const struct coho_allocator *allocator)
+{
+	FILE *fp;
+	uint64_t h[HEADER_FIELDS], delta, offset = 0;
+	char magic[8];
+	size_t i;
+	int c, shift, saved;
+
+	coho_smiles_index_init_with_allocator(idx, allocator);
+	if ((fp = fopen(path, "rb")) == NULL)
+		return -1;
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+	    memcmp(magic, MAGIC, sizeof(magic)) != 0)
+		goto malformed;
+	for (i = 0; i < HEADER_FIELDS; i++) {
+		if (get_u64(fp, &h[i]))
+			goto malformed;
+	}
+	idx->size = h[0];
+	idx->mtime = h[1];
+	idx->mtime_nsec = h[2];
+	idx->records = h[3];
+	idx->interval = h[4];
+	if (idx->interval == 0 || idx->records != h[3])
+		goto malformed;
+
+	idx->count = (idx->records + idx->interval - 1) / idx->interval;
+	if (idx->count > 0 && (idx->offsets = coho_mem_alloc(&idx->allocator,
+	    idx->count, sizeof(idx->offsets[0]))) == NULL) {
+		fclose(fp);
+		coho_smiles_index_init_with_allocator(idx, allocator);
+		errno = ENOMEM;
+		return -1;
+	}
+	idx->cap = idx->count;
+
+	for (i = 0; i < idx->count; i++) {
+		delta = 0;
+		shift = 0;
+		do {
+			if ((c = getc(fp)) == EOF || shift > 63)
+				goto malformed;
+			delta |= (uint64_t)(c & 0x7f) << shift;
+			shift += 7;
+		} while (c & 0x80);
+		offset += delta;
+		if (offset >= idx->size)
+			goto malformed;
+		idx->offsets[i] = offset;
+	}
+	if (getc(fp) != EOF)
+		goto malformed;
+
+	fclose(fp);
+	if (smiles_path != NULL && stale(idx, smiles_path)) {
+		coho_smiles_index_free(idx);
+		return -1;
+	}
+	return 0;
+
+malformed:
+	saved = ferror(fp) ? errno : EINVAL;
+	fclose(fp);
+	coho_smiles_index_free(idx);
+	errno = saved;
+	return -1;
+}
+
+/*
+ * Positions f, which must hold the indexed file, at record i, reading
+ * at most interval - 1 records to get there.
+ * Reading continues to the end of the file.
+ * Returns 0 on success or -1 if there is no record i.
+ */
+int coho_smiles_index_seek(const struct coho_smiles_index *idx,
+    struct coho_smiles_file *f, size_t i)
+{
+	struct coho_smiles_record r;
+	size_t k;
+
+	if (i >= idx->records || f->size != idx->size)
+		return -1;
+
+	f->pos = idx->offsets[i / idx->interval];
+	f->end = f->size;
+	for (k = 0; k < i % idx->interval; k++) {
+		if (!coho_smiles_file_next(f, &r))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Writes the index to path.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_smiles_index_write(const struct coho_smiles_index *idx,
+    const char *path)
+{
+	FILE *fp;
+	uint64_t delta, prev = 0;
+	size_t i;
+	int saved;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+
+	if (fwrite(MAGIC, 1, 8, fp) != 8 ||
+	    put_u64(fp, idx->size) ||
+	    put_u64(fp, idx->mtime) ||
+	    put_u64(fp, idx->mtime_nsec) ||
+	    put_u64(fp, idx->records) ||
+	    put_u64(fp, idx->interval))
+		goto fail;
+
+	for (i = 0; i < idx->count; i++) {
+		delta = idx->offsets[i] - prev;
+		prev = idx->offsets[i];
+		while (delta >= 0x80) {
+			if (putc((delta & 0x7f) | 0x80, fp) == EOF)
+				goto fail;
+			delta >>= 7;
+		}
+		if (putc(delta, fp) == EOF)
+			goto fail;
+	}
+
+	if (fclose(fp) == EOF)
+		return -1;
+	return 0;
+
+fail:
+	saved = errno;
+	fclose(fp);
+	errno = saved;
+	return -1;
+}
+
+static int get_u64(FILE *fp, uint64_t *v)
+{
+	unsigned char b[8];
+	int i;
+
+	if (fread(b, 1, sizeof(b), fp) != sizeof(b))
+		return -1;
+	*v = 0;
+	for (i = 7; i >= 0; i--)
+		*v = *v << 8 | b[i];
+	return 0;
+}
+
+static int put_u64(FILE *fp, uint64_t v)
+{
+	unsigned char b[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		b[i] = v & 0xff;
+		v >>= 8;
+	}
+	return fwrite(b, 1, sizeof(b), fp) == sizeof(b) ? 0 : -1;
+}
+
+/*
+ * Returns 1, setting errno to ESTALE, if the file at path differs in
+ * size or modification time from the file indexed, or -1 if it can't be
+ * examined, else 0.
+ */
+static int stale(const struct coho_smiles_index *idx, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == -1)
+		return -1;
+	if ((size_t)st.st_size != idx->size ||
+	    st.st_mtim.tv_sec != idx->mtime ||
+	    st.st_mtim.tv_nsec != idx->mtime_nsec) {
+		errno = ESTALE;
+		return 1;
+	}
+	return 0;
+}
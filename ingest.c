@@ -0,0 +1,928 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reads many SMILES files at once, parsing them as they are read.
+ *
+ * The calling thread reads up to queue_depth files at a time, with one
+ * read in flight per file, into a fixed set of buffers.  On Linux the
+ * reads are made with io_uring into buffers registered with the kernel;
+ * elsewhere, or if io_uring is unavailable, with pread().
+ * Each buffer read ends at the last complete line, and the partial line
+ * after it starts the file's next read.  A line too long for that is
+ * read into the file's own memory, also through io_uring if in use.
+ * Parser threads take filled buffers, parse their records and return
+ * them for reuse.
+ *
+ * All memory comes from the caller's allocator.  Long lines are copied
+ * by the reading thread and freed by the parser threads, so their
+ * memory is counted in an allocator of its own, used under the lock.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IORING_OFF_SQES)
+#define INGEST_IO_URING
+#endif
+#endif
+
+#include "coho.h"
+
+#define PAGE_SIZE	4096
+
+/*
+ * Filled buffer, or line too long for a buffer, waiting to be parsed.
+ */
+struct job {
+	struct job *next;
+	char *data;
+	size_t len;
+	size_t offset;		/* offset of data in file */
+	size_t file;
+	int buffer;		/* -1 if data was allocated for the job */
+};
+
+/*
+ * File being read.
+ */
+struct shard {
+	int fd;
+	size_t file;
+	off_t pos;		/* offset of next read */
+	int busy;		/* read in flight */
+
+	/* Partial line following the last complete line read. */
+	char *carry;
+	size_t carry_len;
+	size_t carry_cap;
+	size_t offset;		/* offset of carry in file */
+#ifdef INGEST_IO_URING
+	struct iovec iov;	/* read into carry in flight */
+#endif
+};
+
+#ifdef INGEST_IO_URING
+struct uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	unsigned pending;	/* prepared but not submitted */
+};
+#endif
+
+struct ingest {
+	const struct coho_smiles_ingest *opts;
+	const struct coho_allocator *callbacks;	/* for each context */
+	struct coho_allocator allocator;	/* for the reading thread */
+	struct coho_allocator job_allocator;	/* for long lines */
+	const char *const *paths;
+	size_t npaths;
+	int (*fn)(void *, struct coho_smiles *,
+	    const struct coho_smiles_record *, int);
+	void *ud;
+
+	struct coho_smiles x;	/* for the reading thread */
+
+	char *memory;		/* all buffers, aligned to a page */
+	char *block;		/* memory as allocated */
+	size_t block_size;
+	struct job *jobs;	/* one per buffer */
+	struct shard *shards;	/* one per queue slot */
+
+	pthread_mutex_t lock;
+	pthread_cond_t job_cond;
+	pthread_cond_t free_cond;
+	struct job *queue;
+	struct job **queue_tail;
+	int *free;		/* stack of empty buffers */
+	int free_count;
+	int done;
+	int stop;
+	int error;		/* errno value of first failure */
+	int result;		/* nonzero return value of fn */
+
+#ifdef INGEST_IO_URING
+	struct uring ring;
+	int use_ring;
+#endif
+	int inflight;
+};
+
+static int complete(struct ingest *, struct shard *, int, ssize_t);
+static int complete_long_line(struct ingest *, struct shard *, ssize_t);
+static int drive(struct ingest *);
+static void finish(struct ingest *, int, int);
+static void free_job(struct ingest *, struct job *);
+static int grow(struct ingest *, char **, size_t *, size_t);
+static void *parse(void *);
+static void parse_job(struct ingest *, struct coho_smiles *, struct job *);
+static struct job *pop(struct ingest *, int);
+static void push(struct ingest *, struct job *);
+static int read_long_line(struct ingest *, struct shard *);
+static void release(struct ingest *, int);
+static int start_read(struct ingest *, struct shard *, int);
+static int take_buffer(struct ingest *, int);
+#ifdef INGEST_IO_URING
+static int uring_init(struct uring *, struct ingest *);
+static void uring_free(struct uring *);
+static void uring_read(struct ingest *, struct shard *, int, int, void *,
+    size_t);
+static int uring_wait(struct ingest *);
+#endif
+
+/*
+ * Sets the default options: one parsing thread, eight files read at
+ * once, 32 buffers of 1 MiB, and io_uring if available.
+ */
+void coho_smiles_ingest_init(struct coho_smiles_ingest *opts)
+{
+	opts->nthreads = 1;
+	opts->queue_depth = 8;
+	opts->buffers = 32;
+	opts->buffer_size = 1 << 20;
+	opts->flags = 0;
+	opts->io_uring = 1;
+}
+
+/*
+ * Reads the npaths SMILES files at paths, calling fn for every record
+ * as coho_smiles_read_gz() does.
+ * The file field of each record is the index of its file in paths.
+ * Returns 0 once every record has been read, the nonzero value returned
+ * by fn, or -1 on failure, setting errno.
+ */
+int coho_smiles_read_files(const struct coho_smiles_ingest *opts,
+    const char *const *paths, size_t npaths,
+    int (*fn)(void *, struct coho_smiles *,
+    const struct coho_smiles_record *, int), void *ud)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	return coho_smiles_read_files_with_allocator(opts, &a, paths, npaths,
+	    fn, ud);
+}
+
+/*
+ * Reads files like coho_smiles_read_files(), allocating memory,
+ * including that of each thread's context, through allocator.
+ * The allocator must therefore be safe to call from several threads at
+ * once.  The buffers are allocated as one block, a page larger than
+ * needed so that they can start on a page.
+ */
+int coho_smiles_read_files_with_allocator(
+    const struct coho_smiles_ingest *opts,
+    const struct coho_allocator *allocator, const char *const *paths,
+    size_t npaths, int (*fn)(void *, struct coho_smiles *,
+    const struct coho_smiles_record *, int), void *ud)
+{
+	struct coho_allocator *a;
+	struct ingest g;
+	pthread_t *parsers;
+	int *started;
+#ifdef INGEST_IO_URING
+	int inflight;
+#endif
+	int i, nthreads, depth, nbuffers, rc = -1;
+
+	nthreads = opts->nthreads > 0 ? opts->nthreads : 1;
+	depth = opts->queue_depth > 0 ? opts->queue_depth : 1;
+	nbuffers = opts->buffers > 0 ? opts->buffers : 1;
+	if (opts->buffer_size < 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&g, 0, sizeof(g));
+	g.opts = opts;
+	g.paths = paths;
+	g.npaths = npaths;
+	g.fn = fn;
+	g.ud = ud;
+	g.queue_tail = &g.queue;
+	g.callbacks = allocator;
+	g.allocator = *allocator;
+	g.job_allocator = *allocator;
+	a = &g.allocator;
+
+	parsers = coho_mem_alloc(a, nthreads, sizeof(parsers[0]));
+	started = coho_mem_alloc(a, nthreads, sizeof(started[0]));
+	g.jobs = coho_mem_alloc(a, nbuffers, sizeof(g.jobs[0]));
+	g.free = coho_mem_alloc(a, nbuffers, sizeof(g.free[0]));
+	if ((g.shards = coho_mem_alloc(a, depth, sizeof(g.shards[0]))) !=
+	    NULL) {
+		memset(g.shards, 0, depth * sizeof(g.shards[0]));
+		for (i = 0; i < depth; i++)
+			g.shards[i].fd = -1;
+	}
+	if ((size_t)nbuffers <= ((size_t)-1 - PAGE_SIZE) / opts->buffer_size) {
+		g.block_size = nbuffers * opts->buffer_size + PAGE_SIZE - 1;
+		g.block = coho_mem_alloc(a, g.block_size, 1);
+	}
+	if (parsers == NULL || started == NULL || g.jobs == NULL ||
+	    g.free == NULL || g.shards == NULL || g.block == NULL) {
+		errno = ENOMEM;
+		goto done;
+	}
+	memset(started, 0, nthreads * sizeof(started[0]));
+	memset(g.jobs, 0, nbuffers * sizeof(g.jobs[0]));
+	g.memory = g.block + (PAGE_SIZE - (uintptr_t)g.block % PAGE_SIZE) %
+	    PAGE_SIZE;
+
+	for (i = 0; i < nbuffers; i++) {
+		g.jobs[i].data = g.memory + i * opts->buffer_size;
+		g.jobs[i].buffer = i;
+		g.free[g.free_count++] = i;
+	}
+
+#ifdef INGEST_IO_URING
+	g.use_ring = opts->io_uring && uring_init(&g.ring, &g) == 0;
+#endif
+
+	pthread_mutex_init(&g.lock, NULL);
+	pthread_cond_init(&g.job_cond, NULL);
+	pthread_cond_init(&g.free_cond, NULL);
+
+	for (i = 1; i < nthreads; i++)
+		started[i] = pthread_create(&parsers[i], NULL, parse, &g) == 0;
+
+	coho_smiles_init_with_allocator(&g.x, allocator);
+	g.x.flags = opts->flags;
+	if (drive(&g))
+		finish(&g, errno, 0);
+	coho_smiles_free(&g.x);
+
+#ifdef INGEST_IO_URING
+	/* Buffers can't be reused until the kernel is done with them. */
+	while (g.inflight > 0) {
+		inflight = g.inflight;
+		uring_wait(&g);
+		if (g.inflight == inflight)
+			break;
+	}
+#endif
+
+	pthread_mutex_lock(&g.lock);
+	g.done = 1;
+	pthread_cond_broadcast(&g.job_cond);
+	pthread_mutex_unlock(&g.lock);
+
+	/* Jobs left for lack of threads are parsed now. */
+	parse(&g);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(parsers[i], NULL);
+	}
+
+	if (g.error) {
+		errno = g.error;
+		rc = -1;
+	} else {
+		rc = g.result;
+	}
+
+#ifdef INGEST_IO_URING
+	if (g.use_ring)
+		uring_free(&g.ring);
+#endif
+	pthread_cond_destroy(&g.free_cond);
+	pthread_cond_destroy(&g.job_cond);
+	pthread_mutex_destroy(&g.lock);
+done:
+	if (g.shards != NULL) {
+		for (i = 0; i < depth; i++) {
+			if (g.shards[i].fd != -1)
+				close(g.shards[i].fd);
+			coho_mem_free(a, g.shards[i].carry,
+			    g.shards[i].carry_cap, 1);
+		}
+	}
+	coho_mem_free(a, g.shards, depth, sizeof(g.shards[0]));
+	coho_mem_free(a, g.block, g.block_size, 1);
+	coho_mem_free(a, g.jobs, nbuffers, sizeof(g.jobs[0]));
+	coho_mem_free(a, g.free, nbuffers, sizeof(g.free[0]));
+	coho_mem_free(a, started, nthreads, sizeof(started[0]));
+	coho_mem_free(a, parsers, nthreads, sizeof(parsers[0]));
+	return rc;
+}
+
+/*
+ * Handles the completion of a read of n bytes into buffer i for s.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int complete(struct ingest *g, struct shard *s, int i, ssize_t n)
+{
+	struct job *j = &g->jobs[i];
+	size_t total, keep;
+	int eof;
+
+	s->busy = 0;
+	if (n < 0) {
+		release(g, i);
+		errno = -n;
+		return -1;
+	}
+
+	/* The buffer starts with the previous partial line. */
+	total = s->carry_len + n;
+	s->pos += n;
+	eof = n == 0;
+
+	if (eof) {
+		keep = total;
+	} else {
+		for (keep = total; keep > 0 && j->data[keep - 1] != '\n';
+		    keep--)
+			;
+	}
+
+	s->carry_len = total - keep;
+	if (grow(g, &s->carry, &s->carry_cap, s->carry_len)) {
+		release(g, i);
+		return -1;
+	}
+	if (s->carry_len > 0)
+		memcpy(s->carry, j->data + keep, s->carry_len);
+
+	if (keep > 0) {
+		j->len = keep;
+		j->offset = s->offset;
+		j->file = s->file;
+		s->offset += keep;
+		push(g, j);
+	} else {
+		release(g, i);
+	}
+
+	if (eof) {
+		close(s->fd);
+		s->fd = -1;
+		return 0;
+	}
+
+	/* Leave room for at least half a buffer of new data. */
+	return read_long_line(g, s);
+}
+
+/*
+ * Handles the completion of a read of n bytes into the partial line of
+ * s, queuing the line as a job of its own if it is now complete.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int complete_long_line(struct ingest *g, struct shard *s, ssize_t n)
+{
+	struct job *j;
+	size_t keep;
+
+	s->busy = 0;
+	if (n < 0) {
+		errno = -n;
+		return -1;
+	}
+	s->carry_len += n;
+	s->pos += n;
+	if (n > 0 && memchr(s->carry + s->carry_len - n, '\n', n) == NULL)
+		return 0;
+
+	if (n == 0) {
+		keep = s->carry_len;
+	} else {
+		for (keep = s->carry_len; s->carry[keep - 1] != '\n'; keep--)
+			;
+	}
+
+	pthread_mutex_lock(&g->lock);
+	if ((j = coho_mem_alloc(&g->job_allocator, 1, sizeof(*j))) != NULL &&
+	    (j->data = coho_mem_alloc(&g->job_allocator, keep, 1)) == NULL) {
+		coho_mem_free(&g->job_allocator, j, 1, sizeof(*j));
+		j = NULL;
+	}
+	pthread_mutex_unlock(&g->lock);
+	if (j == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(j->data, s->carry, keep);
+	j->len = keep;
+	j->offset = s->offset;
+	j->file = s->file;
+	j->buffer = -1;
+	push(g, j);
+
+	memmove(s->carry, s->carry + keep, s->carry_len - keep);
+	s->carry_len -= keep;
+	s->offset += keep;
+
+	if (n == 0) {
+		close(s->fd);
+		s->fd = -1;
+	}
+	return 0;
+}
+
+/*
+ * Reads every file, keeping up to queue_depth of them open.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int drive(struct ingest *g)
+{
+	struct shard *s;
+	struct job *j;
+	size_t next = 0;
+	int k, i, active, depth, stop;
+
+	depth = g->opts->queue_depth > 0 ? g->opts->queue_depth : 1;
+
+	for (;;) {
+		pthread_mutex_lock(&g->lock);
+		stop = g->stop;
+		pthread_mutex_unlock(&g->lock);
+
+		active = 0;
+		for (k = 0; k < depth; k++) {
+			s = &g->shards[k];
+			if (s->fd == -1 && !stop && next < g->npaths) {
+				if ((s->fd = open(g->paths[next],
+				    O_RDONLY)) == -1)
+					return -1;
+				s->file = next++;
+				s->pos = 0;
+				s->carry_len = 0;
+				s->offset = 0;
+			}
+			if (s->fd == -1)
+				continue;
+			active++;
+			if (s->busy || stop)
+				continue;
+			if ((i = take_buffer(g, 0)) == -1)
+				continue;
+			if (start_read(g, s, i))
+				return -1;
+		}
+
+		if (g->inflight > 0) {
+#ifdef INGEST_IO_URING
+			if (uring_wait(g))
+				return -1;
+#endif
+		} else if (stop || active == 0) {
+			break;
+		} else if ((j = pop(g, 0)) != NULL) {
+			/* Help parse rather than wait for a buffer. */
+			parse_job(g, &g->x, j);
+		} else if ((i = take_buffer(g, 1)) != -1) {
+			release(g, i);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Stops reading, recording the first failure or nonzero result of the
+ * callback.
+ */
+static void finish(struct ingest *g, int error, int result)
+{
+	pthread_mutex_lock(&g->lock);
+	if (!g->stop) {
+		g->error = error;
+		g->result = result;
+		g->stop = 1;
+	}
+	pthread_cond_broadcast(&g->job_cond);
+	pthread_cond_broadcast(&g->free_cond);
+	pthread_mutex_unlock(&g->lock);
+}
+
+/*
+ * Frees j, a job for a long line.  The lock must be held.
+ */
+static void free_job(struct ingest *g, struct job *j)
+{
+	coho_mem_free(&g->job_allocator, j->data, j->len, 1);
+	coho_mem_free(&g->job_allocator, j, 1, sizeof(*j));
+}
+
+/*
+ * Ensures that the buffer at *p has room for at least need bytes.
+ * Returns 0 on success or -1 if memory could not be allocated, setting
+ * errno.
+ */
+static int grow(struct ingest *g, char **p, size_t *cap, size_t need)
+{
+	char *np;
+
+	if (*cap >= need)
+		return 0;
+	if (need < 2 * *cap)
+		need = 2 * *cap;
+	if ((np = coho_mem_realloc(&g->allocator, *p, *cap, need, 1)) ==
+	    NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	*p = np;
+	*cap = need;
+	return 0;
+}
+
+/*
+ * Parses queued jobs until none remain and reading is done, or until
+ * reading stops.
+ */
+static void *parse(void *arg)
+{
+	struct ingest *g = arg;
+	struct coho_smiles x;
+	struct job *j;
+
+	coho_smiles_init_with_allocator(&x, g->callbacks);
+	x.flags = g->opts->flags;
+
+	while ((j = pop(g, 1)) != NULL)
+		parse_job(g, &x, j);
+
+	/* Jobs left by a stop are discarded. */
+	pthread_mutex_lock(&g->lock);
+	while ((j = g->queue) != NULL) {
+		g->queue = j->next;
+		if (j->buffer == -1)
+			free_job(g, j);
+	}
+	g->queue_tail = &g->queue;
+	pthread_mutex_unlock(&g->lock);
+
+	coho_smiles_free(&x);
+	return NULL;
+}
+
+/*
+ * Parses the records of j with x and releases j.
+ */
+static void parse_job(struct ingest *g, struct coho_smiles *x, struct job *j)
+{
+	struct coho_smiles_file f;
+	struct coho_smiles_record rec;
+	int rc, result;
+
+	coho_smiles_file_init(&f, j->data, j->len);
+	while (coho_smiles_file_next(&f, &rec)) {
+		rec.offset += j->offset;
+		rec.file = j->file;
+		rc = coho_smiles_read(x, rec.smiles, rec.smiles_length);
+		if (rc == COHO_NOMEM) {
+			finish(g, ENOMEM, 0);
+			break;
+		}
+		if ((result = g->fn(g->ud, x, &rec, rc)) != 0) {
+			finish(g, 0, result);
+			break;
+		}
+	}
+
+	if (j->buffer != -1) {
+		release(g, j->buffer);
+	} else {
+		pthread_mutex_lock(&g->lock);
+		free_job(g, j);
+		pthread_mutex_unlock(&g->lock);
+	}
+}
+
+/*
+ * Takes the next job from the queue, waiting for one if wait is set.
+ * Returns NULL if none is queued, or if reading is done or has stopped.
+ */
+static struct job *pop(struct ingest *g, int wait)
+{
+	struct job *j = NULL;
+
+	pthread_mutex_lock(&g->lock);
+	while (wait && g->queue == NULL && !g->done && !g->stop)
+		pthread_cond_wait(&g->job_cond, &g->lock);
+	if (g->queue != NULL && !g->stop) {
+		j = g->queue;
+		if ((g->queue = j->next) == NULL)
+			g->queue_tail = &g->queue;
+	}
+	pthread_mutex_unlock(&g->lock);
+	return j;
+}
+
+/*
+ * Queues a job for the parser threads.
+ */
+static void push(struct ingest *g, struct job *j)
+{
+	pthread_mutex_lock(&g->lock);
+	j->next = NULL;
+	*g->queue_tail = j;
+	g->queue_tail = &j->next;
+	pthread_cond_signal(&g->job_cond);
+	pthread_mutex_unlock(&g->lock);
+}
+
+/*
+ * Reads the rest of a partial line too long to share a buffer with the
+ * next read, if s has one, queuing it as a job of its own.
+ * With io_uring, each read is only submitted here, and the line is
+ * finished as the reads complete.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int read_long_line(struct ingest *g, struct shard *s)
+{
+	size_t chunk = g->opts->buffer_size;
+	ssize_t n;
+
+	while (s->fd != -1 && s->carry_len >= chunk / 2) {
+		if (grow(g, &s->carry, &s->carry_cap, s->carry_len + chunk))
+			return -1;
+#ifdef INGEST_IO_URING
+		if (g->use_ring) {
+			uring_read(g, s, -1, IORING_OP_READV,
+			    s->carry + s->carry_len, chunk);
+			return 0;
+		}
+#endif
+		do {
+			n = pread(s->fd, s->carry + s->carry_len, chunk,
+			    s->pos);
+		} while (n == -1 && errno == EINTR);
+		if (complete_long_line(g, s, n == -1 ? -errno : n))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns buffer i to the free buffers.
+ */
+static void release(struct ingest *g, int i)
+{
+	pthread_mutex_lock(&g->lock);
+	g->free[g->free_count++] = i;
+	pthread_cond_signal(&g->free_cond);
+	pthread_mutex_unlock(&g->lock);
+}
+
+/*
+ * Starts the next read of s into buffer i, beginning with its partial
+ * line.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int start_read(struct ingest *g, struct shard *s, int i)
+{
+	char *p = g->jobs[i].data;
+	size_t len = g->opts->buffer_size - s->carry_len;
+	ssize_t n;
+
+	if (s->carry_len > 0)
+		memcpy(p, s->carry, s->carry_len);
+	p += s->carry_len;
+	s->busy = 1;
+
+#ifdef INGEST_IO_URING
+	if (g->use_ring) {
+		uring_read(g, s, i, IORING_OP_READ_FIXED, p, len);
+		return 0;
+	}
+#endif
+
+	do {
+		n = pread(s->fd, p, len, s->pos);
+	} while (n == -1 && errno == EINTR);
+	return complete(g, s, i, n == -1 ? -errno : n);
+}
+
+/*
+ * Takes a free buffer, waiting for one if wait is set.
+ * Returns its index, or -1 if none is free or reading has stopped.
+ */
+static int take_buffer(struct ingest *g, int wait)
+{
+	int i = -1;
+
+	pthread_mutex_lock(&g->lock);
+	while (wait && g->free_count == 0 && !g->stop)
+		pthread_cond_wait(&g->free_cond, &g->lock);
+	if (g->free_count > 0)
+		i = g->free[--g->free_count];
+	pthread_mutex_unlock(&g->lock);
+	return i;
+}
+
+#ifdef INGEST_IO_URING
+
+/*
+ * Sets up a ring with one entry per queue slot and registers the
+ * buffers.
+ * Returns 0 on success or -1 on failure.
+ */
+static int uring_init(struct uring *r, struct ingest *g)
+{
+	struct io_uring_params p;
+	struct iovec *iov;
+	unsigned char *sq, *cq;
+	int i, nbuffers, rc;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = syscall(__NR_io_uring_setup, g->opts->queue_depth > 0 ?
+	    g->opts->queue_depth : 1, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_ring_size = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ring = r->sq_ring;
+	} else {
+		r->cq_ring = mmap(NULL, r->cq_ring_size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+		    IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail;
+
+	sq = r->sq_ring;
+	cq = r->cq_ring;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	nbuffers = g->opts->buffers > 0 ? g->opts->buffers : 1;
+	if ((iov = coho_mem_alloc(&g->allocator, nbuffers,
+	    sizeof(iov[0]))) == NULL)
+		goto fail;
+	for (i = 0; i < nbuffers; i++) {
+		iov[i].iov_base = g->jobs[i].data;
+		iov[i].iov_len = g->opts->buffer_size;
+	}
+	rc = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+	    iov, nbuffers);
+	coho_mem_free(&g->allocator, iov, nbuffers, sizeof(iov[0]));
+	if (rc < 0)
+		goto fail;
+	return 0;
+
+fail:
+	uring_free(r);
+	return -1;
+}
+
+static void uring_free(struct uring *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED &&
+	    r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_size);
+	close(r->fd);
+}
+
+/*
+ * Prepares a read of len bytes at p for s, into buffer i, or into its
+ * partial line if i is -1.
+ * The buffer and shard are packed into the user data, with i + 1 in the
+ * low 32 bits.
+ */
+static void uring_read(struct ingest *g, struct shard *s, int i, int op,
+    void *p, size_t len)
+{
+	struct uring *r = &g->ring;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *r->sq_tail;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = s->fd;
+	sqe->off = s->pos;
+	if (op == IORING_OP_READ_FIXED) {
+		sqe->addr = (uint64_t)(uintptr_t)p;
+		sqe->len = len;
+		sqe->buf_index = i;
+	} else {
+		s->iov.iov_base = p;
+		s->iov.iov_len = len;
+		sqe->addr = (uint64_t)(uintptr_t)&s->iov;
+		sqe->len = 1;
+	}
+	sqe->user_data = (uint64_t)(s - g->shards) << 32 | (uint32_t)(i + 1);
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->pending++;
+	g->inflight++;
+	s->busy = 1;
+}
+
+/*
+ * Submits the prepared reads, waits for at least one to complete and
+ * handles every completed read.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+static int uring_wait(struct ingest *g)
+{
+	struct uring *r = &g->ring;
+	struct io_uring_cqe *cqe;
+	struct shard *s;
+	unsigned head, tail;
+	uint64_t data;
+	int i, n, rc = 0;
+
+	do {
+		n = syscall(__NR_io_uring_enter, r->fd, r->pending, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+		if (n >= 0) {
+			r->pending -= n;
+			break;
+		}
+	} while (errno == EINTR);
+	if (n < 0)
+		return -1;
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		data = cqe->user_data;
+		s = &g->shards[data >> 32];
+		i = (int)(data & 0xffffffff) - 1;
+		g->inflight--;
+		if (i == -1) {
+			if ((complete_long_line(g, s, cqe->res) ||
+			    read_long_line(g, s)) && rc == 0)
+				rc = -1;
+		} else if (complete(g, s, i, cqe->res) && rc == 0) {
+			rc = -1;
+		}
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return rc;
+}
+
+#endif /* INGEST_IO_URING */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Helpers shared by the modules of the library but not part of its
+ * interface.  Include after <stdint.h> and coho.h.
+ */
+
+/*
+ * Finalizer of SplitMix64, which spreads the bits of v over the result.
+ */
+static inline uint64_t mix(uint64_t v)
+{
+	v = (v ^ (v >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+	return v ^ (v >> 31);
+}
+
+/*
+ * Scratch arrays, whose contents need not be kept when they grow.
+ * Their owner p has an allocator, capacities atoms_cap and bonds_cap,
+ * and an ARRAYS(X) list giving each array and its length, which is
+ * determined by the capacities, as X(p, name, length).
+ * Passed to ARRAYS(), SCRATCH_INIT sets the arrays to NULL,
+ * SCRATCH_ALLOC allocates them, going to fail if it can't, and
+ * SCRATCH_FREE frees them.
+ */
+#define SCRATCH_INIT(p, name, n) \
+	(p)->name = NULL;
+#define SCRATCH_ALLOC(p, name, n) \
+	if (((p)->name = coho_mem_alloc(&(p)->allocator, (n), \
+	    sizeof((p)->name[0]))) == NULL) \
+		goto fail;
+#define SCRATCH_FREE(p, name, n) \
+	coho_mem_free(&(p)->allocator, (p)->name, (n), \
+	    sizeof((p)->name[0])); \
+	(p)->name = NULL;
+
+int coho_rank_atoms(struct coho_smiles_writer *,
+    const struct coho_smiles *, const int *, int, int *);
+size_t coho_scratch_cap(size_t, size_t);
+void coho_sort(void *, size_t, size_t, int (*)(const void *, const void *));
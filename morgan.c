@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Circular fingerprints, in the manner of Morgan and ECFP.
+ *
+ * Each atom starts with a 64-bit identifier hashed from its element,
+ * isotope, charge, hydrogen count, aromaticity, number of neighbors and
+ * whether it is in a ring.  At each radius up to the fingerprint's, an
+ * atom's identifier is hashed from the radius, its own identifier, and
+ * the identifiers of its neighbors together with the orders of the
+ * bonds to them, sorted so that their order doesn't matter.  Every
+ * identifier of every atom at every radius is a feature.
+ *
+ * Unlike ECFP, features covering the same bonds as another are not
+ * removed, which only affects counts.
+ *
+ * Atoms and bonds are first copied into neighbor lists of the
+ * fingerprint's own, so that parse results and batch columns are
+ * treated alike.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "internal.h"
+
+/*
+ * Scratch arrays of fingerprint f and their lengths (see internal.h).
+ */
+#define ARRAYS(X) \
+	X(f, ids, f->atoms_cap) \
+	X(f, next_ids, f->atoms_cap) \
+	X(f, features, f->atoms_cap * (f->radius + 1)) \
+	X(f, pairs, f->bonds_cap) \
+	X(f, neighbor_offsets, f->atoms_cap + 1) \
+	X(f, neighbor_atoms, 2 * f->bonds_cap) \
+	X(f, neighbor_bonds, 2 * f->bonds_cap) \
+	X(f, bond_orders, f->bonds_cap) \
+	X(f, ring_bonds, f->bonds_cap) \
+	X(f, visits, f->atoms_cap) \
+	X(f, lows, f->atoms_cap) \
+	X(f, parent_bonds, f->atoms_cap) \
+	X(f, next, f->atoms_cap) \
+	X(f, stack, f->atoms_cap)
+
+static uint64_t atom_id(int, int, int, int, int);
+static uint64_t combine(uint64_t, uint64_t);
+static int compare_ids(const void *, const void *);
+static void find_ring_bonds(struct coho_fingerprint *, int);
+static void free_arrays(struct coho_fingerprint *);
+static void grow(struct coho_fingerprint *, int);
+static void load_columns(struct coho_fingerprint *,
+    const struct coho_smiles_columns *, size_t, size_t, int, int);
+static int load_smiles(struct coho_fingerprint *,
+    const struct coho_smiles *);
+static void put_bits(const struct coho_fingerprint *, unsigned long long *);
+
+/*
+ * Computes the fingerprints of count molecules of b, starting with
+ * molecule first, and stores them one after another in bits, each
+ * taking COHO_FINGERPRINT_WORDS(f->length) words.  Molecules that could
+ * not be parsed have empty fingerprints.
+ * Several threads may share out the molecules of a batch, each with a
+ * fingerprint of its own.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_fingerprint_batch(struct coho_fingerprint *f,
+    const struct coho_smiles_batch *b, size_t first, size_t count,
+    unsigned long long *bits)
+{
+	size_t i, atom, bond, words = COHO_FINGERPRINT_WORDS(f->length);
+	int n, m;
+
+	for (i = first; i < first + count; i++, bits += words) {
+		atom = b->atom_offsets[i];
+		bond = b->bond_offsets[i];
+		n = b->atom_offsets[i + 1] - atom;
+		m = b->bond_offsets[i + 1] - bond;
+		if (coho_fingerprint_reserve(f, n, m))
+			return COHO_NOMEM;
+		load_columns(f, &b->columns, atom, bond, n, m);
+		grow(f, n);
+		put_bits(f, bits);
+	}
+	return COHO_OK;
+}
+
+/*
+ * Computes the fingerprint of x, which must hold a parsed molecule, and
+ * stores it in the COHO_FINGERPRINT_WORDS(f->length) words of bits.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_fingerprint_bits(struct coho_fingerprint *f,
+    const struct coho_smiles *x, unsigned long long *bits)
+{
+	if (load_smiles(f, x))
+		return COHO_NOMEM;
+	grow(f, x->atom_count);
+	put_bits(f, bits);
+	return COHO_OK;
+}
+
+/*
+ * Computes the features of x, which must hold a parsed molecule, and
+ * stores up to cap of them in counts, ordered by identifier.  The
+ * number of distinct features, which may be more than cap, is stored in
+ * *count.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_fingerprint_counts(struct coho_fingerprint *f,
+    const struct coho_smiles *x, struct coho_fingerprint_count *counts,
+    size_t cap, size_t *count)
+{
+	size_t i, n = 0;
+
+	if (load_smiles(f, x))
+		return COHO_NOMEM;
+	grow(f, x->atom_count);
+	coho_sort(f->features, f->feature_count, sizeof(f->features[0]),
+	    compare_ids);
+
+	for (i = 0; i < f->feature_count; i++) {
+		if (i > 0 && f->features[i] == f->features[i - 1]) {
+			if (n <= cap)
+				counts[n - 1].count++;
+			continue;
+		}
+		if (n < cap) {
+			counts[n].id = f->features[i];
+			counts[n].count = 1;
+		}
+		n++;
+	}
+	*count = n;
+	return COHO_OK;
+}
+
+void coho_fingerprint_free(struct coho_fingerprint *f)
+{
+	free_arrays(f);
+}
+
+void coho_fingerprint_init(struct coho_fingerprint *f, int radius,
+    size_t length)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_fingerprint_init_with_allocator(f, radius, length, &a);
+}
+
+/*
+ * Initializes a fingerprint of the given radius, folded to length bits,
+ * that obtains all of its memory from allocator.
+ */
+void coho_fingerprint_init_with_allocator(struct coho_fingerprint *f,
+    int radius, size_t length, const struct coho_allocator *allocator)
+{
+	f->allocator = *allocator;
+	f->allocator.held = 0;
+	f->radius = radius;
+	f->length = length;
+	f->feature_count = 0;
+	f->atoms_cap = 0;
+	f->bonds_cap = 0;
+
+	ARRAYS(SCRATCH_INIT)
+}
+
+/*
+ * Ensures that the fingerprint has room for a molecule of the given
+ * numbers of atoms and bonds.
+ * Returns 0 on success or -1 if memory could not be allocated, in which
+ * case the fingerprint holds no memory.
+ */
+int coho_fingerprint_reserve(struct coho_fingerprint *f, size_t atoms,
+    size_t bonds)
+{
+	size_t atoms_cap, bonds_cap;
+
+	if (atoms <= f->atoms_cap && bonds <= f->bonds_cap && f->ids != NULL)
+		return 0;
+
+	atoms_cap = coho_scratch_cap(f->atoms_cap, atoms);
+	bonds_cap = coho_scratch_cap(f->bonds_cap, bonds);
+	free_arrays(f);
+	f->atoms_cap = atoms_cap;
+	f->bonds_cap = bonds_cap;
+	ARRAYS(SCRATCH_ALLOC)
+	return 0;
+
+fail:
+	free_arrays(f);
+	return -1;
+}
+
+/*
+ * Returns the part of an atom's starting identifier that doesn't depend
+ * on its neighbors.
+ */
+static uint64_t atom_id(int atomic_number, int isotope, int charge,
+    int hydrogens, int aromatic)
+{
+	return mix((uint64_t)(atomic_number & 0xff) |
+	    (uint64_t)((isotope + 1) & 0xfffff) << 8 |
+	    (uint64_t)((charge + 128) & 0xff) << 28 |
+	    (uint64_t)(hydrogens & 0xff) << 36 |
+	    (uint64_t)(aromatic != 0) << 44);
+}
+
+/*
+ * Returns a hash of h followed by v.
+ */
+static uint64_t combine(uint64_t h, uint64_t v)
+{
+	return mix(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
+static int compare_ids(const void *p, const void *q)
+{
+	const unsigned long long *a = p, *b = q;
+
+	if (*a != *b)
+		return *a < *b ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Marks the bonds of the first n atoms that are in rings, being those
+ * whose removal would not disconnect their atoms, found by Tarjan's
+ * depth-first search for bridges.
+ */
+static void find_ring_bonds(struct coho_fingerprint *f, int n)
+{
+	int i, j, s, u, v, b, top, time = 0;
+
+	for (i = 0; i < n; i++)
+		f->visits[i] = -1;
+	memset(f->ring_bonds, 1, f->neighbor_offsets[n] / 2);
+
+	for (s = 0; s < n; s++) {
+		if (f->visits[s] != -1)
+			continue;
+		top = 0;
+		f->stack[0] = s;
+		f->visits[s] = f->lows[s] = time++;
+		f->parent_bonds[s] = -1;
+		f->next[s] = f->neighbor_offsets[s];
+
+		while (top >= 0) {
+			v = f->stack[top];
+			if (f->next[v] < f->neighbor_offsets[v + 1]) {
+				j = f->next[v]++;
+				u = f->neighbor_atoms[j];
+				b = f->neighbor_bonds[j];
+				if (b == f->parent_bonds[v])
+					continue;
+				if (f->visits[u] == -1) {
+					f->visits[u] = f->lows[u] = time++;
+					f->parent_bonds[u] = b;
+					f->next[u] = f->neighbor_offsets[u];
+					f->stack[++top] = u;
+				} else if (f->visits[u] < f->lows[v]) {
+					f->lows[v] = f->visits[u];
+				}
+				continue;
+			}
+			if (--top < 0)
+				break;
+			u = f->stack[top];
+			if (f->lows[v] < f->lows[u])
+				f->lows[u] = f->lows[v];
+			if (f->lows[v] > f->visits[u])
+				f->ring_bonds[f->parent_bonds[v]] = 0;
+		}
+	}
+}
+
+static void free_arrays(struct coho_fingerprint *f)
+{
+	ARRAYS(SCRATCH_FREE)
+	f->atoms_cap = 0;
+	f->bonds_cap = 0;
+	f->feature_count = 0;
+}
+
+/*
+ * Computes the features of the n atoms loaded into f, whose identifiers
+ * hold their starting values so far.
+ */
+static void grow(struct coho_fingerprint *f, int n)
+{
+	unsigned long long *t;
+	int i, j, k, r, first, last, ring;
+
+	find_ring_bonds(f, n);
+	for (i = 0; i < n; i++) {
+		first = f->neighbor_offsets[i];
+		last = f->neighbor_offsets[i + 1];
+		for (j = first, ring = 0; j < last && !ring; j++)
+			ring = f->ring_bonds[f->neighbor_bonds[j]];
+		f->ids[i] = combine(f->ids[i], (uint64_t)(last - first) << 1 |
+		    ring);
+		f->features[i] = f->ids[i];
+	}
+	f->feature_count = n;
+
+	for (r = 1; r <= f->radius; r++) {
+		for (i = 0; i < n; i++) {
+			first = f->neighbor_offsets[i];
+			last = f->neighbor_offsets[i + 1];
+			for (j = first, k = 0; j < last; j++, k++) {
+				f->pairs[k] = combine(
+				    f->bond_orders[f->neighbor_bonds[j]],
+				    f->ids[f->neighbor_atoms[j]]);
+			}
+			coho_sort(f->pairs, k, sizeof(f->pairs[0]),
+			    compare_ids);
+			f->next_ids[i] = combine(r, f->ids[i]);
+			for (j = 0; j < k; j++)
+				f->next_ids[i] = combine(f->next_ids[i],
+				    f->pairs[j]);
+			f->features[f->feature_count++] = f->next_ids[i];
+		}
+		t = f->ids;
+		f->ids = f->next_ids;
+		f->next_ids = t;
+	}
+}
+
+/*
+ * Loads n atoms and m bonds of columns c, starting with the given atom
+ * and bond, into f, which must have room for them.
+ */
+static void load_columns(struct coho_fingerprint *f,
+    const struct coho_smiles_columns *c, size_t atom, size_t bond, int n,
+    int m)
+{
+	size_t a;
+	int i, j, k, hydrogens;
+
+	for (i = 0; i <= n; i++)
+		f->neighbor_offsets[i] = 0;
+	for (k = 0; k < m; k++) {
+		f->neighbor_offsets[c->atom0[bond + k] + 1]++;
+		f->neighbor_offsets[c->atom1[bond + k] + 1]++;
+		f->bond_orders[k] = c->order[bond + k];
+	}
+	for (i = 0; i < n; i++) {
+		f->neighbor_offsets[i + 1] += f->neighbor_offsets[i];
+		f->next[i] = f->neighbor_offsets[i];
+	}
+	for (k = 0; k < m; k++) {
+		i = c->atom0[bond + k];
+		j = c->atom1[bond + k];
+		f->neighbor_atoms[f->next[i]] = j;
+		f->neighbor_bonds[f->next[i]++] = k;
+		f->neighbor_atoms[f->next[j]] = i;
+		f->neighbor_bonds[f->next[j]++] = k;
+	}
+
+	for (i = 0; i < n; i++) {
+		a = atom + i;
+		hydrogens = c->hydrogen_count[a];
+		if (hydrogens < 0)
+			hydrogens = c->implicit_hydrogen_count[a];
+		if (hydrogens < 0)
+			hydrogens = 0;
+		f->ids[i] = atom_id(c->atomic_number[a], c->isotope[a],
+		    c->charge[a], hydrogens, c->is_aromatic[a]);
+	}
+}
+
+/*
+ * Loads the atoms and bonds of x into f.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int load_smiles(struct coho_fingerprint *f,
+    const struct coho_smiles *x)
+{
+	const struct coho_smiles_atom *a;
+	int i, n = x->neighbor_offsets[x->atom_count];
+
+	if (coho_fingerprint_reserve(f, x->atom_count, x->bond_count))
+		return -1;
+
+	memcpy(f->neighbor_offsets, x->neighbor_offsets,
+	    (x->atom_count + 1) * sizeof(f->neighbor_offsets[0]));
+	memcpy(f->neighbor_atoms, x->neighbor_atoms,
+	    n * sizeof(f->neighbor_atoms[0]));
+	memcpy(f->neighbor_bonds, x->neighbor_bonds,
+	    n * sizeof(f->neighbor_bonds[0]));
+	for (i = 0; i < x->bond_count; i++)
+		f->bond_orders[i] = x->bonds[i].order;
+
+	for (i = 0; i < x->atom_count; i++) {
+		a = &x->atoms[i];
+		f->ids[i] = atom_id(a->atomic_number, a->isotope, a->charge,
+		    coho_smiles_hydrogen_count(x, i), a->is_aromatic);
+	}
+	return 0;
+}
+
+/*
+ * Sets the bit of each feature of f, folded to its length, in bits,
+ * which is cleared first.
+ */
+static void put_bits(const struct coho_fingerprint *f,
+    unsigned long long *bits)
+{
+	size_t i, k;
+
+	if (f->length == 0)
+		return;
+	memset(bits, 0, COHO_FINGERPRINT_WORDS(f->length) * sizeof(bits[0]));
+	for (i = 0; i < f->feature_count; i++) {
+		k = f->features[i] % f->length;
+		bits[k / 64] |= 1ULL << k % 64;
+	}
+}
+
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compact representations of parsed atoms and bonds: packed structs,
+ * and a struct-of-arrays view.
+ * struct coho_smiles_atom and struct coho_smiles_bond remain the
+ * parser's own representation; these are derived from them.
+ */
+
+#include <string.h>
+
+#include "coho.h"
+
+static const char *chiralities[] = {"", "@", "@@"};
+
+/*
+ * Columns, for use with COLUMNS(X).
+ */
+#define COLUMNS(X) \
+	X(atomic_number) \
+	X(charge) \
+	X(hydrogen_count) \
+	X(implicit_hydrogen_count) \
+	X(is_aromatic) \
+	X(isotope) \
+	X(atom0) \
+	X(atom1) \
+	X(order)
+
+void coho_smiles_columns_free(struct coho_smiles_columns *c)
+{
+#define FREE(name) \
+	coho_mem_free(c->allocator, c->name, c->cap, sizeof(c->name[0])); \
+	c->name = NULL;
+
+	COLUMNS(FREE)
+
+#undef FREE
+	c->cap = 0;
+}
+
+/*
+ * Initializes empty columns whose storage will come from allocator.
+ */
+void coho_smiles_columns_init(struct coho_smiles_columns *c,
+    struct coho_allocator *allocator)
+{
+	c->atomic_number = NULL;
+	c->charge = NULL;
+	c->hydrogen_count = NULL;
+	c->implicit_hydrogen_count = NULL;
+	c->is_aromatic = NULL;
+	c->isotope = NULL;
+	c->atom0 = NULL;
+	c->atom1 = NULL;
+	c->order = NULL;
+	c->cap = 0;
+	c->allocator = allocator;
+}
+
+/*
+ * Copies natoms atoms starting at src_atom and nbonds bonds starting at
+ * src_bond of src to dst, starting at dst_atom and dst_bond.
+ */
+void coho_smiles_columns_copy(struct coho_smiles_columns *dst,
+    size_t dst_atom, size_t dst_bond, const struct coho_smiles_columns *src,
+    size_t src_atom, size_t src_bond, size_t natoms, size_t nbonds)
+{
+#define COPY(name, d, s, n) \
+	memcpy(dst->name + (d), src->name + (s), (n) * sizeof(dst->name[0]))
+
+	COPY(atomic_number, dst_atom, src_atom, natoms);
+	COPY(charge, dst_atom, src_atom, natoms);
+	COPY(hydrogen_count, dst_atom, src_atom, natoms);
+	COPY(implicit_hydrogen_count, dst_atom, src_atom, natoms);
+	COPY(is_aromatic, dst_atom, src_atom, natoms);
+	COPY(isotope, dst_atom, src_atom, natoms);
+	COPY(atom0, dst_bond, src_bond, nbonds);
+	COPY(atom1, dst_bond, src_bond, nbonds);
+	COPY(order, dst_bond, src_bond, nbonds);
+
+#undef COPY
+}
+
+/*
+ * Ensures that each column has room for cap atoms or bonds.
+ * Returns 0 on success or -1 if memory could not be allocated, in which
+ * case the columns are unchanged.
+ */
+int coho_smiles_columns_reserve(struct coho_smiles_columns *c, size_t cap)
+{
+	struct coho_smiles_columns n;
+
+	if (c->cap >= cap)
+		return 0;
+
+	/*
+	 * Allocate all new columns before giving up any old ones,
+	 * so that a failure leaves every column at the old capacity.
+	 */
+	coho_smiles_columns_init(&n, c->allocator);
+	n.cap = cap;
+
+#define ALLOC(name) \
+	if ((n.name = coho_mem_alloc(c->allocator, cap, \
+	    sizeof(n.name[0]))) == NULL) \
+		goto fail;
+
+	COLUMNS(ALLOC)
+
+#undef ALLOC
+#define MOVE(name) \
+	if (c->cap) \
+		memcpy(n.name, c->name, c->cap * sizeof(c->name[0]));
+
+	COLUMNS(MOVE)
+
+#undef MOVE
+	coho_smiles_columns_free(c);
+	*c = n;
+	return 0;
+
+fail:
+	coho_smiles_columns_free(&n);
+	return -1;
+}
+
+/*
+ * Stores the atoms of x in the columns starting at index atom_base and
+ * its bonds starting at bond_base.
+ * Bond atom indices are those of x.
+ * The columns must have room for them.
+ */
+void coho_smiles_columns_set(struct coho_smiles_columns *c, size_t atom_base,
+    size_t bond_base, const struct coho_smiles *x)
+{
+	const struct coho_smiles_atom *a;
+	const struct coho_smiles_bond *b;
+	size_t i, j;
+	int k;
+
+	for (k = 0; k < x->atom_count; k++) {
+		a = &x->atoms[k];
+		i = atom_base + k;
+		c->atomic_number[i] = a->atomic_number;
+		c->charge[i] = a->charge;
+		c->hydrogen_count[i] = a->hydrogen_count;
+		c->implicit_hydrogen_count[i] = a->implicit_hydrogen_count;
+		c->is_aromatic[i] = a->is_aromatic;
+		c->isotope[i] = a->isotope;
+	}
+
+	for (k = 0; k < x->bond_count; k++) {
+		b = &x->bonds[k];
+		j = bond_base + k;
+		c->atom0[j] = b->atom0;
+		c->atom1[j] = b->atom1;
+		c->order[j] = b->order;
+	}
+}
+
+/*
+ * Packs atom a, which was parsed from smiles.
+ */
+void coho_smiles_pack_atom(struct coho_smiles_packed_atom *pa,
+    const struct coho_smiles_atom *a, const char *smiles)
+{
+	const char *s;
+	int i;
+
+	/* The symbol follows the bracket and isotope, if present. */
+	s = smiles + a->position;
+	i = 0;
+	if (a->is_bracket) {
+		for (i = 1; s[i] >= '0' && s[i] <= '9'; i++)
+			;
+	}
+
+	pa->position = a->position;
+	pa->isotope = a->isotope + 1;
+	pa->atomic_number = a->atomic_number;
+	pa->hydrogen_count = a->hydrogen_count + 1;
+	pa->is_bracket = a->is_bracket;
+	pa->is_organic = a->is_organic;
+	pa->is_aromatic = a->is_aromatic;
+	pa->atom_class = a->atom_class + 1;
+	pa->symbol_offset = i;
+	pa->symbol_length = strlen(a->symbol);
+	pa->charge = a->charge;
+	pa->implicit_hydrogen_count = a->implicit_hydrogen_count;
+	pa->chirality = strlen(a->chirality);
+	pa->length = a->length;
+}
+
+void coho_smiles_pack_bond(struct coho_smiles_packed_bond *pb,
+    const struct coho_smiles_bond *b)
+{
+	pb->atom0 = b->atom0;
+	pb->atom1 = b->atom1;
+	pb->position = b->position;
+	pb->order = b->order;
+	pb->stereo = b->stereo;
+	pb->is_implicit = b->is_implicit;
+	pb->is_ring = b->is_ring;
+	pb->length = b->length;
+}
+
+/*
+ * Unpacks atom pa, which was parsed from smiles.
+ */
+void coho_smiles_unpack_atom(struct coho_smiles_atom *a,
+    const struct coho_smiles_packed_atom *pa, const char *smiles)
+{
+	a->atomic_number = pa->atomic_number;
+	memcpy(a->symbol, smiles + pa->position + pa->symbol_offset,
+	    pa->symbol_length);
+	a->symbol[pa->symbol_length] = '\0';
+	a->isotope = (int)pa->isotope - 1;
+	a->charge = pa->charge;
+	a->hydrogen_count = (int)pa->hydrogen_count - 1;
+	a->implicit_hydrogen_count = pa->implicit_hydrogen_count;
+	a->is_bracket = pa->is_bracket;
+	a->is_organic = pa->is_organic;
+	a->is_aromatic = pa->is_aromatic;
+	strlcpy(a->chirality, chiralities[pa->chirality],
+	    sizeof(a->chirality));
+	a->atom_class = (int)pa->atom_class - 1;
+	a->position = pa->position;
+	a->length = pa->length;
+}
+
+void coho_smiles_unpack_bond(struct coho_smiles_bond *b,
+    const struct coho_smiles_packed_bond *pb)
+{
+	b->atom0 = pb->atom0;
+	b->atom1 = pb->atom1;
+	b->order = pb->order;
+	b->stereo = pb->stereo;
+	b->is_implicit = pb->is_implicit;
+	b->is_ring = pb->is_ring;
+	b->position = pb->position;
+	b->length = pb->length;
+}
@@ -18,6 +18,7 @@ cdef extern from "coho.h":
         COHO_OK
         COHO_ERROR
         COHO_NOMEM
+        COHO_STOPPED
 
     enum:
         COHO_SMILES_BOND_SINGLE
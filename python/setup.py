@@ -18,7 +18,24 @@ ext = [
     Extension(
         "coho.smiles",
         include_dirs=["src"],
-        sources=["coho/smiles.c", "src/smiles.c", "src/compat.c"],
+        libraries=["pthread"],
+        sources=[
+            "coho/smiles.c",
+            "src/smiles.c",
+            "src/alloc.c",
+            "src/batch.c",
+            "src/pack.c",
+            "src/scan.c",
+            "src/compat.c",
+            "src/file.c",
+            "src/index.c",
+            "src/ingest.c",
+            "src/canon.c",
+            "src/write.c",
+            "src/morgan.c",
+            "src/search.c",
+            "src/sort.c",
+        ],
     ),
 ]
 
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Classifies every byte of a SMILES string ahead of parsing.
+ * The input is processed in blocks of up to 32 bytes, each reduced to a
+ * set of bitmasks (one bit per byte) from which the scan results are
+ * derived, and which are passed on to the caller if asked for.  Masks
+ * are computed with SSE2 or AVX2 when the CPU supports them, else one
+ * byte at a time.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "coho.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define BLOCK	32
+
+/*
+ * Per-block bitmasks.
+ */
+struct masks {
+	uint32_t valid;		/* bytes present in block */
+	uint32_t legal;		/* bytes that may appear in SMILES */
+	uint32_t atom;		/* letters and '*' */
+	uint32_t digit;
+	uint32_t open;		/* [ */
+	uint32_t close;		/* ] */
+	uint32_t paren;		/* ( */
+	uint32_t close_paren;	/* ) */
+};
+
+/*
+ * Scan state carried between blocks.
+ */
+struct state {
+	struct coho_smiles_scan *sc;
+	struct coho_smiles_scan_masks *out;	/* or NULL */
+	int inside;		/* within a bracket atom */
+};
+
+static void clear_masks(struct masks *);
+static int ctz32(uint32_t);
+static int legal(int);
+static int popcount32(uint32_t);
+static int scan(struct coho_smiles_scan *, const char *, size_t,
+    struct coho_smiles_scan_masks *);
+static void scan_block(struct state *, size_t, struct masks *);
+static void scan_scalar(struct state *, const unsigned char *, size_t,
+    size_t);
+#ifdef SCAN_X86
+static size_t scan_avx2(struct state *, const unsigned char *, size_t);
+static size_t scan_sse2(struct state *, const unsigned char *, size_t);
+#endif
+
+/*
+ * Scans sz bytes of smiles, or all of it if sz is zero.
+ * Returns COHO_OK if every byte may appear in a SMILES string,
+ * otherwise COHO_ERROR.
+ */
+int coho_smiles_scan(struct coho_smiles_scan *sc, const char *smiles,
+    size_t sz)
+{
+	return scan(sc, smiles, sz, NULL);
+}
+
+/*
+ * As coho_smiles_scan(), also storing the bitmasks of each block of 32
+ * bytes in the arrays of out.
+ */
+int coho_smiles_scan_masks(struct coho_smiles_scan *sc, const char *smiles,
+    size_t sz, struct coho_smiles_scan_masks *out)
+{
+	return scan(sc, smiles, sz, out);
+}
+
+static void clear_masks(struct masks *m)
+{
+	m->valid = 0;
+	m->legal = 0;
+	m->atom = 0;
+	m->digit = 0;
+	m->open = 0;
+	m->close = 0;
+	m->paren = 0;
+	m->close_paren = 0;
+}
+
+static int ctz32(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(x);
+#else
+	int n = 0;
+
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Returns 1 if c may appear in a SMILES string, else 0.
+ * The same ranges are tested by the vectorized scanners.
+ */
+static int legal(int c)
+{
+	return (c >= 0x23 && c <= 0x25) ||	/* # $ % */
+	    (c >= 0x28 && c <= 0x2b) ||		/* ( ) * + */
+	    (c >= 0x2d && c <= 0x3a) ||		/* - . / 0-9 : */
+	    c == 0x3d ||			/* = */
+	    (c >= 0x40 && c <= 0x5d) ||		/* @ A-Z [ \ ] */
+	    (c >= 0x61 && c <= 0x7a);		/* a-z */
+}
+
+static int popcount32(uint32_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f;
+	return (x * 0x01010101) >> 24;
+#endif
+}
+
+static int scan(struct coho_smiles_scan *sc, const char *smiles, size_t sz,
+    struct coho_smiles_scan_masks *out)
+{
+	struct state st;
+	const unsigned char *s = (const unsigned char *)smiles;
+	size_t done = 0;
+
+	if (sz == 0)
+		sz = strlen(smiles);
+
+	sc->illegal = -1;
+	sc->atoms = 0;
+	sc->rings = 0;
+	sc->parens = 0;
+
+	st.sc = sc;
+	st.out = out;
+	st.inside = 0;
+
+#ifdef SCAN_X86
+	if (__builtin_cpu_supports("avx2"))
+		done = scan_avx2(&st, s, sz);
+	else if (__builtin_cpu_supports("sse2"))
+		done = scan_sse2(&st, s, sz);
+#endif
+	scan_scalar(&st, s, done, sz);
+
+	return sc->illegal == -1 ? COHO_OK : COHO_ERROR;
+}
+
+/*
+ * Accumulates the results for one block starting at offset base.
+ * Bracket atoms are rare enough that the span of bytes within them is
+ * found one bit at a time, and only for blocks that contain brackets.
+ */
+static void scan_block(struct state *st, size_t base, struct masks *m)
+{
+	struct coho_smiles_scan *sc = st->sc;
+	uint32_t brackets, bit, in;
+	size_t k;
+	int i;
+
+	if (sc->illegal == -1 && (m->valid & ~m->legal))
+		sc->illegal = (int)base + ctz32(m->valid & ~m->legal);
+
+	brackets = m->open | m->close;
+	if (brackets == 0) {
+		in = st->inside ? m->valid : 0;
+	} else {
+		in = 0;
+		for (i = 0; i < BLOCK; i++) {
+			bit = (uint32_t)1 << i;
+			if (!(m->valid & bit))
+				break;
+			else if (m->open & bit)
+				st->inside = 1;
+			else if (m->close & bit)
+				st->inside = 0;
+			else if (st->inside)
+				in |= bit;
+		}
+	}
+
+	sc->atoms += popcount32(m->atom & ~in) + popcount32(m->open);
+	sc->rings += popcount32(m->digit & ~in);
+	sc->parens += popcount32(m->paren);
+
+	if (st->out == NULL)
+		return;
+	k = base / BLOCK;
+	if (st->out->brackets != NULL)
+		st->out->brackets[k] = in | brackets;
+	if (st->out->rings != NULL)
+		st->out->rings[k] = m->digit & ~in;
+	if (st->out->parens != NULL)
+		st->out->parens[k] = m->paren;
+	if (st->out->close_parens != NULL)
+		st->out->close_parens[k] = m->close_paren;
+}
+
+/*
+ * Scans bytes [from, to) one at a time.
+ */
+static void scan_scalar(struct state *st, const unsigned char *s, size_t from,
+    size_t to)
+{
+	struct masks m;
+	uint32_t bit;
+	size_t i;
+	int c;
+
+	while (from < to) {
+		clear_masks(&m);
+		for (i = 0; i < BLOCK && from + i < to; i++) {
+			c = s[from + i];
+			bit = (uint32_t)1 << i;
+			m.valid |= bit;
+			if (legal(c))
+				m.legal |= bit;
+			if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+			    c == '*')
+				m.atom |= bit;
+			if (c >= '0' && c <= '9')
+				m.digit |= bit;
+			if (c == '[')
+				m.open |= bit;
+			if (c == ']')
+				m.close |= bit;
+			if (c == '(')
+				m.paren |= bit;
+			if (c == ')')
+				m.close_paren |= bit;
+		}
+		scan_block(st, from, &m);
+		from += i;
+	}
+}
+
+#ifdef SCAN_X86
+
+/*
+ * Byte range tests.
+ * Bytes are compared as signed values, which places all bytes
+ * >= 0x80 below every range tested here.
+ */
+#define IN_RANGE128(v, lo, hi) \
+	_mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((lo) - 1)), \
+	    _mm_cmplt_epi8((v), _mm_set1_epi8((hi) + 1)))
+#define IS128(v, c) \
+	_mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+
+#define IN_RANGE256(v, lo, hi) \
+	_mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8((lo) - 1)), \
+	    _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), (v)))
+#define IS256(v, c) \
+	_mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+
+/*
+ * Adds the masks for 16 bytes, starting at bit shift, to m.
+ */
+__attribute__((target("sse2")))
+static void masks_sse2(struct masks *m, __m128i v, int shift)
+{
+	__m128i letter;
+
+	letter = _mm_or_si128(IN_RANGE128(v, 'A', 'Z'),
+	    IN_RANGE128(v, 'a', 'z'));
+
+#define MASK(field, e) \
+	m->field |= (uint32_t)(_mm_movemask_epi8(e) & 0xffff) << shift
+
+	MASK(legal, _mm_or_si128(
+	    _mm_or_si128(IN_RANGE128(v, 0x23, 0x25),
+	    IN_RANGE128(v, 0x28, 0x2b)),
+	    _mm_or_si128(
+	    _mm_or_si128(IN_RANGE128(v, 0x2d, 0x3a), IS128(v, 0x3d)),
+	    _mm_or_si128(IN_RANGE128(v, 0x40, 0x5d),
+	    IN_RANGE128(v, 0x61, 0x7a)))));
+	MASK(atom, _mm_or_si128(letter, IS128(v, '*')));
+	MASK(digit, IN_RANGE128(v, '0', '9'));
+	MASK(open, IS128(v, '['));
+	MASK(close, IS128(v, ']'));
+	MASK(paren, IS128(v, '('));
+	MASK(close_paren, IS128(v, ')'));
+
+#undef MASK
+}
+
+/*
+ * Scans whole 32-byte blocks, two 16-byte vectors at a time.
+ * Returns the number of bytes scanned.
+ */
+__attribute__((target("sse2")))
+static size_t scan_sse2(struct state *st, const unsigned char *s, size_t sz)
+{
+	struct masks m;
+	size_t i;
+
+	for (i = 0; i + BLOCK <= sz; i += BLOCK) {
+		clear_masks(&m);
+		m.valid = 0xffffffff;
+		masks_sse2(&m, _mm_loadu_si128((const __m128i *)(s + i)), 0);
+		masks_sse2(&m, _mm_loadu_si128((const __m128i *)(s + i) + 1),
+		    16);
+		scan_block(st, i, &m);
+	}
+	return i;
+}
+
+/*
+ * Scans whole 32-byte blocks.
+ * Returns the number of bytes scanned.
+ */
+__attribute__((target("avx2")))
+static size_t scan_avx2(struct state *st, const unsigned char *s, size_t sz)
+{
+	struct masks m;
+	__m256i v, letter;
+	size_t i;
+
+	for (i = 0; i + BLOCK <= sz; i += BLOCK) {
+		m.valid = 0xffffffff;
+		v = _mm256_loadu_si256((const __m256i *)(s + i));
+		letter = _mm256_or_si256(IN_RANGE256(v, 'A', 'Z'),
+		    IN_RANGE256(v, 'a', 'z'));
+
+#define MASK(field, e) \
+	m.field = (uint32_t)_mm256_movemask_epi8(e)
+
+		MASK(legal, _mm256_or_si256(
+		    _mm256_or_si256(IN_RANGE256(v, 0x23, 0x25),
+		    IN_RANGE256(v, 0x28, 0x2b)),
+		    _mm256_or_si256(
+		    _mm256_or_si256(IN_RANGE256(v, 0x2d, 0x3a),
+		    IS256(v, 0x3d)),
+		    _mm256_or_si256(IN_RANGE256(v, 0x40, 0x5d),
+		    IN_RANGE256(v, 0x61, 0x7a)))));
+		MASK(atom, _mm256_or_si256(letter, IS256(v, '*')));
+		MASK(digit, IN_RANGE256(v, '0', '9'));
+		MASK(open, IS256(v, '['));
+		MASK(close, IS256(v, ']'));
+		MASK(paren, IS256(v, '('));
+		MASK(close_paren, IS256(v, ')'));
+
+#undef MASK
+		scan_block(st, i, &m);
+	}
+	return i;
+}
+
+#endif /* SCAN_X86 */
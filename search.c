@@ -0,0 +1,752 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Tanimoto similarity search over stores of fingerprints.
+ *
+ * A store keeps its fingerprints sorted by the number of bits set.  The
+ * similarity of fingerprints with a and b bits set is at most
+ * min(a, b) / max(a, b), so for a query with a bits set only those with
+ * between a * t and a / t bits set can reach similarity t.  Searches
+ * visit the groups of fingerprints with the same number of bits set in
+ * order of that bound, highest first, and stop once it falls below the
+ * threshold or, for the k most similar, below the least similarity of
+ * the k found so far.
+ *
+ * Bits in common are counted with AVX-512 VPOPCNTDQ, AVX2 or the POPCNT
+ * instruction when the CPU supports them, else one word at a time.
+ * With several threads, each takes its share of every group, so that
+ * pruning leaves them equal work.
+ *
+ * A stored file is the store's block of memory as is, in the byte order
+ * of the machine that wrote it:
+ *
+ *	header of 8 words: magic "COHOFPS1", BYTE_ORDER_MARK, length,
+ *	    count, stride and 3 unused words
+ *	count fingerprints of stride words
+ *	count ids
+ *	length + 2 offsets
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+#define MAGIC		"COHOFPS1"
+#define BYTE_ORDER_MARK	0x0102030405060708ULL
+#define HEADER_WORDS	8
+#define ALIGN		64
+#define CHUNK		256	/* fingerprints counted per kernel call */
+
+/*
+ * Counts the bits that the query has in common with each of n
+ * fingerprints of stride words.
+ */
+typedef void counter(const uint64_t *, const uint64_t *, size_t, size_t,
+    int *);
+
+/*
+ * Search of one thread's share of the store.
+ */
+struct worker {
+	const struct coho_fingerprint_store *s;
+	const uint64_t *query;
+	int bits;			/* bits set in query */
+	double threshold;
+	size_t k;
+	int part;
+	int nparts;
+	struct coho_fingerprint_hits hits;
+	int nomem;
+	pthread_t thread;
+	int started;
+};
+
+static int best_kernel(void);
+static int better(const struct coho_fingerprint_hit *,
+    const struct coho_fingerprint_hit *);
+static double bound(int, int);
+static int compare_hits(const void *, const void *);
+static void count_scalar(const uint64_t *, const uint64_t *, size_t, size_t,
+    int *);
+#ifdef SEARCH_X86
+static void count_avx2(const uint64_t *, const uint64_t *, size_t, size_t,
+    int *);
+static void count_avx512(const uint64_t *, const uint64_t *, size_t, size_t,
+    int *);
+static void count_popcnt(const uint64_t *, const uint64_t *, size_t, size_t,
+    int *);
+#endif
+static uint64_t last_word_mask(size_t);
+static void offer(struct worker *, size_t, double);
+static int popcount64(uint64_t);
+static int reserve_hits(struct coho_fingerprint_hits *, size_t);
+static void run(struct worker *, int);
+static void set_layout(struct coho_fingerprint_store *, const void *);
+static void sift_down(struct coho_fingerprint_hit *, size_t);
+static void *work(void *);
+
+void coho_fingerprint_hits_free(struct coho_fingerprint_hits *h)
+{
+	coho_mem_free(&h->allocator, h->hits, h->cap, sizeof(h->hits[0]));
+	h->hits = NULL;
+	h->count = 0;
+	h->cap = 0;
+}
+
+void coho_fingerprint_hits_init(struct coho_fingerprint_hits *h)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_fingerprint_hits_init_with_allocator(h, &a);
+}
+
+void coho_fingerprint_hits_init_with_allocator(
+    struct coho_fingerprint_hits *h, const struct coho_allocator *allocator)
+{
+	h->allocator = *allocator;
+	h->allocator.held = 0;
+	h->hits = NULL;
+	h->count = 0;
+	h->cap = 0;
+}
+
+/*
+ * Finds the fingerprints of s whose similarity to query, of
+ * COHO_FINGERPRINT_WORDS(s->length) words, is at least threshold, or if
+ * k is nonzero the k most similar of them, using up to nthreads threads.
+ * They are stored in hits, most similar first, and those equally
+ * similar by id.
+ * Each thread uses the allocator of hits, which must then be safe to
+ * call from several threads at once.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_fingerprint_search(const struct coho_fingerprint_store *s,
+    const unsigned long long *query, double threshold, size_t k,
+    int nthreads, struct coho_fingerprint_hits *hits)
+{
+	struct coho_allocator *a = &hits->allocator;
+	struct worker *workers;
+	uint64_t *q;
+	size_t i, words = COHO_FINGERPRINT_WORDS(s->length), total;
+	int j, bits = 0, rc = COHO_NOMEM;
+
+	hits->count = 0;
+	if (s->count == 0)
+		return COHO_OK;
+	if (nthreads < 1)
+		nthreads = 1;
+	if ((size_t)nthreads > s->count)
+		nthreads = s->count;
+
+	q = coho_mem_alloc(a, s->stride, sizeof(q[0]));
+	workers = coho_mem_alloc(a, nthreads, sizeof(workers[0]));
+	if (q == NULL || workers == NULL)
+		goto done;
+	for (i = 0; i < s->stride; i++) {
+		q[i] = i < words ? query[i] : 0;
+		if (i == words - 1)
+			q[i] &= last_word_mask(s->length);
+		bits += popcount64(q[i]);
+	}
+
+	for (j = 0; j < nthreads; j++) {
+		workers[j].s = s;
+		workers[j].query = q;
+		workers[j].bits = bits;
+		workers[j].threshold = threshold;
+		workers[j].k = k;
+		workers[j].part = j;
+		workers[j].nparts = nthreads;
+		workers[j].nomem = 0;
+		coho_fingerprint_hits_init_with_allocator(&workers[j].hits, a);
+	}
+	run(workers, nthreads);
+
+	total = 0;
+	for (j = 0; j < nthreads; j++) {
+		if (workers[j].nomem)
+			goto free_workers;
+		total += workers[j].hits.count;
+	}
+	if (reserve_hits(hits, total))
+		goto free_workers;
+	for (j = 0; j < nthreads; j++) {
+		if (workers[j].hits.count == 0)
+			continue;
+		memcpy(hits->hits + hits->count, workers[j].hits.hits,
+		    workers[j].hits.count * sizeof(hits->hits[0]));
+		hits->count += workers[j].hits.count;
+	}
+	qsort(hits->hits, hits->count, sizeof(hits->hits[0]), compare_hits);
+	if (k > 0 && hits->count > k)
+		hits->count = k;
+	rc = COHO_OK;
+
+free_workers:
+	for (j = 0; j < nthreads; j++)
+		coho_fingerprint_hits_free(&workers[j].hits);
+done:
+	coho_mem_free(a, q, s->stride, sizeof(q[0]));
+	coho_mem_free(a, workers, nthreads, sizeof(workers[0]));
+	return rc;
+}
+
+/*
+ * Builds a store of the count fingerprints of length bits at bits, each
+ * taking COHO_FINGERPRINT_WORDS(length) words, as written by
+ * coho_fingerprint_batch().  Bits past the length are ignored.
+ * Returns COHO_OK, or COHO_NOMEM if memory could not be allocated.
+ */
+int coho_fingerprint_store_build(struct coho_fingerprint_store *s,
+    const unsigned long long *bits, size_t count, size_t length)
+{
+	const unsigned long long *fp;
+	uint64_t *h, *base, *offsets, *ids, *dst;
+	uint64_t mask = last_word_mask(length);
+	size_t i, w, words = COHO_FINGERPRINT_WORDS(length), stride, size;
+	int p;
+
+	coho_fingerprint_store_free(s);
+	stride = (words + 7) / 8 * 8;
+	size = (HEADER_WORDS + count * (stride + 1) + length + 2) *
+	    sizeof(uint64_t);
+	if ((s->data = coho_mem_alloc(&s->allocator, size + ALIGN, 1)) == NULL)
+		return COHO_NOMEM;
+	s->size = size + ALIGN;
+
+	h = (uint64_t *)((char *)s->data +
+	    (ALIGN - (uintptr_t)s->data % ALIGN) % ALIGN);
+	memset(h, 0, size);
+	memcpy(h, MAGIC, 8);
+	h[1] = BYTE_ORDER_MARK;
+	h[2] = length;
+	h[3] = count;
+	h[4] = stride;
+	set_layout(s, h);
+	base = h + HEADER_WORDS;
+	ids = base + count * stride;
+	offsets = ids + count;
+
+	/* Sort by bits set, keeping the original order of each group. */
+	for (i = 0, fp = bits; i < count; i++, fp += words) {
+		for (w = 0, p = 0; w < words; w++)
+			p += popcount64(w + 1 < words ? fp[w] : fp[w] & mask);
+		offsets[p + 1]++;
+	}
+	for (p = 0; (size_t)p <= length; p++)
+		offsets[p + 1] += offsets[p];
+	for (i = 0, fp = bits; i < count; i++, fp += words) {
+		for (w = 0, p = 0; w < words; w++)
+			p += popcount64(w + 1 < words ? fp[w] : fp[w] & mask);
+		dst = base + offsets[p] * stride;
+		memcpy(dst, fp, words * sizeof(dst[0]));
+		if (words > 0)
+			dst[words - 1] &= mask;
+		ids[offsets[p]++] = i;
+	}
+	for (p = length; p > 0; p--)
+		offsets[p] = offsets[p - 1];
+	offsets[0] = 0;
+	return COHO_OK;
+}
+
+/*
+ * Releases the memory or mapping of s, leaving it empty.
+ */
+void coho_fingerprint_store_free(struct coho_fingerprint_store *s)
+{
+	if (s->is_mapped)
+		munmap(s->data, s->size);
+	else
+		coho_mem_free(&s->allocator, s->data, s->size, 1);
+	s->fingerprints = NULL;
+	s->ids = NULL;
+	s->offsets = NULL;
+	s->count = 0;
+	s->length = 0;
+	s->stride = 0;
+	s->data = NULL;
+	s->size = 0;
+	s->is_mapped = 0;
+}
+
+void coho_fingerprint_store_init(struct coho_fingerprint_store *s)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_fingerprint_store_init_with_allocator(s, &a);
+}
+
+/*
+ * Initializes an empty store that obtains its memory from allocator.
+ * Its kernel is the fastest the CPU supports.
+ */
+void coho_fingerprint_store_init_with_allocator(
+    struct coho_fingerprint_store *s, const struct coho_allocator *allocator)
+{
+	s->allocator = *allocator;
+	s->allocator.held = 0;
+	s->fingerprints = NULL;
+	s->ids = NULL;
+	s->offsets = NULL;
+	s->count = 0;
+	s->length = 0;
+	s->stride = 0;
+	s->kernel = best_kernel();
+	s->data = NULL;
+	s->size = 0;
+	s->is_mapped = 0;
+}
+
+/*
+ * Maps the store in the file at path into memory.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_fingerprint_store_open(struct coho_fingerprint_store *s,
+    const char *path)
+{
+	struct stat st;
+	const uint64_t *h;
+	void *p;
+	uint64_t length, count, stride;
+	int fd, saved;
+
+	coho_fingerprint_store_free(s);
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1)
+		goto fail;
+	if ((size_t)st.st_size < HEADER_WORDS * sizeof(uint64_t)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		goto fail;
+	close(fd);
+
+	h = p;
+	length = h[2];
+	count = h[3];
+	stride = h[4];
+	if (memcmp(h, MAGIC, 8) != 0 || h[1] != BYTE_ORDER_MARK ||
+	    stride != (COHO_FINGERPRINT_WORDS(length) + 7) / 8 * 8 ||
+	    count > (uint64_t)st.st_size / sizeof(uint64_t) ||
+	    length > (uint64_t)st.st_size * 8 ||
+	    (uint64_t)st.st_size != (HEADER_WORDS + count * (stride + 1) +
+	    length + 2) * sizeof(uint64_t)) {
+		munmap(p, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	s->data = p;
+	s->size = st.st_size;
+	s->is_mapped = 1;
+	set_layout(s, p);
+	return 0;
+
+fail:
+	saved = errno;
+	close(fd);
+	errno = saved;
+	return -1;
+}
+
+/*
+ * Writes s, which must have been built or opened, to a file at path,
+ * from which coho_fingerprint_store_open() can map it.
+ * Returns 0 on success or -1 on failure, setting errno.
+ */
+int coho_fingerprint_store_write(const struct coho_fingerprint_store *s,
+    const char *path)
+{
+	FILE *fp;
+	size_t size;
+	int saved;
+
+	if (s->data == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+	size = (HEADER_WORDS + s->count * (s->stride + 1) + s->length + 2) *
+	    sizeof(uint64_t);
+	if (fwrite((const uint64_t *)s->fingerprints - HEADER_WORDS, 1, size,
+	    fp) != size) {
+		saved = errno;
+		fclose(fp);
+		errno = saved;
+		return -1;
+	}
+	if (fclose(fp) == EOF)
+		return -1;
+	return 0;
+}
+
+/*
+ * Returns the fastest kernel the CPU supports.
+ */
+static int best_kernel(void)
+{
+#ifdef SEARCH_X86
+	if (__builtin_cpu_supports("avx512f") &&
+	    __builtin_cpu_supports("avx512vpopcntdq"))
+		return COHO_FINGERPRINT_KERNEL_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return COHO_FINGERPRINT_KERNEL_AVX2;
+	if (__builtin_cpu_supports("popcnt"))
+		return COHO_FINGERPRINT_KERNEL_POPCNT;
+#endif
+	return COHO_FINGERPRINT_KERNEL_SCALAR;
+}
+
+/*
+ * Returns 1 if hit p ranks ahead of hit q, else 0.
+ */
+static int better(const struct coho_fingerprint_hit *p,
+    const struct coho_fingerprint_hit *q)
+{
+	if (p->similarity != q->similarity)
+		return p->similarity > q->similarity;
+	return p->id < q->id;
+}
+
+/*
+ * Returns the greatest similarity of fingerprints with a and b bits
+ * set.
+ */
+static double bound(int a, int b)
+{
+	if (a == 0 || b == 0)
+		return 0;
+	return a < b ? (double)a / b : (double)b / a;
+}
+
+static int compare_hits(const void *p, const void *q)
+{
+	if (better(p, q))
+		return -1;
+	return better(q, p);
+}
+
+static void count_scalar(const uint64_t *q, const uint64_t *fp,
+    size_t stride, size_t n, int *counts)
+{
+	size_t i, w;
+	int c;
+
+	for (i = 0; i < n; i++, fp += stride) {
+		for (w = 0, c = 0; w < stride; w++)
+			c += popcount64(q[w] & fp[w]);
+		counts[i] = c;
+	}
+}
+
+#ifdef SEARCH_X86
+
+/*
+ * Counts bits four words at a time, looking up the count of each
+ * nibble with a shuffle and summing the bytes of each word.
+ */
+__attribute__((target("avx2")))
+static void count_avx2(const uint64_t *q, const uint64_t *fp, size_t stride,
+    size_t n, int *counts)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+	    1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3,
+	    1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i v, sum, c;
+	__m128i t;
+	size_t i, w;
+
+	for (i = 0; i < n; i++, fp += stride) {
+		sum = _mm256_setzero_si256();
+		for (w = 0; w < stride; w += 4) {
+			v = _mm256_and_si256(
+			    _mm256_loadu_si256((const __m256i *)(q + w)),
+			    _mm256_load_si256((const __m256i *)(fp + w)));
+			c = _mm256_add_epi8(
+			    _mm256_shuffle_epi8(table,
+			    _mm256_and_si256(v, nibble)),
+			    _mm256_shuffle_epi8(table,
+			    _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+			sum = _mm256_add_epi64(sum,
+			    _mm256_sad_epu8(c, _mm256_setzero_si256()));
+		}
+		t = _mm_add_epi64(_mm256_castsi256_si128(sum),
+		    _mm256_extracti128_si256(sum, 1));
+		counts[i] = _mm_cvtsi128_si64(t) +
+		    _mm_cvtsi128_si64(_mm_unpackhi_epi64(t, t));
+	}
+}
+
+/*
+ * Counts bits eight words at a time.
+ */
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void count_avx512(const uint64_t *q, const uint64_t *fp,
+    size_t stride, size_t n, int *counts)
+{
+	__m512i sum;
+	size_t i, w;
+
+	for (i = 0; i < n; i++, fp += stride) {
+		sum = _mm512_setzero_si512();
+		for (w = 0; w < stride; w += 8)
+			sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(
+			    _mm512_and_si512(_mm512_loadu_si512(q + w),
+			    _mm512_load_si512(fp + w))));
+		counts[i] = _mm512_reduce_add_epi64(sum);
+	}
+}
+
+__attribute__((target("popcnt")))
+static void count_popcnt(const uint64_t *q, const uint64_t *fp,
+    size_t stride, size_t n, int *counts)
+{
+	size_t i, w;
+	int c;
+
+	for (i = 0; i < n; i++, fp += stride) {
+		for (w = 0, c = 0; w < stride; w++)
+			c += __builtin_popcountll(q[w] & fp[w]);
+		counts[i] = c;
+	}
+}
+
+#endif
+
+/*
+ * Returns the mask of the bits of the last word of a fingerprint of
+ * length bits that lie within it.
+ */
+static uint64_t last_word_mask(size_t length)
+{
+	return length % 64 ? (1ULL << length % 64) - 1 : ~0ULL;
+}
+
+/*
+ * Adds fingerprint i of the store, of the given similarity to the
+ * query, to w's hits, keeping only the best k if k is nonzero in a heap
+ * with the worst hit first.
+ */
+static void offer(struct worker *w, size_t i, double similarity)
+{
+	struct coho_fingerprint_hits *h = &w->hits;
+	struct coho_fingerprint_hit hit, t;
+	size_t j;
+
+	hit.id = w->s->ids[i];
+	hit.similarity = similarity;
+
+	if (w->k == 0 || h->count < w->k) {
+		if (reserve_hits(h, h->count + 1)) {
+			w->nomem = 1;
+			return;
+		}
+		h->hits[h->count++] = hit;
+		if (w->k == 0)
+			return;
+		/* Sift the new hit up. */
+		for (j = h->count - 1; j > 0 &&
+		    better(&h->hits[(j - 1) / 2], &h->hits[j]); j = (j - 1) / 2) {
+			t = h->hits[j];
+			h->hits[j] = h->hits[(j - 1) / 2];
+			h->hits[(j - 1) / 2] = t;
+		}
+		return;
+	}
+	if (better(&hit, &h->hits[0])) {
+		h->hits[0] = hit;
+		sift_down(h->hits, h->count);
+	}
+}
+
+static int popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/*
+ * Ensures room for n hits.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int reserve_hits(struct coho_fingerprint_hits *h, size_t n)
+{
+	struct coho_fingerprint_hit *p;
+	size_t cap = h->cap;
+
+	if (n <= cap)
+		return 0;
+	if (cap < 16)
+		cap = 16;
+	while (cap < n)
+		cap *= 2;
+	if ((p = coho_mem_realloc(&h->allocator, h->hits, h->cap, cap,
+	    sizeof(h->hits[0]))) == NULL)
+		return -1;
+	h->hits = p;
+	h->cap = cap;
+	return 0;
+}
+
+/*
+ * Runs the n workers, the first on the calling thread.
+ * A worker whose thread can't be created runs on the calling thread
+ * afterwards.
+ */
+static void run(struct worker *workers, int n)
+{
+	struct worker *w;
+	int k;
+
+	for (k = 1; k < n; k++) {
+		w = &workers[k];
+		w->started = pthread_create(&w->thread, NULL, work, w) == 0;
+	}
+
+	work(&workers[0]);
+
+	for (k = 1; k < n; k++) {
+		w = &workers[k];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		else
+			work(w);
+	}
+}
+
+/*
+ * Points the arrays of s into the block of memory at h, which starts
+ * with the header.
+ */
+static void set_layout(struct coho_fingerprint_store *s, const void *h)
+{
+	const uint64_t *p = h;
+
+	s->length = p[2];
+	s->count = p[3];
+	s->stride = p[4];
+	s->fingerprints = (const unsigned long long *)p + HEADER_WORDS;
+	s->ids = s->fingerprints + s->count * s->stride;
+	s->offsets = s->ids + s->count;
+}
+
+/*
+ * Restores the heap of n hits, worst first, after the first changes.
+ */
+static void sift_down(struct coho_fingerprint_hit *h, size_t n)
+{
+	struct coho_fingerprint_hit t;
+	size_t i = 0, c;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && better(&h[c], &h[c + 1]))
+			c++;
+		if (!better(&h[i], &h[c]))
+			break;
+		t = h[i];
+		h[i] = h[c];
+		h[c] = t;
+		i = c;
+	}
+}
+
+/*
+ * Searches the worker's share of each group of fingerprints with the
+ * same number of bits set, taking groups in order of their bound.
+ */
+static void *work(void *arg)
+{
+	struct worker *w = arg;
+	const struct coho_fingerprint_store *s = w->s;
+	counter *count = count_scalar;
+	int counts[CHUNK];
+	size_t i, j, n, m, first, last;
+	int p, lo = w->bits, hi = w->bits + 1, length = s->length, d;
+	double b, least, similarity;
+
+#ifdef SEARCH_X86
+	if (s->kernel == COHO_FINGERPRINT_KERNEL_AVX512)
+		count = count_avx512;
+	else if (s->kernel == COHO_FINGERPRINT_KERNEL_AVX2)
+		count = count_avx2;
+	else if (s->kernel == COHO_FINGERPRINT_KERNEL_POPCNT)
+		count = count_popcnt;
+#endif
+
+	while (lo >= 0 || hi <= length) {
+		if (hi > length || (lo >= 0 &&
+		    bound(w->bits, lo) >= bound(w->bits, hi)))
+			p = lo--;
+		else
+			p = hi++;
+
+		b = bound(w->bits, p);
+		least = w->threshold;
+		if (w->k > 0 && w->hits.count == w->k &&
+		    w->hits.hits[0].similarity > least)
+			least = w->hits.hits[0].similarity;
+		if (b < least)
+			break;
+
+		n = s->offsets[p + 1] - s->offsets[p];
+		first = s->offsets[p] + n * w->part / w->nparts;
+		last = s->offsets[p] + n * (w->part + 1) / w->nparts;
+		for (i = first; i < last; i += m) {
+			m = last - i < CHUNK ? last - i : CHUNK;
+			count(w->query, (const uint64_t *)s->fingerprints +
+			    i * s->stride, s->stride, m, counts);
+			for (j = 0; j < m; j++) {
+				d = w->bits + p - counts[j];
+				similarity = d > 0 ? (double)counts[j] / d : 0;
+				if (similarity >= w->threshold)
+					offer(w, i + j, similarity);
+			}
+			if (w->nomem)
+				return NULL;
+		}
+	}
+	return NULL;
+}
@@ -44,88 +44,409 @@
 #define PLUS			0x10000
 #define WILDCARD		0x20000
 
-struct token {
-	int type;
-	int position;
-	const char *s;
-	size_t n;
-	int intval;
-	int flags;
+/*
+ * Arrays of context x and their lengths, which are determined by its
+ * capacities, for use with ARRAYS(X).
+ * Those of INLINE_ARRAYS(X) may instead be the arrays of the same name
+ * in struct coho_smiles_inline (see IS_INLINE()).
+ * neighbor_atoms and neighbor_bonds also serve as scratch space for
+ * sort_bonds().
+ * Validation uses only bonds, paren_stack and big_rings.
+ */
+#define ARRAYS(X) \
+	INLINE_ARRAYS(X) \
+	HEAP_ARRAYS(X)
+
+#define INLINE_ARRAYS(X) \
+	X(atoms, x->atoms_cap) \
+	X(bonds, x->bonds_cap) \
+	X(paren_stack, x->paren_stack_cap)
+
+#define INDEX_ARRAYS(X) \
+	X(neighbor_offsets, x->atoms_cap + 1) \
+	X(neighbor_atoms, 2 * x->bonds_cap) \
+	X(neighbor_bonds, MAX(2 * x->bonds_cap, x->atoms_cap + 1)) \
+	X(bond_slots, 2 * x->bonds_cap)
+
+#define HEAP_ARRAYS(X) \
+	INDEX_ARRAYS(X) \
+	X(big_rings, x->big_rings_cap)
+
+/*
+ * True if array name of context x is its inline storage.
+ */
+#define IS_INLINE(x, name)	((x)->name == (x)->storage.name)
+
+#define MAX(a, b)		((a) > (b) ? (a) : (b))
+#define NELEMENTS		(sizeof(elements) / sizeof(elements[0]))
+
+/*
+ * Calls handler function fn of context x, if there is one, with the
+ * remaining arguments.
+ * Evaluates to nonzero if the handler asked to stop.
+ */
+#define EMIT(x, fn, ...) \
+	((x)->handler != NULL && (x)->handler->fn != NULL && \
+	    (x)->handler->fn((x)->handler->ud, __VA_ARGS__) != 0)
+
+/*
+ * True if the positions and lengths of atoms and bonds are not to be
+ * stored.  Packed atoms need them to find their symbols.
+ */
+#define NO_SPANS(x) \
+	(((x)->flags & (COHO_SMILES_NO_SPANS | COHO_SMILES_PACKED)) == \
+	    COHO_SMILES_NO_SPANS)
+
+#define RING_BIT(n)		(1UL << ((n) % 32))
+#define RING_WORD(x, n)		((x)->ring_open[(n) / 32])
+
+/*
+ * Parser states, kept in the context between calls to
+ * coho_smiles_feed().
+ */
+enum {
+	INIT,
+	ATOM_READ,
+	BOND_READ,
+	DOT_READ,
+	OPEN_PAREN_READ,
+	CLOSE_PAREN_READ,
+};
+
+/*
+ * Lexer table entry describing the token that begins with a given
+ * character.
+ * If pair is nonzero, the token may instead be a two-character one,
+ * depending on the following character (see lex_pairs).
+ */
+struct lexeme {
+	unsigned int type;
+	signed char intval;
+	unsigned char n;
+	unsigned char flags;
+	unsigned char pair;
+};
+
+/*
+ * Second-character table for two-character tokens.
+ * The value of the token formed with the following character is stored
+ * at its pair_column(), with zero indicating that the two characters
+ * do not form a token.
+ */
+#define PAIR_COLUMNS	27
+
+struct lexpair {
+	unsigned int type;
+	signed char intval[PAIR_COLUMNS];
+};
+
+struct element {
+	char symbol[4];
+	signed char valences[3];
 };
 
 static int atom_class(struct coho_smiles *, struct coho_smiles_atom *);
-static int add_atom(struct coho_smiles *, struct coho_smiles_atom *);
-static int add_bond(struct coho_smiles *, struct coho_smiles_bond *);
+static int add_atom(struct coho_smiles *, struct coho_smiles_atom *, int);
+static int add_bond(struct coho_smiles *, struct coho_smiles_bond *, int, int);
+static int add_big_ringbond(struct coho_smiles *, int,
+    struct coho_smiles_bond *);
 static int add_ringbond(struct coho_smiles *, int, struct coho_smiles_bond *);
 static int aliphatic_organic(struct coho_smiles *, struct coho_smiles_atom *);
 static int aromatic_organic(struct coho_smiles *, struct coho_smiles_atom *);
 static int assign_implicit_hydrogen_count(struct coho_smiles *);
-static int atom(struct coho_smiles *, int *);
-static int atom_ringbond(struct coho_smiles *, int *);
-static int atom_valence(struct coho_smiles *, size_t);
+static int atom(struct coho_smiles *, int *, int);
+static int atom_ringbond(struct coho_smiles *, int *, int,
+    struct coho_smiles_bond *);
+static int atom_valence(const struct coho_smiles *, size_t);
 static int bond(struct coho_smiles *, struct coho_smiles_bond *b);
+static void build_adjacency(struct coho_smiles *);
 static int bracket_atom(struct coho_smiles *, struct coho_smiles_atom *);
 static int charge(struct coho_smiles *, struct coho_smiles_atom *);
 static int check_ring_closures(struct coho_smiles *);
 static int chirality(struct coho_smiles *, struct coho_smiles_atom *);
 static int close_paren(struct coho_smiles *, struct coho_smiles_bond *);
+static int close_ringbond(struct coho_smiles *, struct coho_smiles_bond *,
+    int, int, struct coho_smiles_bond *);
+static int complete(struct coho_smiles *);
 static int dot(struct coho_smiles *);
-static int ensure_array_capacities(struct coho_smiles *, size_t);
+static int ensure_array_capacities(struct coho_smiles *, size_t,
+    const struct coho_smiles_scan *);
 static void finalize_implicit_bond_order(struct coho_smiles *,
     struct coho_smiles_bond *);
+static void free_arrays(struct coho_smiles *);
+static void free_packed(struct coho_smiles *);
+static int grow_array_capacities(struct coho_smiles *, size_t);
+static void *grow_validation_array(struct coho_smiles *, void *, size_t *,
+    size_t, int);
 static int hydrogen_count(struct coho_smiles *, struct coho_smiles_atom *);
 static int integer(struct coho_smiles *, size_t, int *);
 static int isotope(struct coho_smiles *, struct coho_smiles_atom *);
-static unsigned int lex(struct coho_smiles *, struct token *, int);
-static int match(struct coho_smiles *, struct token *, int, unsigned int);
+static const struct coho_smiles_token *lex(struct coho_smiles *, int);
+static int match(struct coho_smiles *, struct coho_smiles_token *, int,
+    unsigned int);
 static size_t next_array_cap(size_t);
+static int next_neighbor_slot(struct coho_smiles *, int);
+static int nomem(struct coho_smiles *);
+static int pack(struct coho_smiles *);
+static int pair_column(int);
+static int parse(struct coho_smiles *, int);
 static int open_paren(struct coho_smiles *, struct coho_smiles_bond *);
 static int pop_paren_stack(struct coho_smiles *, int, struct coho_smiles_bond *);
-static void push_paren_stack(struct coho_smiles *, int,
+static int push_paren_stack(struct coho_smiles *, int,
     struct coho_smiles_bond *);
-static int ringbond(struct coho_smiles *, int);
+static int quick_validate(struct coho_smiles *);
+static int ring_number(struct coho_smiles *, int *);
+static int ringbond(struct coho_smiles *, int, struct coho_smiles_bond *);
 static int round_valence(int, int, int);
 static void coho_smiles_atom_init(struct coho_smiles_atom *);
 static void coho_smiles_bond_init(struct coho_smiles_bond *);
 static void coho_smiles_reinit(struct coho_smiles *, const char *, size_t);
+static void sort_bonds(struct coho_smiles *);
+static void start(struct coho_smiles *, const char *, size_t);
+static int stop(struct coho_smiles *);
+static size_t stream_cut(struct coho_smiles *);
 static int symbol(struct coho_smiles *, struct coho_smiles_atom *);
-static void tokcpy(char *, struct token *, size_t);
+static void tokcpy(char *, const struct coho_smiles_token *, size_t);
 static int wildcard(struct coho_smiles *, struct coho_smiles_atom *);
 
 /*
- * Table of standard atom valences.
- * <atomic number> <valence>...
- */
-static int standard_valences[][4] = {
-	{5, 3, -1, -1},		/* B */
-	{6, 4, -1, -1},		/* C */
-	{7, 3, 5, -1},		/* N */
-	{8, 2, -1, -1},		/* O */
-	{9, 1, -1, -1},		/* F */
-	{15, 3, 5, -1},		/* P */
-	{16, 2, 4, 6},		/* S */
-	{17, 1, -1, -1},	/* Cl */
-	{35, 1, -1, -1},	/* Br */
-	{53, 1, -1, -1},	/* I */
-	{-1, -1, -1, -1},
+ * Elements indexed by atomic number, with 0 standing for the wildcard.
+ * Elements of the organic subset list their standard valences in
+ * increasing order; the others have none.
+ */
+static const struct element elements[] = {
+	{"*", {0}}, {"H", {0}}, {"He", {0}}, {"Li", {0}}, {"Be", {0}},
+	{"B", {3}}, {"C", {4}}, {"N", {3, 5}}, {"O", {2}}, {"F", {1}},
+	{"Ne", {0}}, {"Na", {0}}, {"Mg", {0}}, {"Al", {0}}, {"Si", {0}},
+	{"P", {3, 5}}, {"S", {2, 4, 6}}, {"Cl", {1}}, {"Ar", {0}},
+	{"K", {0}}, {"Ca", {0}}, {"Sc", {0}}, {"Ti", {0}}, {"V", {0}},
+	{"Cr", {0}}, {"Mn", {0}}, {"Fe", {0}}, {"Co", {0}}, {"Ni", {0}},
+	{"Cu", {0}}, {"Zn", {0}}, {"Ga", {0}}, {"Ge", {0}}, {"As", {0}},
+	{"Se", {0}}, {"Br", {1}}, {"Kr", {0}}, {"Rb", {0}}, {"Sr", {0}},
+	{"Y", {0}}, {"Zr", {0}}, {"Nb", {0}}, {"Mo", {0}}, {"Tc", {0}},
+	{"Ru", {0}}, {"Rh", {0}}, {"Pd", {0}}, {"Ag", {0}}, {"Cd", {0}},
+	{"In", {0}}, {"Sn", {0}}, {"Sb", {0}}, {"Te", {0}}, {"I", {1}},
+	{"Xe", {0}}, {"Cs", {0}}, {"Ba", {0}}, {"La", {0}}, {"Ce", {0}},
+	{"Pr", {0}}, {"Nd", {0}}, {"Pm", {0}}, {"Sm", {0}}, {"Eu", {0}},
+	{"Gd", {0}}, {"Tb", {0}}, {"Dy", {0}}, {"Ho", {0}}, {"Er", {0}},
+	{"Tm", {0}}, {"Yb", {0}}, {"Lu", {0}}, {"Hf", {0}}, {"Ta", {0}},
+	{"W", {0}}, {"Re", {0}}, {"Os", {0}}, {"Ir", {0}}, {"Pt", {0}},
+	{"Au", {0}}, {"Hg", {0}}, {"Tl", {0}}, {"Pb", {0}}, {"Bi", {0}},
+	{"Po", {0}}, {"At", {0}}, {"Rn", {0}}, {"Fr", {0}}, {"Ra", {0}},
+	{"Ac", {0}}, {"Th", {0}}, {"Pa", {0}}, {"U", {0}}, {"Np", {0}},
+	{"Pu", {0}}, {"Am", {0}}, {"Cm", {0}}, {"Bk", {0}}, {"Cf", {0}},
+	{"Es", {0}}, {"Fm", {0}}, {"Md", {0}}, {"No", {0}}, {"Lr", {0}},
+	{"Rf", {0}}, {"Db", {0}}, {"Sg", {0}}, {"Bh", {0}}, {"Hs", {0}},
+	{"Mt", {0}}, {"Ds", {0}}, {"Rg", {0}}, {"Cn", {0}}, {"Nh", {0}},
+	{"Fl", {0}}, {"Mc", {0}}, {"Lv", {0}}, {"Ts", {0}}, {"Og", {0}},
+};
+
+enum {
+	P_NONE,
+	P_A,
+	P_B,
+	P_BR,
+	P_C,
+	P_CL,
+	P_D,
+	P_E,
+	P_F,
+	P_G,
+	P_H,
+	P_I,
+	P_K,
+	P_L,
+	P_M,
+	P_N,
+	P_O,
+	P_P,
+	P_R,
+	P_S,
+	P_T,
+	P_X,
+	P_Y,
+	P_Z,
+	P_as,
+	P_se,
+	P_AT,
+};
+
+#define C(c)	[(c) - 'a']
+
+static const struct lexpair lex_pairs[] = {
+	[P_A] = {ELEMENT, {C('c') = 89, C('g') = 47, C('l') = 13, C('m') = 95,
+	    C('r') = 18, C('s') = 33, C('t') = 85, C('u') = 79}},
+	[P_B] = {ELEMENT, {C('a') = 56, C('e') = 4, C('h') = 107, C('i') = 83,
+	    C('k') = 97, C('r') = 35}},
+	[P_BR] = {ALIPHATIC_ORGANIC, {C('r') = 35}},
+	[P_C] = {ELEMENT, {C('a') = 20, C('d') = 48, C('e') = 58, C('f') = 98,
+	    C('l') = 17, C('m') = 96, C('n') = 112, C('o') = 27, C('r') = 24,
+	    C('s') = 55, C('u') = 29}},
+	[P_CL] = {ALIPHATIC_ORGANIC, {C('l') = 17}},
+	[P_D] = {ELEMENT, {C('b') = 105, C('s') = 110, C('y') = 66}},
+	[P_E] = {ELEMENT, {C('r') = 68, C('s') = 99, C('u') = 63}},
+	[P_F] = {ELEMENT, {C('e') = 26, C('l') = 114, C('m') = 100,
+	    C('r') = 87}},
+	[P_G] = {ELEMENT, {C('a') = 31, C('d') = 64, C('e') = 32}},
+	[P_H] = {ELEMENT, {C('e') = 2, C('f') = 72, C('g') = 80, C('o') = 67,
+	    C('s') = 108}},
+	[P_I] = {ELEMENT, {C('n') = 49, C('r') = 77}},
+	[P_K] = {ELEMENT, {C('r') = 36}},
+	[P_L] = {ELEMENT, {C('a') = 57, C('i') = 3, C('r') = 103, C('u') = 71,
+	    C('v') = 116}},
+	[P_M] = {ELEMENT, {C('c') = 115, C('d') = 101, C('g') = 12, C('n') = 25,
+	    C('o') = 42, C('t') = 109}},
+	[P_N] = {ELEMENT, {C('a') = 11, C('b') = 41, C('d') = 60, C('e') = 10,
+	    C('h') = 113, C('i') = 28, C('o') = 102, C('p') = 93}},
+	[P_O] = {ELEMENT, {C('g') = 118, C('s') = 76}},
+	[P_P] = {ELEMENT, {C('a') = 91, C('b') = 82, C('d') = 46, C('m') = 61,
+	    C('o') = 84, C('r') = 59, C('t') = 78, C('u') = 94}},
+	[P_R] = {ELEMENT, {C('a') = 88, C('b') = 37, C('e') = 75, C('f') = 104,
+	    C('g') = 111, C('h') = 45, C('n') = 86, C('u') = 44}},
+	[P_S] = {ELEMENT, {C('b') = 51, C('c') = 21, C('e') = 34, C('g') = 106,
+	    C('i') = 14, C('m') = 62, C('n') = 50, C('r') = 38}},
+	[P_T] = {ELEMENT, {C('a') = 73, C('b') = 65, C('c') = 43, C('e') = 52,
+	    C('h') = 90, C('i') = 22, C('l') = 81, C('m') = 69,
+	    C('s') = 117}},
+	[P_X] = {ELEMENT, {C('e') = 54}},
+	[P_Y] = {ELEMENT, {C('b') = 70}},
+	[P_Z] = {ELEMENT, {C('n') = 30, C('r') = 40}},
+	[P_as] = {AROMATIC, {C('s') = 33}},
+	[P_se] = {AROMATIC, {C('e') = 34}},
+	[P_AT] = {CHIRALITY, {[PAIR_COLUMNS - 1] = -1}},
+};
+
+#undef C
+
+/*
+ * Tokens that are read the same way inside and outside of brackets.
+ */
+#define LEX_COMMON \
+	['0'] = {DIGIT, 0, 1, 0, 0}, \
+	['1'] = {DIGIT, 1, 1, 0, 0}, \
+	['2'] = {DIGIT, 2, 1, 0, 0}, \
+	['3'] = {DIGIT, 3, 1, 0, 0}, \
+	['4'] = {DIGIT, 4, 1, 0, 0}, \
+	['5'] = {DIGIT, 5, 1, 0, 0}, \
+	['6'] = {DIGIT, 6, 1, 0, 0}, \
+	['7'] = {DIGIT, 7, 1, 0, 0}, \
+	['8'] = {DIGIT, 8, 1, 0, 0}, \
+	['9'] = {DIGIT, 9, 1, 0, 0}, \
+	['*'] = {WILDCARD, 0, 1, 0, 0}, \
+	['['] = {BRACKET_OPEN, -1, 1, 0, 0}, \
+	[']'] = {BRACKET_CLOSE, -1, 1, 0, 0}, \
+	['('] = {PAREN_OPEN, -1, 1, 0, 0}, \
+	[')'] = {PAREN_CLOSE, -1, 1, 0, 0}, \
+	['+'] = {PLUS, 1, 1, 0, 0}, \
+	['%'] = {PERCENT, -1, 1, 0, 0}, \
+	['='] = {BOND, COHO_SMILES_BOND_DOUBLE, 1, 0, 0}, \
+	['#'] = {BOND, COHO_SMILES_BOND_TRIPLE, 1, 0, 0}, \
+	['$'] = {BOND, COHO_SMILES_BOND_QUAD, 1, 0, 0}, \
+	['/'] = {BOND, COHO_SMILES_BOND_SINGLE, 1, \
+	    COHO_SMILES_BOND_STEREO_UP, 0}, \
+	['\\'] = {BOND, COHO_SMILES_BOND_SINGLE, 1, \
+	    COHO_SMILES_BOND_STEREO_DOWN, 0}, \
+	['.'] = {DOT, -1, 1, 0, 0}, \
+	['@'] = {CHIRALITY, -1, 1, 0, P_AT}, \
+	['A'] = {0, -1, 1, 0, P_A}, \
+	['D'] = {0, -1, 1, 0, P_D}, \
+	['E'] = {0, -1, 1, 0, P_E}, \
+	['G'] = {0, -1, 1, 0, P_G}, \
+	['H'] = {ELEMENT | HYDROGEN, 1, 1, 0, P_H}, \
+	['K'] = {ELEMENT, 19, 1, 0, P_K}, \
+	['L'] = {0, -1, 1, 0, P_L}, \
+	['M'] = {0, -1, 1, 0, P_M}, \
+	['R'] = {0, -1, 1, 0, P_R}, \
+	['T'] = {0, -1, 1, 0, P_T}, \
+	['U'] = {ELEMENT, 92, 1, 0, 0}, \
+	['V'] = {ELEMENT, 23, 1, 0, 0}, \
+	['W'] = {ELEMENT, 74, 1, 0, 0}, \
+	['X'] = {0, -1, 1, 0, P_X}, \
+	['Y'] = {ELEMENT, 39, 1, 0, P_Y}, \
+	['Z'] = {0, -1, 1, 0, P_Z}
+
+/*
+ * Lexer tables, indexed by the inbracket flag and the first character
+ * of a token.
+ * Characters that can't begin a token have type zero.
+ */
+static const struct lexeme lexemes[2][256] = {
+	{
+		LEX_COMMON,
+		['b'] = {AROMATIC_ORGANIC, 5, 1, 0, 0},
+		['c'] = {AROMATIC_ORGANIC, 6, 1, 0, 0},
+		['n'] = {AROMATIC_ORGANIC, 7, 1, 0, 0},
+		['o'] = {AROMATIC_ORGANIC, 8, 1, 0, 0},
+		['p'] = {AROMATIC_ORGANIC, 15, 1, 0, 0},
+		['s'] = {AROMATIC_ORGANIC, 16, 1, 0, 0},
+		['B'] = {ALIPHATIC_ORGANIC, 5, 1, 0, P_BR},
+		['C'] = {ALIPHATIC_ORGANIC, 6, 1, 0, P_CL},
+		['F'] = {ALIPHATIC_ORGANIC, 9, 1, 0, 0},
+		['I'] = {ALIPHATIC_ORGANIC, 53, 1, 0, 0},
+		['N'] = {ALIPHATIC_ORGANIC, 7, 1, 0, 0},
+		['O'] = {ALIPHATIC_ORGANIC, 8, 1, 0, 0},
+		['P'] = {ALIPHATIC_ORGANIC, 15, 1, 0, 0},
+		['S'] = {ALIPHATIC_ORGANIC, 16, 1, 0, 0},
+		['-'] = {BOND, COHO_SMILES_BOND_SINGLE, 1, 0, 0},
+		[':'] = {BOND, COHO_SMILES_BOND_AROMATIC, 1, 0, 0},
+	},
+	{
+		LEX_COMMON,
+		['a'] = {0, -1, 1, 0, P_as},
+		['b'] = {AROMATIC, 5, 1, 0, 0},
+		['c'] = {AROMATIC, 6, 1, 0, 0},
+		['n'] = {AROMATIC, 7, 1, 0, 0},
+		['o'] = {AROMATIC, 8, 1, 0, 0},
+		['p'] = {AROMATIC, 15, 1, 0, 0},
+		['s'] = {AROMATIC, 16, 1, 0, P_se},
+		['B'] = {ELEMENT, 5, 1, 0, P_B},
+		['C'] = {ELEMENT, 6, 1, 0, P_C},
+		['F'] = {ELEMENT, 9, 1, 0, P_F},
+		['I'] = {ELEMENT, 53, 1, 0, P_I},
+		['N'] = {ELEMENT, 7, 1, 0, P_N},
+		['O'] = {ELEMENT, 8, 1, 0, P_O},
+		['P'] = {ELEMENT, 15, 1, 0, P_P},
+		['S'] = {ELEMENT, 16, 1, 0, P_S},
+		['-'] = {MINUS, -1, 1, 0, 0},
+		[':'] = {COLON, -1, 1, 0, 0},
+	},
 };
 
+#undef LEX_COMMON
+
 void coho_smiles_free(struct coho_smiles *x)
 {
-	free(x->atoms);
-	free(x->bonds);
-	free(x->paren_stack);
+	coho_smiles_shrink(x);
 }
 
 void coho_smiles_init(struct coho_smiles *x)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_smiles_init_with_allocator(x, &a);
+}
+
+/*
+ * Initializes a context that obtains all of its memory from allocator.
+ */
+void coho_smiles_init_with_allocator(struct coho_smiles *x,
+    const struct coho_allocator *allocator)
 {
 	size_t i;
 
+	x->flags = 0;
+	x->allocator = *allocator;
+	x->allocator.held = 0;
+
 	x->smiles = NULL;
+	x->smiles_base = 0;
 	x->position = 0;
 	x->end = 0;
 	x->error[0] = '\0';
 	x->error_position = -1;
+	x->token.position = -1;
+	x->token_inbracket = 0;
 
 	x->atom_count = 0;
 	x->bond_count = 0;
@@ -136,229 +457,338 @@ void coho_smiles_init(struct coho_smiles *x)
 	x->bonds_cap = 0;
 	x->paren_stack = NULL;
 	x->paren_stack_cap = 0;
-
-	for (i = 0; i < 100; i++)
-		coho_smiles_bond_init(&x->ring_bonds[i]);
+	x->big_rings_cap = 0;
+	x->trim_after = 0;
+	x->trim_above = 0;
+	x->trim_count = 0;
+
+	x->state = INIT;
+	x->last_atom = -1;
+	coho_smiles_bond_init(&x->open_bond);
+	coho_smiles_bond_init(&x->next_bond);
+	x->validating = 0;
+	x->last_position = -1;
+	x->last_aromatic = 0;
+	x->handler = NULL;
+	x->stopped = 0;
+	x->stream = NULL;
+	x->stream_len = 0;
+	x->stream_cap = 0;
+	x->streaming = 0;
+	x->stream_status = COHO_OK;
+
+	x->neighbor_offsets = NULL;
+	x->neighbor_atoms = NULL;
+	x->neighbor_bonds = NULL;
+	x->bond_slots = NULL;
+	x->big_rings = NULL;
+
+	x->packed_atoms = NULL;
+	x->packed_bonds = NULL;
+	x->packed_cap = 0;
+	coho_smiles_columns_init(&x->columns, &x->allocator);
+
+	for (i = 0; i < 4; i++)
+		x->ring_open[i] = 0;
+	x->big_ring_count = 0;
 	x->open_ring_closures = 0;
 }
 
-int coho_smiles_read(struct coho_smiles *x, const char *smiles, size_t sz)
+/*
+ * Sets the context to release its memory once it has held more than
+ * bytes for the given number of consecutive parses.
+ * A count of zero disables this.
+ */
+void coho_smiles_set_trim(struct coho_smiles *x, int parses, size_t bytes)
+{
+	x->trim_after = parses;
+	x->trim_above = bytes;
+	x->trim_count = 0;
+}
+
+/*
+ * Releases the memory held by the context.
+ * The results of the last parse are discarded.
+ */
+void coho_smiles_shrink(struct coho_smiles *x)
+{
+	free_arrays(x);
+	free_packed(x);
+	coho_smiles_columns_free(&x->columns);
+	coho_mem_free(&x->allocator, x->stream, x->stream_cap, 1);
+	x->stream = NULL;
+	x->stream_cap = 0;
+	x->stream_len = 0;
+	x->streaming = 0;
+	x->atom_count = 0;
+	x->bond_count = 0;
+	x->trim_count = 0;
+}
+
+/*
+ * Returns the number of bytes of memory held by the context.
+ */
+size_t coho_smiles_memory(const struct coho_smiles *x)
+{
+	return x->allocator.held;
+}
+
+/*
+ * Parses the next n bytes of a SMILES string that arrives in pieces.
+ * The first call after coho_smiles_init(), coho_smiles_read() or
+ * coho_smiles_finish() starts a new string.
+ * Parsing proceeds as far as the bytes received allow, and the context
+ * keeps a copy of only those not yet parsed, unless COHO_SMILES_PACKED
+ * is set, in which case the packed atoms need the whole string.
+ * Returns COHO_OK if no error has been found so far, COHO_ERROR if the
+ * string can't be parsed, or COHO_NOMEM if memory could not be
+ * allocated.  Once an error is returned, later bytes are ignored until
+ * coho_smiles_finish() is called.
+ */
+int coho_smiles_feed(struct coho_smiles *x, const char *bytes, size_t n)
+{
+	struct coho_smiles_scan scan;
+	size_t len, keep, cap;
+	char *p;
+
+	if (!x->streaming) {
+		x->stream_len = 0;
+		start(x, x->stream, 0);
+		x->streaming = 1;
+		x->stream_status = COHO_OK;
+	}
+	if (x->stream_status != COHO_OK || n == 0)
+		return x->stream_status;
+
+	len = x->stream_len + n;
+	if (len < n || len > INT_MAX) {
+		strlcpy(x->error, "SMILES too long", sizeof(x->error));
+		return x->stream_status = COHO_NOMEM;
+	}
+
+	if ((x->flags & COHO_SMILES_PRESCAN) &&
+	    coho_smiles_scan(&scan, bytes, n)) {
+		strlcpy(x->error, "illegal character", sizeof(x->error));
+		x->error_position = x->stream_len + scan.illegal;
+		return x->stream_status = COHO_ERROR;
+	}
+
+	/* Positions stay those within the whole string. */
+	if (!(x->flags & COHO_SMILES_PACKED) && x->position > x->smiles_base) {
+		keep = x->stream_len - x->position;
+		memmove(x->stream, x->stream + (x->position - x->smiles_base),
+		    keep);
+		x->smiles_base = x->position;
+	}
+	keep = len - x->smiles_base;
+	if (keep > x->stream_cap) {
+		cap = next_array_cap(keep);
+		if ((p = coho_mem_realloc(&x->allocator, x->stream,
+		    x->stream_cap, cap, 1)) == NULL)
+			return x->stream_status = COHO_NOMEM;
+		x->stream = p;
+		x->stream_cap = cap;
+	}
+	memcpy(x->stream + (x->stream_len - x->smiles_base), bytes, n);
+	x->stream_len = len;
+	x->smiles = x->stream;
+
+	if (grow_array_capacities(x, len))
+		return x->stream_status = COHO_NOMEM;
+
+	/* Parse up to the last atom, which may continue in later bytes. */
+	x->end = stream_cut(x);
+	x->token.position = -1;
+	return x->stream_status = parse(x, 0);
+}
+
+/*
+ * Completes the parse of a string given to coho_smiles_feed().
+ * Returns the same values as coho_smiles_read().
+ */
+int coho_smiles_finish(struct coho_smiles *x)
 {
-	struct coho_smiles_bond b;
-	int anum;			/* index of last atom read */
-	int eos;			/* end-of-string flag */
 	int rc;
+
+	if (!x->streaming)
+		coho_smiles_feed(x, NULL, 0);
+	x->streaming = 0;
+
+	if ((rc = x->stream_status) != COHO_OK)
+		return rc;
+
+	x->end = x->stream_len;
+	x->token.position = -1;
+	if ((rc = parse(x, 1)) != COHO_OK)
+		return rc;
+	return complete(x);
+}
+
+int coho_smiles_read(struct coho_smiles *x, const char *smiles, size_t sz)
+{
+	struct coho_smiles_scan scan;
 	size_t end;
+	int rc;
 
-	enum {
-		INIT,
-		ATOM_READ,
-		BOND_READ,
-		DOT_READ,
-		OPEN_PAREN_READ,
-		CLOSE_PAREN_READ,
-	} state;
+	x->streaming = 0;
 
 	end = sz ? sz : strlen(smiles);
 	if (sz > INT_MAX) {
 		strlcpy(x->error, "SMILES too long", sizeof(x->error));
 		return COHO_NOMEM;
 	}
-	coho_smiles_reinit(x, smiles, end);
 
-	if (ensure_array_capacities(x, end)) {
+	/*
+	 * Reject strings containing bytes that can't appear in SMILES
+	 * before doing any other work.
+	 */
+	if (x->flags & COHO_SMILES_PRESCAN) {
+		if (coho_smiles_scan(&scan, smiles, end)) {
+			coho_smiles_reinit(x, smiles, end);
+			strlcpy(x->error, "illegal character", sizeof(x->error));
+			x->error_position = scan.illegal;
+			return COHO_ERROR;
+		}
+	} else if (x->flags & COHO_SMILES_EXACT) {
+		coho_smiles_scan(&scan, smiles, end);
+	}
+
+	start(x, smiles, end);
+
+	if (ensure_array_capacities(x, end,
+	    x->flags & COHO_SMILES_EXACT ? &scan : NULL)) {
 		return COHO_NOMEM;
 	}
 
-	b.atom0 = -1;		/* no previous atom to bond to */
-	anum = -1;
-	state = INIT;
+	if ((rc = parse(x, 1)) != COHO_OK)
+		return rc;
+	return complete(x);
+}
 
-	for (;;) {
-		eos = x->position == x->end;
+/*
+ * Parses a SMILES string without storing atoms or bonds, calling the
+ * functions of handler as each atom, bond, ring bond opening, branch and
+ * component is read.
+ * Bonds are reported once both atoms are read, with atom0 < atom1.
+ * Implicit hydrogen counts are not computed.
+ * Only the open ring bonds, the parenthesis stack and the bonds to the
+ * last atom read, which are checked for duplicates, are kept, so memory
+ * use does not grow with the length of the string.
+ * On return, x->atom_count and x->bond_count are zero.
+ * Returns the same values as coho_smiles_read(), or COHO_STOPPED if a
+ * handler function stopped the parse.
+ */
+int coho_smiles_read_events(struct coho_smiles *x, const char *smiles,
+    size_t sz, const struct coho_smiles_handler *handler)
+{
+	struct coho_smiles_scan scan;
+	size_t end;
+	int rc;
 
-		switch (state) {
+	x->streaming = 0;
 
-		case INIT:
-			/* Parsing has just begun.  */
-			if (eos) {
-				strlcpy(x->error, "empty SMILES",
-				    sizeof(x->error));
-				goto err;
-			} else if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-			} else {
-				strlcpy(x->error, "atom expected",
-				    sizeof(x->error));
-				goto err;
-			}
-			state = ATOM_READ;
-			break;
+	end = sz ? sz : strlen(smiles);
+	if (sz > INT_MAX) {
+		strlcpy(x->error, "SMILES too long", sizeof(x->error));
+		return COHO_NOMEM;
+	}
 
-		case ATOM_READ:
-			/* An atom has just been read. */
+	if ((x->flags & COHO_SMILES_PRESCAN) &&
+	    coho_smiles_scan(&scan, smiles, end)) {
+		coho_smiles_reinit(x, smiles, end);
+		strlcpy(x->error, "illegal character", sizeof(x->error));
+		x->error_position = scan.illegal;
+		return COHO_ERROR;
+	}
 
-			/*
-			 * If there is an open bond to the previous
-			 * atom, complete it.
-			 */
-			if (b.atom0 != -1) {
-				b.atom1 = anum;
-				finalize_implicit_bond_order(x, &b);
-				if (add_bond(x, &b) == -1)
-					goto err;
-			}
+	start(x, smiles, end);
+	if (handler == NULL) {
+		if (quick_validate(x) == 0)
+			return COHO_OK;
+		coho_smiles_reinit(x, smiles, end);
+	}
+	x->validating = 1;
+	x->handler = handler;
+
+	/* Only bonds, paren_stack and big_rings are used, grown as needed. */
+	if (x->bonds == NULL) {
+		x->bonds = x->storage.bonds;
+		x->bonds_cap = COHO_SMILES_INLINE;
+		x->paren_stack = x->storage.paren_stack;
+		x->paren_stack_cap = COHO_SMILES_INLINE;
+	}
 
-			/*
-			 * The atom just read may be bonded to subsequent
-			 * atoms.  Store this state in an incomplete bond.
-			 */
-			coho_smiles_bond_init(&b);
-			b.atom0 = anum;
-			b.is_implicit = 1;
+	if ((rc = parse(x, 1)) == COHO_OK)
+		rc = complete(x);
 
-			if (eos) {
-				goto done;
-			} else if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-			} else if ((rc = bond(x, &b))) {
-				if (rc == -1)
-					goto err;
-				state = BOND_READ;
-			} else if (dot(x)) {
-				state = DOT_READ;
-			} else if (open_paren(x, &b)) {
-				state = OPEN_PAREN_READ;
-			} else if ((rc = close_paren(x, &b))) {
-				if (rc == -1)
-					goto err;
-				state = CLOSE_PAREN_READ;
-			} else {
-				goto unexpected;
-			}
+	if (x->stopped)
+		rc = x->stopped;
+	x->validating = 0;
+	x->handler = NULL;
+	return rc;
+}
 
-			break;
+/*
+ * Checks that a SMILES string can be parsed, reporting errors exactly
+ * as coho_smiles_read() does, but without storing atoms or bonds.
+ */
+int coho_smiles_validate(struct coho_smiles *x, const char *smiles,
+    size_t sz)
+{
+	return coho_smiles_read_events(x, smiles, sz, NULL);
+}
 
-		case DOT_READ:
-			/*
-			 * A dot (.) has just been read.  An atom is expected.
-			 * If there is a bond to a previous atom awaiting
-			 * completion, it must be cancelled.
-			 */
+/*
+ * Returns the symbol of the element with the given atomic number,
+ * "*" for 0, or NULL if there is no such element.
+ */
+const char *coho_smiles_element_symbol(int atomic_number)
+{
+	if (atomic_number < 0 || (size_t)atomic_number >= NELEMENTS)
+		return NULL;
+	return elements[atomic_number].symbol;
+}
 
-			/* Invalidate open bond to previous atom. */
-			b.atom0 = -1;
+/*
+ * Returns the number of hydrogens attached to atom i, whether given in
+ * its brackets or implied by the organic subset.
+ * Hydrogens written as atoms of their own are not counted.
+ */
+int coho_smiles_hydrogen_count(const struct coho_smiles *x, int i)
+{
+	const struct coho_smiles_atom *a = &x->atoms[i];
 
-			if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-			} else {
-				strlcpy(x->error, "atom must follow dot",
-				    sizeof(x->error));
-				goto err;
-			}
-			state = ATOM_READ;
-			break;
+	if (a->is_bracket)
+		return a->hydrogen_count > 0 ? a->hydrogen_count : 0;
+	if (!a->is_organic)
+		return 0;
+	if (a->implicit_hydrogen_count >= 0)
+		return a->implicit_hydrogen_count;
+	return coho_smiles_organic_hydrogen_count(x, i);
+}
 
-		case BOND_READ:
-			/*
-			 * A bond (-, =, #, etc) has just been read.
-			 * An atom is expected.
-			 */
-			if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-			} else {
-				strlcpy(x->error, "atom must follow bond",
-				    sizeof(x->error));
-				goto err;
-			}
-			state = ATOM_READ;
-			break;
+/*
+ * Returns the number of hydrogens atom i would be given if it were
+ * written without brackets, or -1 if its element can't be written so.
+ * Only b, c, n, o, p and s may be aromatic.
+ */
+int coho_smiles_organic_hydrogen_count(const struct coho_smiles *x, int i)
+{
+	const struct coho_smiles_atom *a = &x->atoms[i];
+	int valence, std;
 
-		case OPEN_PAREN_READ:
-			/*
-			 * An opening parenthesis has just been read
-			 * and the parenthesis stack pushed.
-			 */
-			if (eos) {
-				strlcpy(x->error, "unbalanced parenthesis",
-				    sizeof(x->error));
-				x->error_position = x->position - 1;
-				goto err;
-			} else if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-				state = ATOM_READ;
-			} else if ((rc = bond(x, &b))) {
-				if (rc == -1)
-					goto err;
-				state = BOND_READ;
-			} else if (dot(x)) {
-				state = DOT_READ;
-			} else {
-				strlcpy(x->error, "atom, bond, or dot expected",
-				    sizeof(x->error));
-				goto err;
-			}
-			break;
+	if (a->atomic_number == 0)
+		return a->is_aromatic ? -1 : 0;
+	if (a->atomic_number < 0 || (size_t)a->atomic_number >= NELEMENTS ||
+	    elements[a->atomic_number].valences[0] == 0)
+		return -1;
+	if (a->is_aromatic && a->atomic_number > 8 && a->atomic_number != 15 &&
+	    a->atomic_number != 16)
+		return -1;
 
-		case CLOSE_PAREN_READ:
-			/*
-			 * A closing parenthesis has just been read
-			 * and the parenthesis stack popped.
-			 */
-			if (eos) {
-				goto done;
-			} else if ((rc = atom_ringbond(x, &anum))) {
-				if (rc == -1)
-					goto err;
-				state = ATOM_READ;
-			} else if ((rc = bond(x, &b))) {
-				if (rc == -1)
-					goto err;
-				state = BOND_READ;
-			} else if (dot(x)) {
-				state = DOT_READ;
-			} else if (open_paren(x, &b)) {
-				state = OPEN_PAREN_READ;
-			} else if ((rc = close_paren(x, &b))) {
-				if (rc == -1)
-					goto err;
-				state = CLOSE_PAREN_READ;
-			} else {
-				goto unexpected;
-			}
-			break;
-		}
-	}
-
-done:
-	assert(x->position == x->end);
-
-	if (check_ring_closures(x))
-		goto err;
-
-	if (x->paren_stack_count > 0) {
-		strlcpy(x->error, "unbalanced parenthesis",
-		    sizeof(x->error));
-		x->error_position = x->paren_stack[0].position;
-		goto err;
-	}
-
-	if (assign_implicit_hydrogen_count(x))
-		goto err;
-
-	return COHO_OK;
-
-unexpected:
-	strlcpy(x->error, "unexpected character", sizeof(x->error));
-err:
-	if (x->error_position == -1)
-		x->error_position = x->position;
-	return COHO_ERROR;
+	valence = atom_valence(x, i);
+	std = round_valence(a->atomic_number, valence, a->is_aromatic);
+	return std == -1 ? 0 : std - valence;
 }
 
 /*
@@ -369,7 +799,7 @@ err:
  */
 static int atom_class(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 	int n;
 
 	if (!match(x, &t, 1, COLON))
@@ -391,10 +821,31 @@ static int atom_class(struct coho_smiles *x, struct coho_smiles_atom *a)
 
 /*
  * Saves a completed atom and returns its index.
+ * The parent is the index of the preceding atom the new one will be
+ * bonded to, or -1 if there is none.
+ * The bond to the parent is always the atom's first neighbor, so
+ * its slot is reserved here.
+ * When validating, only passes the atom to the handler, returning -1
+ * if it asks to stop.
  */
-static int add_atom(struct coho_smiles *x, struct coho_smiles_atom *a)
+static int add_atom(struct coho_smiles *x, struct coho_smiles_atom *a,
+    int parent)
 {
+	x->last_position = a->position;
+	if (NO_SPANS(x)) {
+		a->position = -1;
+		a->length = 0;
+	}
+
+	x->last_aromatic = a->is_aromatic;
+	if (x->validating) {
+		if ((parent == -1 && EMIT(x, on_component, x->atom_count)) ||
+		    EMIT(x, on_atom, a, x->atom_count))
+			return stop(x);
+		return x->atom_count++;
+	}
 	x->atoms[x->atom_count] = *a;
+	x->neighbor_offsets[x->atom_count + 1] = parent == -1 ? 0 : 1;
 	return x->atom_count++;
 }
 
@@ -402,13 +853,25 @@ static int add_atom(struct coho_smiles *x, struct coho_smiles_atom *a)
  * Saves a new bond to the bond list and returns its index.
  * Returns new length of bond list on success.
  * If the bond is already in the list, sets x->error and returns -1.
- * Bonds are added so that bond->atom0 < bond->atom1 and the entire bond list
- * remains sorted.
+ * Bonds are added so that bond->atom0 < bond->atom1.
+ * The bond occupies position slot0 in the neighbor list of bond->atom0 and
+ * slot1 in that of bond->atom1.
+ *
+ * Every bond is added while its higher-numbered atom is the last atom
+ * read, so the list is ordered by atom1 and any duplicate is found among
+ * the bonds at its end that share atom1.
+ * The list is put in its final order by sort_bonds().
+ * When validating, only the bonds to the last atom read are kept, and
+ * the bond is passed to the handler.  These are few, so the array is
+ * grown only as they need.
  */
-static int add_bond(struct coho_smiles *x, struct coho_smiles_bond *bond)
+static int add_bond(struct coho_smiles *x, struct coho_smiles_bond *bond,
+    int slot0, int slot1)
 {
-	size_t i, move;
+	int i;
 	struct coho_smiles_bond nb, *b;
+	int tmp;
+	void *p;
 
 	nb = *bond;
 
@@ -416,6 +879,9 @@ static int add_bond(struct coho_smiles *x, struct coho_smiles_bond *bond)
 	if (bond->atom0 > bond->atom1) {
 		nb.atom0 = bond->atom1;
 		nb.atom1 = bond->atom0;
+		tmp = slot0;
+		slot0 = slot1;
+		slot1 = tmp;
 
 		if (bond->stereo == COHO_SMILES_BOND_STEREO_UP)
 			nb.stereo = COHO_SMILES_BOND_STEREO_DOWN;
@@ -423,38 +889,89 @@ static int add_bond(struct coho_smiles *x, struct coho_smiles_bond *bond)
 			nb.stereo = COHO_SMILES_BOND_STEREO_UP;
 	}
 
-	/*
-	 * Find position to insert and check for duplicates.
-	 * Start search from end, since bonds are
-	 * mostly generated in the correct order.
-	 */
+	if (x->validating && x->bond_count > 0 &&
+	    x->bonds[x->bond_count - 1].atom1 != nb.atom1)
+		x->bond_count = 0;
+
 	for (i = x->bond_count; i > 0; i--) {
 		b = &x->bonds[i-1];
-		if (nb.atom0 > b->atom0)
-			break;
-		else if (nb.atom0 < b->atom0)
-			continue;
-		else if (nb.atom1 > b->atom1)
+		if (b->atom1 != nb.atom1)
 			break;
-		else if (nb.atom1 < b->atom1)
-			continue;
-		else {
+		else if (b->atom0 == nb.atom0) {
 			strlcpy(x->error, "duplicate bond", sizeof(x->error));
 			x->error_position = nb.position;
 			return -1;
 		}
 	}
 
-	move = x->bond_count - i;		/* # elements to shift */
-	if (move) {
-		memmove(x->bonds + i + 1, x->bonds + i,
-		    move * sizeof(x->bonds[0]));
+	if (NO_SPANS(x)) {
+		nb.position = -1;
+		nb.length = 0;
 	}
 
+	i = x->bond_count;
+	if ((size_t)i == x->bonds_cap) {
+		if ((p = grow_validation_array(x, x->bonds, &x->bonds_cap,
+		    sizeof(x->bonds[0]), IS_INLINE(x, bonds))) == NULL)
+			return nomem(x);
+		x->bonds = p;
+	}
 	x->bonds[i] = nb;
+	if (x->validating) {
+		if (EMIT(x, on_bond, &nb))
+			return stop(x);
+		return x->bond_count++;
+	}
+
+	if (i > 0 && x->bonds[i-1].atom0 > nb.atom0)
+		x->bonds_unsorted = 1;
+
+	x->bond_slots[2 * i] = slot0;
+	x->bond_slots[2 * i + 1] = slot1;
 	return x->bond_count++;
 }
 
+/*
+ * Adds a ring bond closure numbered 100 or more.
+ * Behaves like add_ringbond().
+ */
+static int add_big_ringbond(struct coho_smiles *x, int rnum,
+    struct coho_smiles_bond *b)
+{
+	struct coho_smiles_ring *r;
+	void *p;
+	int i;
+
+	for (i = 0; i < x->big_ring_count; i++) {
+		r = &x->big_rings[i];
+		if (r->number != rnum)
+			continue;
+		if (close_ringbond(x, &r->bond, r->slot, r->aromatic, b))
+			return -1;
+		*r = x->big_rings[--x->big_ring_count];
+		x->open_ring_closures--;
+		return 0;
+	}
+
+	if ((size_t)x->big_ring_count == x->big_rings_cap) {
+		if ((p = grow_validation_array(x, x->big_rings,
+		    &x->big_rings_cap, sizeof(x->big_rings[0]), 0)) == NULL)
+			return nomem(x);
+		x->big_rings = p;
+	}
+	r = &x->big_rings[x->big_ring_count++];
+	r->number = rnum;
+	r->bond = *b;
+	r->bond.is_implicit = 0;
+	r->bond.is_ring = 1;
+	r->slot = next_neighbor_slot(x, b->atom0);
+	r->aromatic = x->last_aromatic;
+	x->open_ring_closures++;
+	if (EMIT(x, on_ring_open, rnum, &r->bond))
+		return stop(x);
+	return 0;
+}
+
 /*
  * Adds a ring bond closure.
  * If there is already an open ring bond using rnum,
@@ -468,55 +985,36 @@ static int add_ringbond(struct coho_smiles *x, int rnum,
 {
 	struct coho_smiles_bond *rb;
 
-	assert(rnum < 100);
-
 	if (b->order == COHO_SMILES_BOND_UNSPECIFIED)
 		assert(b->stereo == COHO_SMILES_BOND_STEREO_UNSPECIFIED);
 
+	if (rnum >= 100)
+		return add_big_ringbond(x, rnum, b);
+
 	rb = &x->ring_bonds[rnum];
 
-	if (rb->atom0 == -1) {
-		rb->atom0 = b->atom0;
-		rb->order = b->order;
-		rb->stereo = b->stereo;
+	if (!(RING_WORD(x, rnum) & RING_BIT(rnum))) {
+		*rb = *b;
 		rb->is_implicit = 0;
 		rb->is_ring = 1;
-		rb->position = b->position;
-		rb->length = b->length;
+		x->ring_slots[rnum] = next_neighbor_slot(x, b->atom0);
+		RING_WORD(x, rnum) |= RING_BIT(rnum);
+		if (x->last_aromatic)
+			x->ring_aromatic[rnum / 32] |= RING_BIT(rnum);
+		else
+			x->ring_aromatic[rnum / 32] &= ~RING_BIT(rnum);
 		x->open_ring_closures++;
+		if (EMIT(x, on_ring_open, rnum, rb))
+			return stop(x);
 		return 0;
 	}
 
-	/* Close the open bond */
-	if (rb->atom0 == b->atom0) {
-		strlcpy(x->error, "atom ring-bonded to itself",
-		    sizeof(x->error));
-		x->error_position = x->atoms[b->atom0].position;
+	if (close_ringbond(x, rb, x->ring_slots[rnum],
+	    (x->ring_aromatic[rnum / 32] & RING_BIT(rnum)) != 0, b))
 		return -1;
-	}
-
-	if (rb->order == COHO_SMILES_BOND_UNSPECIFIED)
-		rb->order = b->order;
-	else if (b->order == COHO_SMILES_BOND_UNSPECIFIED)
-		; /* pass */
-	else if (rb->order != b->order) {
-		strlcpy(x->error, "conflicting ring bond orders",
-		    sizeof(x->error));
-		x->error_position = x->atoms[b->atom0].position;
-		return -1;
-	}
-	if (rb->order == COHO_SMILES_BOND_UNSPECIFIED)
-		rb->order = COHO_SMILES_BOND_SINGLE;
-
-	rb->atom1 = b->atom0;
 
-	if (add_bond(x, rb) == -1)
-		return -1;
-
-	coho_smiles_bond_init(rb);
-	rb->atom0 = -1; ;		/* mark slot open again */
+	RING_WORD(x, rnum) &= ~RING_BIT(rnum);
 	x->open_ring_closures--;
-
 	return 0;
 }
 
@@ -526,7 +1024,7 @@ static int add_ringbond(struct coho_smiles *x, int rnum,
  */
 static int aliphatic_organic(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, ALIPHATIC_ORGANIC))
 		return 0;
@@ -535,7 +1033,8 @@ static int aliphatic_organic(struct coho_smiles *x, struct coho_smiles_atom *a)
 	a->atomic_number = t.intval;
 	a->is_organic = 1;
 	a->length = t.n;
-	tokcpy(a->symbol, &t, sizeof(a->symbol));
+	if (!(x->flags & COHO_SMILES_NO_SYMBOLS))
+		tokcpy(a->symbol, &t, sizeof(a->symbol));
 	return 1;
 }
 
@@ -546,7 +1045,7 @@ static int aliphatic_organic(struct coho_smiles *x, struct coho_smiles_atom *a)
 static int aromatic_organic(struct coho_smiles *x,
     struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, AROMATIC_ORGANIC))
 		return 0;
@@ -556,7 +1055,8 @@ static int aromatic_organic(struct coho_smiles *x,
 	a->is_organic = 1;
 	a->is_aromatic = 1;
 	a->length = t.n;
-	tokcpy(a->symbol, &t, sizeof(a->symbol));
+	if (!(x->flags & COHO_SMILES_NO_SYMBOLS))
+		tokcpy(a->symbol, &t, sizeof(a->symbol));
 	return 1;
 }
 
@@ -566,22 +1066,12 @@ static int aromatic_organic(struct coho_smiles *x,
  */
 static int assign_implicit_hydrogen_count(struct coho_smiles *x)
 {
-	int i, valence, std;
-	struct coho_smiles_atom *a;
+	int i;
 
 	for (i = 0; i < x->atom_count; i++) {
-		a = &x->atoms[i];
-
-		if (!a->is_organic)
-			continue;
-
-		valence = atom_valence(x, i);
-		std = round_valence(a->atomic_number, valence, a->is_aromatic);
-
-		if (std == -1)
-			a->implicit_hydrogen_count = 0;
-		else
-			a->implicit_hydrogen_count = std - valence;
+		if (x->atoms[i].is_organic)
+			x->atoms[i].implicit_hydrogen_count =
+			    coho_smiles_organic_hydrogen_count(x, i);
 	}
 
 	return 0;
@@ -590,9 +1080,11 @@ static int assign_implicit_hydrogen_count(struct coho_smiles *x)
 /*
  * Matches an atom or returns 0 if not found.
  * If successful, stores the index of the new atom in *anum and returns 1.
+ * The parent is the index of the preceding atom the new one will be
+ * bonded to, or -1 if there is none.
  * On error, sets x->error and returns -1.
  */
-static int atom(struct coho_smiles *x, int *atom_index)
+static int atom(struct coho_smiles *x, int *atom_index, int parent)
 {
 	struct coho_smiles_atom a;
 	int rc;
@@ -606,27 +1098,32 @@ static int atom(struct coho_smiles *x, int *atom_index)
 	} else {
 		return 0;
 	}
-	*atom_index = add_atom(x, &a);
+	if ((*atom_index = add_atom(x, &a, parent)) == -1)
+		return -1;
 	return 1;
 }
 
 /*
  * Matches an atom followed by zero or more ringbonds.
  * On success, stores the index of the new atom in *anum and returns 1.
+ * A bond read after the ring bonds that does not begin another one is
+ * stored in *next, whose length is otherwise 0.
  * Returns 0 if there is no match.
+ * The parent is as described for atom().
  * On error, sets x->error and returns -1.
  */
-static int atom_ringbond(struct coho_smiles *x, int *anum)
+static int atom_ringbond(struct coho_smiles *x, int *anum, int parent,
+    struct coho_smiles_bond *next)
 {
 	int rc;
 
-	if ((rc = atom(x, anum))) {
+	if ((rc = atom(x, anum, parent))) {
 		if (rc == -1 )
 			return -1;
 	} else {
 		return 0;
 	}
-	while ((rc = ringbond(x, *anum)))
+	while ((rc = ringbond(x, *anum, next)))
 		if (rc == -1 )
 			return -1;
 	return 1;
@@ -638,21 +1135,18 @@ static int atom_ringbond(struct coho_smiles *x, int *anum)
  * Treats aromatic atoms as a special case in an attempt to
  * properly derive implicit hydrogen count.
  */
-static int atom_valence(struct coho_smiles *x, size_t idx)
+static int atom_valence(const struct coho_smiles *x, size_t idx)
 {
 	int i;
 	int valence, neighbors;
-	struct coho_smiles_bond *b;
+	const struct coho_smiles_bond *b;
 
 	valence = 0;
 	neighbors = 0;
 
-	for (i = 0; i < x->bond_count; i++) {
-		b = &x->bonds[i];
-		if (b->atom0 > (int)idx)
-			break;
-		else if (b->atom0 != (int)idx && b->atom1 != (int)idx)
-			continue;
+	for (i = x->neighbor_offsets[idx]; i < x->neighbor_offsets[idx + 1];
+	    i++) {
+		b = &x->bonds[x->neighbor_bonds[i]];
 
 		if (b->order == COHO_SMILES_BOND_SINGLE)
 			valence += 1;
@@ -683,7 +1177,7 @@ static int atom_valence(struct coho_smiles *x, size_t idx)
  */
 static int bond(struct coho_smiles *x, struct coho_smiles_bond *b)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, BOND))
 		return 0;
@@ -695,6 +1189,32 @@ static int bond(struct coho_smiles *x, struct coho_smiles_bond *b)
 	return 1;
 }
 
+/*
+ * Fills in the neighbor lists from the completed bond list.
+ * While parsing, neighbor_offsets[i + 1] holds the number of neighbors
+ * of atom i seen so far and bond_slots holds the position of each bond
+ * in the neighbor lists of its two atoms.
+ */
+static void build_adjacency(struct coho_smiles *x)
+{
+	int i, *off = x->neighbor_offsets;
+	struct coho_smiles_bond *b;
+
+	off[0] = 0;
+	for (i = 0; i < x->atom_count; i++)
+		off[i + 1] += off[i];
+
+	for (i = 0; i < x->bond_count; i++) {
+		b = &x->bonds[i];
+		x->neighbor_atoms[off[b->atom0] + x->bond_slots[2 * i]] =
+		    b->atom1;
+		x->neighbor_bonds[off[b->atom0] + x->bond_slots[2 * i]] = i;
+		x->neighbor_atoms[off[b->atom1] + x->bond_slots[2 * i + 1]] =
+		    b->atom0;
+		x->neighbor_bonds[off[b->atom1] + x->bond_slots[2 * i + 1]] = i;
+	}
+}
+
 /*
  * Matches a bracket atom or returns 0 if not found.
  * If found, initializes the atom, sets its fields, and returns 1.
@@ -702,7 +1222,7 @@ static int bond(struct coho_smiles *x, struct coho_smiles_bond *b)
  */
 static int bracket_atom(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, BRACKET_OPEN))
 		return 0;
@@ -740,19 +1260,32 @@ static int bracket_atom(struct coho_smiles *x, struct coho_smiles_atom *a)
  */
 static int check_ring_closures(struct coho_smiles *x)
 {
-	size_t i;
+	struct coho_smiles_ring *r, *lowest;
+	unsigned long w;
+	int i, n;
 
 	if (x->open_ring_closures == 0)
 		return 0;
 
 	strlcpy(x->error, "unclosed ring bond", sizeof(x->error));
 
-	for (i = 0; i < 100; i++) {
-		if (x->ring_bonds[i].atom0 != -1) {
-			x->error_position = x->ring_bonds[i].position;
-			break;
-		}
+	/* Report the lowest-numbered open ring bond. */
+	for (i = 0; i < 4; i++) {
+		if ((w = x->ring_open[i]) == 0)
+			continue;
+		for (n = 0; !(w & 1); n++)
+			w >>= 1;
+		x->error_position = x->ring_bonds[i * 32 + n].position;
+		return -1;
+	}
+
+	lowest = &x->big_rings[0];
+	for (i = 1; i < x->big_ring_count; i++) {
+		r = &x->big_rings[i];
+		if (r->number < lowest->number)
+			lowest = r;
 	}
+	x->error_position = lowest->bond.position;
 	return -1;
 }
 
@@ -764,7 +1297,8 @@ static int check_ring_closures(struct coho_smiles *x)
  */
 static int charge(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	const struct coho_smiles_token *p;
+	struct coho_smiles_token t;
 	int sign;
 	int n;
 	int length;
@@ -782,12 +1316,11 @@ static int charge(struct coho_smiles *x, struct coho_smiles_atom *a)
 		length += n;
 	} else {
 		a->charge = sign;
-		if (lex(x, &t, 1) & (PLUS | MINUS)) {
-			if (t.intval == sign) {
-				x->position += t.n;
-				a->charge *= 2;
-				length += t.n;
-			}
+		if ((p = lex(x, 1)) != NULL && p->type & (PLUS | MINUS) &&
+		    p->intval == sign) {
+			x->position += p->n;
+			a->charge *= 2;
+			length += p->n;
 		}
 	}
 	a->length += length;
@@ -802,11 +1335,12 @@ static int charge(struct coho_smiles *x, struct coho_smiles_atom *a)
  */
 static int chirality(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 1, CHIRALITY))
 		return 0;
-	tokcpy(a->chirality, &t, sizeof(a->chirality));
+	if (!(x->flags & COHO_SMILES_NO_CHIRALITY))
+		tokcpy(a->chirality, &t, sizeof(a->chirality));
 	a->length += t.n;
 	return 1;
 }
@@ -819,53 +1353,340 @@ static int chirality(struct coho_smiles *x, struct coho_smiles_atom *a)
  */
 static int close_paren(struct coho_smiles *x, struct coho_smiles_bond *b)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, PAREN_CLOSE))
 		return 0;
 	if (pop_paren_stack(x, t.position, b))
 		return -1;
+	if (EMIT(x, on_branch_close, b->atom0))
+		return stop(x);
 	return 1;
 }
 
+/*
+ * Closes the open ring bond rb, which occupies neighbor slot slot of
+ * its first atom, using the ring bond b read at the current atom.
+ * The first atom is aromatic if aromatic is set.  As for chain bonds,
+ * a ring bond without a bond symbol is aromatic between two aromatic
+ * atoms and single otherwise.
+ * Returns 0 on success.
+ * On failure, sets x->error and returns -1.
+ */
+static int close_ringbond(struct coho_smiles *x, struct coho_smiles_bond *rb,
+    int slot, int aromatic, struct coho_smiles_bond *b)
+{
+	if (rb->atom0 == b->atom0) {
+		strlcpy(x->error, "atom ring-bonded to itself",
+		    sizeof(x->error));
+		x->error_position = x->last_position;
+		return -1;
+	}
+
+	if (rb->order == COHO_SMILES_BOND_UNSPECIFIED)
+		rb->order = b->order;
+	else if (b->order == COHO_SMILES_BOND_UNSPECIFIED)
+		; /* pass */
+	else if (rb->order != b->order) {
+		strlcpy(x->error, "conflicting ring bond orders",
+		    sizeof(x->error));
+		x->error_position = x->last_position;
+		return -1;
+	}
+	if (rb->order == COHO_SMILES_BOND_UNSPECIFIED)
+		rb->order = aromatic && x->last_aromatic ?
+		    COHO_SMILES_BOND_AROMATIC : COHO_SMILES_BOND_SINGLE;
+
+	rb->atom1 = b->atom0;
+
+	if (add_bond(x, rb, slot, next_neighbor_slot(x, b->atom0)) == -1)
+		return -1;
+	return 0;
+}
+
+/*
+ * Checks and completes the molecule once the whole string is parsed.
+ * Returns COHO_OK, or COHO_ERROR or COHO_NOMEM on failure.
+ */
+static int complete(struct coho_smiles *x)
+{
+	if (check_ring_closures(x))
+		goto err;
+
+	if (x->paren_stack_count > 0) {
+		strlcpy(x->error, "unbalanced parenthesis",
+		    sizeof(x->error));
+		x->error_position = x->paren_stack[0].position;
+		goto err;
+	}
+
+	if (x->validating) {
+		x->atom_count = 0;
+		x->bond_count = 0;
+		return COHO_OK;
+	}
+
+	sort_bonds(x);
+	build_adjacency(x);
+
+	if (!(x->flags & COHO_SMILES_NO_HYDROGENS) &&
+	    assign_implicit_hydrogen_count(x))
+		goto err;
+
+	if (pack(x))
+		return COHO_NOMEM;
+
+	return COHO_OK;
+
+err:
+	if (x->error_position == -1)
+		x->error_position = x->position;
+	return COHO_ERROR;
+}
+
 /*
  * Matches dot, the no-bond specifier.
  * Returns 1 on success, 0 if there was no match.
  */
 static int dot(struct coho_smiles *x)
 {
-	struct token t;
+	struct coho_smiles_token t;
 	return match(x, &t, 0, DOT);
 }
 
-static int ensure_array_capacities(struct coho_smiles *x, size_t smiles_length)
+/*
+ * Ensures that the arrays have room for the results of parsing
+ * smiles_length bytes.
+ * If sc is not NULL, the arrays are instead sized from the counts
+ * it holds for the string.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int ensure_array_capacities(struct coho_smiles *x,
+    size_t smiles_length, const struct coho_smiles_scan *sc)
 {
-	size_t new_cap;
-	void *p;
+	size_t atoms, bonds, parens, rings;
+	int fits;
+
+	/* Validation and the event API keep no per-atom arrays. */
+	assert(!x->validating);
+
+	if (sc != NULL) {
+		/*
+		 * Every ring bond uses at least two ring digits and every
+		 * ring number of 100 or more uses three.
+		 */
+		atoms = MAX(sc->atoms, 1);
+		bonds = MAX(atoms - 1 + sc->rings / 2, 1);
+		parens = MAX(sc->parens, 1);
+		rings = sc->rings / 3 + 1;
+	} else {
+		/*
+		 * Maximum required storage is bounded by length of
+		 * SMILES string.
+		 */
+		atoms = bonds = parens = smiles_length;
+		rings = smiles_length / 4 + 1;	/* each needs "%(n)" */
+	}
 
-	/*
-	 * Maximum required storage is bounded by length of SMILES string.
-	 */
-	if (x->atoms_cap >= smiles_length)
+	if (x->atoms_cap >= atoms && x->bonds_cap >= bonds &&
+	    x->paren_stack_cap >= parens && x->big_rings_cap >= rings)
 		return 0;
 
-	new_cap = next_array_cap(smiles_length);
+	/* Nothing in the arrays needs to be kept. */
+	free_arrays(x);
+
+	fits = atoms <= COHO_SMILES_INLINE && bonds <= COHO_SMILES_INLINE &&
+	    parens <= COHO_SMILES_INLINE;
+	if (fits) {
+		atoms = bonds = parens = COHO_SMILES_INLINE;
+		rings = MAX(rings, COHO_SMILES_INLINE / 4 + 1);
+	} else if (sc == NULL) {
+		atoms = bonds = parens = next_array_cap(smiles_length);
+		rings = atoms / 4 + 1;
+	}
+	x->atoms_cap = atoms;
+	x->bonds_cap = bonds;
+	x->paren_stack_cap = parens;
+	x->big_rings_cap = rings;
+
+#define ALLOC(name, n) \
+	if ((x->name = coho_mem_alloc(&x->allocator, (n), \
+	    sizeof(x->name[0]))) == NULL) { \
+		free_arrays(x); \
+		return -1; \
+	}
+#define POINT(name, n) \
+	x->name = x->storage.name;
+
+	if (fits) {
+		INLINE_ARRAYS(POINT)
+	} else {
+		INLINE_ARRAYS(ALLOC)
+	}
+	HEAP_ARRAYS(ALLOC)
+
+#undef ALLOC
+#undef POINT
+	return 0;
+}
+
+/*
+ * Frees the arrays sized by ensure_array_capacities(), other than the
+ * context's inline storage.
+ */
+static void free_arrays(struct coho_smiles *x)
+{
+#define FREE(name, n) \
+	coho_mem_free(&x->allocator, x->name, (n), sizeof(x->name[0])); \
+	x->name = NULL;
+#define FREE_INLINE(name, n) \
+	if (!IS_INLINE(x, name)) \
+		coho_mem_free(&x->allocator, x->name, (n), \
+		    sizeof(x->name[0])); \
+	x->name = NULL;
+
+	INLINE_ARRAYS(FREE_INLINE)
+	HEAP_ARRAYS(FREE)
+
+#undef FREE
+#undef FREE_INLINE
+	x->atoms_cap = 0;
+	x->bonds_cap = 0;
+	x->paren_stack_cap = 0;
+	x->big_rings_cap = 0;
+}
+
+/*
+ * Frees the packed atoms and bonds.
+ */
+static void free_packed(struct coho_smiles *x)
+{
+	coho_mem_free(&x->allocator, x->packed_atoms, x->packed_cap,
+	    sizeof(x->packed_atoms[0]));
+	coho_mem_free(&x->allocator, x->packed_bonds, x->packed_cap,
+	    sizeof(x->packed_bonds[0]));
+	x->packed_atoms = NULL;
+	x->packed_bonds = NULL;
+	x->packed_cap = 0;
+}
+
+/*
+ * Like ensure_array_capacities(), but keeps the contents of the arrays,
+ * for a string that grows as it is parsed (see coho_smiles_feed()).
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int grow_array_capacities(struct coho_smiles *x, size_t smiles_length)
+{
+	void *p[8];
+	size_t len[8], size[8];
+	size_t atoms_cap, bonds_cap, paren_stack_cap, big_rings_cap, cap;
+	int i;
+
+	if (x->atoms_cap >= smiles_length && x->bonds_cap >= smiles_length &&
+	    x->paren_stack_cap >= smiles_length &&
+	    x->big_rings_cap >= smiles_length / 4 + 1)
+		return 0;
+
+	if (x->atom_count == 0 && x->paren_stack_count == 0 &&
+	    x->big_ring_count == 0)
+		return ensure_array_capacities(x, smiles_length, NULL);
+
+	atoms_cap = x->atoms_cap;
+	bonds_cap = x->bonds_cap;
+	paren_stack_cap = x->paren_stack_cap;
+	big_rings_cap = x->big_rings_cap;
+
+	cap = next_array_cap(smiles_length);
+	x->atoms_cap = x->bonds_cap = x->paren_stack_cap = cap;
+	x->big_rings_cap = cap / 4 + 1;
 
-#define GROW(name) \
-	do { \
-		p = reallocarray(x->name, new_cap, sizeof(x->name[0])); \
-		if (p == NULL) \
-			return -1; \
-		x->name = p; \
-		x->name##_cap = new_cap; \
-	} while (0)
+	i = 0;
 
-	GROW(atoms);
-	GROW(bonds);
-	GROW(paren_stack);
+#define ALLOC(name, n) \
+	len[i] = (n); \
+	size[i] = sizeof(x->name[0]); \
+	if ((p[i] = coho_mem_alloc(&x->allocator, len[i], size[i])) == NULL) \
+		goto fail; \
+	i++;
 
-#undef GROW
+	ARRAYS(ALLOC)
+
+#undef ALLOC
+
+	x->atoms_cap = atoms_cap;
+	x->bonds_cap = bonds_cap;
+	x->paren_stack_cap = paren_stack_cap;
+	x->big_rings_cap = big_rings_cap;
+
+	i = 0;
+
+#define MOVE(name, n) \
+	memcpy(p[i], x->name, (n) * size[i]); \
+	coho_mem_free(&x->allocator, x->name, (n), size[i]); \
+	x->name = p[i++];
+#define MOVE_INLINE(name, n) \
+	memcpy(p[i], x->name, (n) * size[i]); \
+	if (!IS_INLINE(x, name)) \
+		coho_mem_free(&x->allocator, x->name, (n), size[i]); \
+	x->name = p[i++];
+
+	INLINE_ARRAYS(MOVE_INLINE)
+	HEAP_ARRAYS(MOVE)
+
+#undef MOVE
+#undef MOVE_INLINE
+
+	x->atoms_cap = x->bonds_cap = x->paren_stack_cap = cap;
+	x->big_rings_cap = cap / 4 + 1;
 	return 0;
+
+fail:
+	while (i-- > 0)
+		coho_mem_free(&x->allocator, p[i], len[i], size[i]);
+	x->atoms_cap = atoms_cap;
+	x->bonds_cap = bonds_cap;
+	x->paren_stack_cap = paren_stack_cap;
+	x->big_rings_cap = big_rings_cap;
+	return -1;
+}
+
+/*
+ * Doubles the capacity *cap of array p, one of those used while
+ * validating, and returns the new array with the contents of p.
+ * The arrays validation doesn't use are freed first, since their
+ * lengths follow the capacities; ensure_array_capacities() allocates
+ * them again.
+ * Returns NULL if memory could not be allocated.
+ */
+static void *grow_validation_array(struct coho_smiles *x, void *p,
+    size_t *cap, size_t size, int is_inline)
+{
+	size_t len = *cap ? 2 * *cap : COHO_SMILES_INLINE / 4 + 1;
+	void *q;
+
+	assert(x->validating);
+
+#define FREE(name, n) \
+	coho_mem_free(&x->allocator, x->name, (n), sizeof(x->name[0])); \
+	x->name = NULL;
+
+	if (!IS_INLINE(x, atoms))
+		coho_mem_free(&x->allocator, x->atoms, x->atoms_cap,
+		    sizeof(x->atoms[0]));
+	x->atoms = NULL;
+	INDEX_ARRAYS(FREE)
+	x->atoms_cap = 0;
+
+#undef FREE
+
+	if ((q = coho_mem_alloc(&x->allocator, len, size)) == NULL)
+		return NULL;
+	if (*cap > 0)
+		memcpy(q, p, *cap * size);
+	if (!is_inline)
+		coho_mem_free(&x->allocator, p, *cap, size);
+	*cap = len;
+	return q;
 }
 
 /*
@@ -878,6 +1699,14 @@ static void finalize_implicit_bond_order(struct coho_smiles *x,
 	if (!b->is_implicit)
 		return;
 
+	/* The open bond holds the aromaticity of atom0 (see parse()). */
+	if (x->validating) {
+		if (b->order == COHO_SMILES_BOND_AROMATIC && !x->last_aromatic)
+			b->order = COHO_SMILES_BOND_SINGLE;
+		return;
+	}
+
+
 	if (x->atoms[b->atom0].is_aromatic && x->atoms[b->atom1].is_aromatic)
 		b->order = COHO_SMILES_BOND_AROMATIC;
 	else
@@ -891,7 +1720,7 @@ static void finalize_implicit_bond_order(struct coho_smiles *x,
  */
 static int hydrogen_count(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 1, HYDROGEN))
 		return 0;
@@ -912,87 +1741,395 @@ static int hydrogen_count(struct coho_smiles *x, struct coho_smiles_atom *a)
  * Matches an integer up to maxdigit long.
  * On success, stores the integer in *dst and returns number of digits.
  * Returns 0 if no digits are available.
- * Returns -1 if maxdigit is exceeded.
+ * Returns -1 if maxdigit is exceeded, setting x->error_position to the
+ * first digit.
+ * Digits are single-byte tokens in and out of brackets, so they are
+ * read directly rather than through the lexer.
  */
 static int integer(struct coho_smiles *x, size_t maxdigit, int *dst)
 {
-	size_t i;
+	const char *s = x->smiles + (x->position - x->smiles_base);
+	size_t i, len = x->end - x->position;
 	int n = 0;
-	int saved = x->position;
-	struct token t;
 
-	for (i = 0; lex(x, &t, 0) & DIGIT; i++) {
-		if (maxdigit && i == maxdigit) {
-			x->position = saved;
-			return -1;
+	for (i = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+		if (maxdigit && i == maxdigit) {
+			x->error_position = x->position;
+			return -1;
+		}
+		n = n * 10 + s[i] - '0';
+	}
+	if (i == 0)
+		return 0;
+	x->position += i;
+	*dst = n;
+	return i;
+}
+
+/*
+ * Parses isotope inside a bracket atom.
+ * If successful, sets a->isotope and increments a->length.
+ * Returns 1 if isotope was read, else 0.
+ * On error, returns -1 and sets x->error.
+ */
+static int isotope(struct coho_smiles *x, struct coho_smiles_atom *a)
+{
+	int n;
+
+	if ((n = integer(x, 5, &a->isotope)) == -1) {
+		strlcpy(x->error, "isotope too large", sizeof(x->error));
+		return -1;
+	}
+	a->length += n;
+	return 0;
+}
+
+/*
+ * Reads next token and checks if its type is among those requested.
+ * If so, copies the token to t, consumes it, and returns 1.
+ * If not, returns 0 and the parsing position remains unchanged.
+ */
+static int match(struct coho_smiles *x, struct coho_smiles_token *t,
+    int inbracket, unsigned int ttype)
+{
+	const struct coho_smiles_token *p;
+
+	if ((p = lex(x, inbracket)) == NULL || !(p->type & ttype))
+		return 0;
+	*t = *p;
+	x->position += p->n;
+	return 1;
+}
+
+/*
+ * Returns a new array capacity that is larger than
+ * its previous capacity.
+ */
+static size_t next_array_cap(size_t previous_cap)
+{
+	size_t cap = 2 * previous_cap - 1;
+	while (cap & (cap - 1))
+		cap = cap & (cap - 1);
+	return cap;
+}
+
+/*
+ * Returns the next free position in the neighbor list of an atom.
+ */
+static int next_neighbor_slot(struct coho_smiles *x, int atom)
+{
+	if (x->validating)
+		return 0;
+	return x->neighbor_offsets[atom + 1]++;
+}
+
+/*
+ * Records that memory could not be allocated while validating.
+ * Returns -1.
+ */
+static int nomem(struct coho_smiles *x)
+{
+	x->stopped = COHO_NOMEM;
+	return -1;
+}
+
+/*
+ * Fills the packed and columnar copies of the atoms and bonds
+ * requested by x->flags.
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+static int pack(struct coho_smiles *x)
+{
+	int i;
+
+	if (x->flags & COHO_SMILES_PACKED) {
+		if (x->packed_cap < MAX(x->atoms_cap, x->bonds_cap)) {
+			free_packed(x);
+			x->packed_cap = MAX(x->atoms_cap, x->bonds_cap);
+			x->packed_atoms = coho_mem_alloc(&x->allocator,
+			    x->packed_cap, sizeof(x->packed_atoms[0]));
+			x->packed_bonds = coho_mem_alloc(&x->allocator,
+			    x->packed_cap, sizeof(x->packed_bonds[0]));
+			if (x->packed_atoms == NULL ||
+			    x->packed_bonds == NULL) {
+				free_packed(x);
+				return -1;
+			}
+		}
+		/* The whole string is kept for this by coho_smiles_feed(). */
+		for (i = 0; i < x->atom_count; i++)
+			coho_smiles_pack_atom(&x->packed_atoms[i],
+			    &x->atoms[i], x->smiles);
+		for (i = 0; i < x->bond_count; i++)
+			coho_smiles_pack_bond(&x->packed_bonds[i],
+			    &x->bonds[i]);
+	}
+
+	if (x->flags & COHO_SMILES_COLUMNS) {
+		if (coho_smiles_columns_reserve(&x->columns,
+		    MAX(x->atoms_cap, x->bonds_cap)))
+			return -1;
+		coho_smiles_columns_set(&x->columns, 0, 0, x);
+	}
+	return 0;
+}
+
+/*
+ * Returns the column of lex_pairs used for c when it is
+ * the second character of a token, or -1 if there is none.
+ */
+static int pair_column(int c)
+{
+	if (c >= 'a' && c <= 'z')
+		return c - 'a';
+	else if (c == '@')
+		return PAIR_COLUMNS - 1;
+	return -1;
+}
+
+/*
+ * Parses from the current position to x->end, resuming in the state
+ * saved by the previous call.
+ * Unless final is set, more input may follow, and parsing pauses at
+ * x->end.
+ * quick_validate() accepts valid strings by a grammar of its own, so
+ * any change to what is accepted here must be mirrored there; the
+ * tests compare the two over mutated strings.
+ * Returns COHO_OK or, on error, sets x->error and returns COHO_ERROR.
+ */
+static int parse(struct coho_smiles *x, int final)
+{
+	struct coho_smiles_bond b = x->open_bond;
+	struct coho_smiles_bond next = x->next_bond; /* bond after an atom */
+	int anum = x->last_atom;	/* index of last atom read */
+	int state = x->state;
+	int eos;			/* end-of-string flag */
+	int rc;
+
+	for (;;) {
+		eos = x->position == x->end;
+
+		if (eos && !final) {
+			x->open_bond = b;
+			x->next_bond = next;
+			x->last_atom = anum;
+			x->state = state;
+			return COHO_OK;
+		}
+
+		switch (state) {
+
+		case INIT:
+			/* Parsing has just begun.  */
+			if (eos) {
+				strlcpy(x->error, "empty SMILES",
+				    sizeof(x->error));
+				goto err;
+			} else if ((rc = atom_ringbond(x, &anum, b.atom0,
+			    &next))) {
+				if (rc == -1)
+					goto err;
+			} else {
+				strlcpy(x->error, "atom expected",
+				    sizeof(x->error));
+				goto err;
+			}
+			state = ATOM_READ;
+			break;
+
+		case ATOM_READ:
+			/* An atom has just been read. */
+
+			/*
+			 * If there is an open bond to the previous
+			 * atom, complete it.
+			 */
+			if (b.atom0 != -1) {
+				b.atom1 = anum;
+				finalize_implicit_bond_order(x, &b);
+				if (add_bond(x, &b, next_neighbor_slot(x, b.atom0),
+				    0) == -1) {
+					/* Not past a bond after the atom. */
+					if (x->error_position == -1 &&
+					    next.length)
+						x->error_position =
+						    next.position;
+					goto err;
+				}
+			}
+
+			/*
+			 * A bond read after the atom's ring bonds leads to
+			 * the next atom.
+			 */
+			if (next.length) {
+				b = next;
+				next.length = 0;
+				state = BOND_READ;
+				break;
+			}
+
+			/*
+			 * The atom just read may be bonded to subsequent
+			 * atoms.  Store this state in an incomplete bond.
+			 */
+			coho_smiles_bond_init(&b);
+			b.atom0 = anum;
+			b.is_implicit = 1;
+			if (x->validating)
+				b.order = x->last_aromatic ?
+				    COHO_SMILES_BOND_AROMATIC :
+				    COHO_SMILES_BOND_SINGLE;
+
+			if (eos) {
+				goto done;
+			} else if ((rc = atom_ringbond(x, &anum, b.atom0,
+			    &next))) {
+				if (rc == -1)
+					goto err;
+			} else if (dot(x)) {
+				state = DOT_READ;
+			} else if ((rc = open_paren(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = OPEN_PAREN_READ;
+			} else if ((rc = close_paren(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = CLOSE_PAREN_READ;
+			} else {
+				goto unexpected;
+			}
+
+			break;
+
+		case DOT_READ:
+			/*
+			 * A dot (.) has just been read.  An atom is expected.
+			 * If there is a bond to a previous atom awaiting
+			 * completion, it must be cancelled.
+			 */
+
+			/* Invalidate open bond to previous atom. */
+			b.atom0 = -1;
+
+			if ((rc = atom_ringbond(x, &anum, b.atom0, &next))) {
+				if (rc == -1)
+					goto err;
+			} else {
+				strlcpy(x->error, "atom must follow dot",
+				    sizeof(x->error));
+				goto err;
+			}
+			state = ATOM_READ;
+			break;
+
+		case BOND_READ:
+			/*
+			 * A bond (-, =, #, etc) has just been read.
+			 * An atom is expected.
+			 */
+			if ((rc = atom_ringbond(x, &anum, b.atom0, &next))) {
+				if (rc == -1)
+					goto err;
+			} else {
+				strlcpy(x->error, "atom must follow bond",
+				    sizeof(x->error));
+				goto err;
+			}
+			state = ATOM_READ;
+			break;
+
+		case OPEN_PAREN_READ:
+			/*
+			 * An opening parenthesis has just been read
+			 * and the parenthesis stack pushed.
+			 */
+			if (eos) {
+				strlcpy(x->error, "unbalanced parenthesis",
+				    sizeof(x->error));
+				x->error_position = x->position - 1;
+				goto err;
+			} else if ((rc = atom_ringbond(x, &anum, b.atom0,
+			    &next))) {
+				if (rc == -1)
+					goto err;
+				state = ATOM_READ;
+			} else if ((rc = bond(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = BOND_READ;
+			} else if (dot(x)) {
+				state = DOT_READ;
+			} else {
+				strlcpy(x->error, "atom, bond, or dot expected",
+				    sizeof(x->error));
+				goto err;
+			}
+			break;
+
+		case CLOSE_PAREN_READ:
+			/*
+			 * A closing parenthesis has just been read
+			 * and the parenthesis stack popped.
+			 */
+			if (eos) {
+				goto done;
+			} else if ((rc = atom_ringbond(x, &anum, b.atom0,
+			    &next))) {
+				if (rc == -1)
+					goto err;
+				state = ATOM_READ;
+			} else if ((rc = bond(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = BOND_READ;
+			} else if (dot(x)) {
+				state = DOT_READ;
+			} else if ((rc = open_paren(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = OPEN_PAREN_READ;
+			} else if ((rc = close_paren(x, &b))) {
+				if (rc == -1)
+					goto err;
+				state = CLOSE_PAREN_READ;
+			} else {
+				goto unexpected;
+			}
+			break;
 		}
-		x->position += t.n;
-		n = n * 10 + t.intval;
-	}
-	if (i == 0)
-		return 0;
-	*dst = n;
-	return i;
-}
-
-/*
- * Parses isotope inside a bracket atom.
- * If successful, sets a->isotope and increments a->length.
- * Returns 1 if isotope was read, else 0.
- * On error, returns -1 and sets x->error.
- */
-static int isotope(struct coho_smiles *x, struct coho_smiles_atom *a)
-{
-	int n;
-
-	if ((n = integer(x, 5, &a->isotope)) == -1) {
-		strlcpy(x->error, "isotope too large", sizeof(x->error));
-		return -1;
 	}
-	a->length += n;
-	return 0;
-}
 
-/*
- * Reads next token and checks if its type is among those requested.
- * If so, consumes the token and returns 1.
- * If not, returns 0 and the parsing position remains unchanged.
- */
-static int match(struct coho_smiles *x, struct token *t, int inbracket,
-    unsigned int ttype)
-{
-	if (lex(x, t, inbracket) & ttype) {
-		x->position += t->n;
-		return 1;
-	}
-	return 0;
-}
+done:
+	assert(x->position == x->end);
+	return COHO_OK;
 
-/*
- * Returns a new array capacity that is larger than
- * its previous capacity.
- */
-static size_t next_array_cap(size_t previous_cap)
-{
-	size_t cap = 2 * previous_cap - 1;
-	while (cap & (cap - 1))
-		cap = cap & (cap - 1);
-	return cap;
+unexpected:
+	strlcpy(x->error, "unexpected character", sizeof(x->error));
+err:
+	if (x->error_position == -1)
+		x->error_position = x->position;
+	return COHO_ERROR;
 }
 
 /*
  * Matches an opening parenthesis that begins a branch.
  * On success, pushes the parenthesis stack and returns 1.
- * Returns 0 if there was no match.
+ * Returns 0 if there was no match, or -1 if the handler asked to stop
+ * or memory could not be allocated.
  */
 static int open_paren(struct coho_smiles *x, struct coho_smiles_bond *b)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, PAREN_OPEN))
 		return 0;
 
-	push_paren_stack(x, t.position, b);
+	if (push_paren_stack(x, t.position, b))
+		return -1;
+	if (EMIT(x, on_branch_open, b->atom0))
+		return stop(x);
 	return 1;
 }
 
@@ -1029,16 +2166,196 @@ static int pop_paren_stack(struct coho_smiles *x, int position,
  * is correctly bonded to the oxygen.
  * The position of the parenthesis triggering the push is stored
  * to support error messages.
+ * Returns 0 on success or -1 if memory could not be allocated, which
+ * can only happen while validating.
  */
-static void push_paren_stack(struct coho_smiles *x, int position,
+static int push_paren_stack(struct coho_smiles *x, int position,
     struct coho_smiles_bond *b)
 {
 	struct coho_smiles_paren *p;
+	void *q;
 
 	assert(b->atom0 != -1);
+	if ((size_t)x->paren_stack_count == x->paren_stack_cap) {
+		if ((q = grow_validation_array(x, x->paren_stack,
+		    &x->paren_stack_cap, sizeof(x->paren_stack[0]),
+		    IS_INLINE(x, paren_stack))) == NULL)
+			return nomem(x);
+		x->paren_stack = q;
+	}
 	p = &x->paren_stack[x->paren_stack_count++];
 	p->position = position;
 	p->bond = *b;
+	return 0;
+}
+
+/*
+ * Checks a SMILES string for coho_smiles_validate() in a single pass
+ * over its tokens, without the atoms and bonds parse() builds.
+ * Ring bonds are tracked by number, and the duplicate bonds of an atom
+ * are found among those to its parent and the ring bonds it closes.
+ * Only strings that are certainly valid are accepted; anything else,
+ * including errors and ring bond numbers of 100 or more, is left to
+ * parse() so that errors are reported exactly as it does.
+ * Returns 0 if the string is valid or -1 if it must be parsed.
+ */
+static int quick_validate(struct coho_smiles *x)
+{
+	const struct coho_smiles_token *t;
+	struct coho_smiles_atom a;
+	unsigned long open[4] = {0, 0, 0, 0};
+	int ring_atom[100], ring_order[100];
+	int stack[64], partner[8];
+	int state = INIT, anum = -1, prev = -1, depth = 0, nopen = 0;
+	int i, n, order, rnum;
+
+	while ((t = lex(x, 0)) != NULL) {
+		if (t->type & (ALIPHATIC_ORGANIC | AROMATIC_ORGANIC |
+		    WILDCARD)) {
+			x->position += t->n;
+		} else if (t->type & BRACKET_OPEN) {
+			if (bracket_atom(x, &a) != 1)
+				return -1;
+		} else if (t->type & BOND) {
+			if (state != OPEN_PAREN_READ &&
+			    state != CLOSE_PAREN_READ)
+				return -1;
+			x->position += t->n;
+			state = BOND_READ;
+			continue;
+		} else if (t->type & DOT) {
+			if (state != ATOM_READ && state != OPEN_PAREN_READ &&
+			    state != CLOSE_PAREN_READ)
+				return -1;
+			x->position += t->n;
+			prev = -1;
+			state = DOT_READ;
+			continue;
+		} else if (t->type & PAREN_OPEN) {
+			if ((state != ATOM_READ && state != CLOSE_PAREN_READ) ||
+			    depth == (int)(sizeof(stack) / sizeof(stack[0])))
+				return -1;
+			x->position += t->n;
+			stack[depth++] = prev;
+			state = OPEN_PAREN_READ;
+			continue;
+		} else if (t->type & PAREN_CLOSE) {
+			if ((state != ATOM_READ && state != CLOSE_PAREN_READ) ||
+			    depth == 0)
+				return -1;
+			x->position += t->n;
+			prev = stack[--depth];
+			state = CLOSE_PAREN_READ;
+			continue;
+		} else {
+			return -1;
+		}
+
+		/* An atom, bonded to prev, and then its ring bonds. */
+		anum++;
+		n = 0;
+		state = ATOM_READ;
+		while ((t = lex(x, 0)) != NULL) {
+			order = COHO_SMILES_BOND_UNSPECIFIED;
+			if (t->type & BOND) {
+				order = t->intval;
+				x->position += t->n;
+				if ((t = lex(x, 0)) == NULL ||
+				    !(t->type & (DIGIT | PERCENT))) {
+					state = BOND_READ;
+					break;
+				}
+			} else if (!(t->type & (DIGIT | PERCENT))) {
+				break;
+			}
+
+			x->position += t->n;
+			if (t->type & PERCENT) {
+				if ((t = lex(x, 0)) == NULL ||
+				    !(t->type & DIGIT))
+					return -1;
+				rnum = t->intval * 10;
+				x->position += t->n;
+				if ((t = lex(x, 0)) == NULL ||
+				    !(t->type & DIGIT))
+					return -1;
+				rnum += t->intval;
+				x->position += t->n;
+			} else {
+				rnum = t->intval;
+			}
+
+			if (!(open[rnum / 32] & RING_BIT(rnum))) {
+				open[rnum / 32] |= RING_BIT(rnum);
+				ring_atom[rnum] = anum;
+				ring_order[rnum] = order;
+				nopen++;
+				continue;
+			}
+			if (ring_atom[rnum] == anum ||
+			    ring_atom[rnum] == prev ||
+			    (order != COHO_SMILES_BOND_UNSPECIFIED &&
+			    ring_order[rnum] != COHO_SMILES_BOND_UNSPECIFIED &&
+			    order != ring_order[rnum]) ||
+			    n == (int)(sizeof(partner) / sizeof(partner[0])))
+				return -1;
+			for (i = 0; i < n; i++)
+				if (partner[i] == ring_atom[rnum])
+					return -1;
+			partner[n++] = ring_atom[rnum];
+			open[rnum / 32] &= ~RING_BIT(rnum);
+			nopen--;
+		}
+		prev = anum;
+	}
+
+	if ((state != ATOM_READ && state != CLOSE_PAREN_READ) ||
+	    depth > 0 || nopen > 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Parses the ring bond number following '%', either two digits or
+ * up to five digits in parentheses.
+ * Returns 0 on success.
+ * On error, sets x->error and returns -1.
+ */
+static int ring_number(struct coho_smiles *x, int *rnum)
+{
+	struct coho_smiles_token t;
+
+	if (match(x, &t, 0, PAREN_OPEN)) {
+		switch (integer(x, 5, rnum)) {
+		case -1:
+			strlcpy(x->error, "ring bond number too large",
+			    sizeof(x->error));
+			return -1;
+		case 0:
+			strlcpy(x->error, "ring bond expected",
+			    sizeof(x->error));
+			return -1;
+		}
+		if (!match(x, &t, 0, PAREN_CLOSE)) {
+			strlcpy(x->error, "')' expected", sizeof(x->error));
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!match(x, &t, 0, DIGIT)) {
+		strlcpy(x->error, "ring bond expected", sizeof(x->error));
+		return -1;
+	}
+	*rnum = t.intval * 10;
+
+	if (!match(x, &t, 0, DIGIT)) {
+		strlcpy(x->error, "2 digit ring bond expected",
+		    sizeof(x->error));
+		return -1;
+	}
+	*rnum += t.intval;
+	return 0;
 }
 
 /*
@@ -1049,49 +2366,34 @@ static void push_paren_stack(struct coho_smiles *x, int position,
  * If the parsed ring bond ID is in use, closes it and adds a new bond
  * to the bond list.
  * Otherwise, marks the ring ID as open.
+ * The bond is read into *b.  A bond not followed by a ring bond number
+ * is still consumed and left in *b for the caller; b->length is 0 if
+ * there was none.
  */
-static int ringbond(struct coho_smiles *x, int anum)
+static int ringbond(struct coho_smiles *x, int anum, struct coho_smiles_bond *b)
 {
-	struct token t;
-	struct coho_smiles_bond b;
-	int rc;
+	struct coho_smiles_token t;
 	int rnum;
-	int saved = x->position;
 
-	coho_smiles_bond_init(&b);
-	b.atom0 = anum;
+	coho_smiles_bond_init(b);
+	b->atom0 = anum;
 
-	if ((rc = bond(x, &b))) {
-		if (rc == -1)
-			return -1;
-	} else {
-		b.order = COHO_SMILES_BOND_UNSPECIFIED;
-		b.position = x->position;
+	if (!bond(x, b)) {
+		b->order = COHO_SMILES_BOND_UNSPECIFIED;
+		b->position = x->position;
 	}
 
-	if (!match(x, &t, 0, PERCENT | DIGIT)) {
-		x->position = saved;
+	if (!match(x, &t, 0, PERCENT | DIGIT))
 		return 0;
-	}
 
 	if (t.type == PERCENT) {
-		if (!match(x, &t, 0, DIGIT)) {
-			strlcpy(x->error, "ring bond expected", sizeof(x->error));
-			return -1;
-		}
-		rnum = t.intval * 10;
-
-		if (!match(x, &t, 0, DIGIT)) {
-			strlcpy(x->error, "2 digit ring bond expected",
-			    sizeof(x->error));
+		if (ring_number(x, &rnum))
 			return -1;
-		}
-		rnum += t.intval;
 	} else {
 		rnum = t.intval;
 	}
 
-	if (add_ringbond(x, rnum, &b))
+	if (add_ringbond(x, rnum, b))
 		return -1;
 	return 1;
 }
@@ -1106,19 +2408,17 @@ static int ringbond(struct coho_smiles *x, int anum)
  */
 static int round_valence(int atomic_number, int valence, int lowest_only)
 {
-	int i, j, anum;
+	const signed char *v;
+	int i;
 
-	for (i = 0; (anum = standard_valences[i][0]) != -1; i++) {
-		if (anum > atomic_number)
+	if (atomic_number < 0 || (size_t)atomic_number >= NELEMENTS)
+		return -1;
+	v = elements[atomic_number].valences;
+	for (i = 0; i < 3 && v[i]; i++) {
+		if (valence <= v[i])
+			return v[i];
+		if (lowest_only)
 			break;
-		else if (anum == atomic_number) {
-			for (j = 1; j < 4; j++) {
-				if (valence <= standard_valences[i][j])
-					return standard_valences[i][j];
-				if (lowest_only)
-					break;
-			}
-		}
 	}
 	return -1;
 }
@@ -1168,17 +2468,150 @@ static void coho_smiles_reinit(struct coho_smiles *x, const char *smiles,
 	size_t i;
 
 	x->smiles = smiles;
+	x->smiles_base = 0;
 	x->position = 0;
 	x->end = end;
+	x->token.position = -1;
 	x->error[0] = '\0';
 	x->error_position = -1;
 	x->atom_count = 0;
 	x->bond_count = 0;
+	x->bonds_unsorted = 0;
 	x->paren_stack_count = 0;
 
-	for (i = 0; i < 100; i++)
-		coho_smiles_bond_init(&x->ring_bonds[i]);
-	x->open_ring_closures = 0;
+	/* Only the ring bonds left open by a failed parse need clearing. */
+	if (x->open_ring_closures) {
+		for (i = 0; i < 4; i++)
+			x->ring_open[i] = 0;
+		x->big_ring_count = 0;
+		x->open_ring_closures = 0;
+	}
+}
+
+/*
+ * Sorts the bond list by atom0 and then atom1.
+ * Bonds are added in order of atom1 (see add_bond()), so a stable
+ * counting sort on atom0 completes the ordering.  The place of each
+ * bond is worked out first, and the bonds and their slots are then
+ * moved there in place, one cycle of the permutation at a time.
+ */
+static void sort_bonds(struct coho_smiles *x)
+{
+	struct coho_smiles_bond b;
+	int i, j, slot, *count, *dest;
+
+	if (!x->bonds_unsorted)
+		return;
+
+	/* The neighbor lists are unused until build_adjacency(). */
+	count = x->neighbor_bonds;
+	dest = x->neighbor_atoms;
+	memset(count, 0, (x->atom_count + 1) * sizeof(count[0]));
+
+	for (i = 0; i < x->bond_count; i++)
+		count[x->bonds[i].atom0 + 1]++;
+	for (i = 0; i < x->atom_count; i++)
+		count[i + 1] += count[i];
+	for (i = 0; i < x->bond_count; i++)
+		dest[i] = count[x->bonds[i].atom0]++;
+
+	for (i = 0; i < x->bond_count; i++) {
+		while ((j = dest[i]) != i) {
+			b = x->bonds[j];
+			x->bonds[j] = x->bonds[i];
+			x->bonds[i] = b;
+			slot = x->bond_slots[2 * j];
+			x->bond_slots[2 * j] = x->bond_slots[2 * i];
+			x->bond_slots[2 * i] = slot;
+			slot = x->bond_slots[2 * j + 1];
+			x->bond_slots[2 * j + 1] = x->bond_slots[2 * i + 1];
+			x->bond_slots[2 * i + 1] = slot;
+			dest[i] = dest[j];
+			dest[j] = j;
+		}
+	}
+}
+
+/*
+ * Prepares to parse the given number of bytes of smiles from the start.
+ */
+static void start(struct coho_smiles *x, const char *smiles, size_t end)
+{
+	coho_smiles_reinit(x, smiles, end);
+
+	if (x->trim_after && coho_smiles_memory(x) > x->trim_above) {
+		if (++x->trim_count >= x->trim_after)
+			coho_smiles_shrink(x);
+	} else {
+		x->trim_count = 0;
+	}
+
+	coho_smiles_bond_init(&x->open_bond);
+	coho_smiles_bond_init(&x->next_bond);
+	x->last_atom = -1;
+	x->state = INIT;
+	x->validating = 0;
+	x->handler = NULL;
+	x->stopped = 0;
+}
+
+/*
+ * Records that the handler asked to stop the parse.
+ * Sets x->error and returns -1.
+ */
+static int stop(struct coho_smiles *x)
+{
+	strlcpy(x->error, "stopped by handler", sizeof(x->error));
+	x->stopped = COHO_STOPPED;
+	return -1;
+}
+
+/*
+ * Returns the offset of the last atom of the bytes fed so far that
+ * follows the current position, or the current position if there is
+ * none.
+ * Tokens that end an atom (ring bonds, or the second letter of Cl)
+ * might be yet to arrive, but everything before the atom is complete.
+ */
+static size_t stream_cut(struct coho_smiles *x)
+{
+	const struct lexeme *l;
+	const char *s = x->smiles;
+	size_t i, pos = x->position, base = x->smiles_base;
+	int c, k, inbracket = 0;
+
+	/* An unclosed bracket atom is the last atom. */
+	for (i = x->stream_len; i > pos; i--) {
+		if (s[i - 1 - base] == '[')
+			return i - 1;
+		if (s[i - 1 - base] == ']')
+			break;
+	}
+
+	for (i = x->stream_len; i > pos; i--) {
+		c = (unsigned char)s[i - 1 - base];
+		if (c == ']')
+			inbracket = 1;
+		else if (c == '[')
+			return i - 1;
+		if (inbracket)
+			continue;
+
+		l = &lexemes[0][c];
+		if (!(l->type & (ALIPHATIC_ORGANIC | AROMATIC_ORGANIC |
+		    WILDCARD)))
+			continue;
+
+		/* The letter might instead end a symbol like Cl. */
+		if (i - 1 > pos) {
+			l = &lexemes[0][(unsigned char)s[i - 2 - base]];
+			k = pair_column(c);
+			if (l->pair && k >= 0 && lex_pairs[l->pair].intval[k])
+				continue;
+		}
+		return i - 1;
+	}
+	return pos;
 }
 
 /*
@@ -1188,14 +2621,15 @@ static void coho_smiles_reinit(struct coho_smiles *x, const char *smiles,
  */
 static int symbol(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 1, ELEMENT | AROMATIC | WILDCARD))
 		return 0;
 	a->atomic_number = t.intval;
 	a->is_aromatic = t.type & AROMATIC ? 1 : 0;
 	a->length += t.n;
-	tokcpy(a->symbol, &t, sizeof(a->symbol));
+	if (!(x->flags & COHO_SMILES_NO_SYMBOLS))
+		tokcpy(a->symbol, &t, sizeof(a->symbol));
 	return 1;
 }
 
@@ -1203,7 +2637,8 @@ static int symbol(struct coho_smiles *x, struct coho_smiles_atom *a)
  * Copies up to dstsz - 1 bytes from the token to dst, NUL-terminating
  * dst if dstsz is not 0.
  */
-static void tokcpy(char *dst, struct token *t, size_t dstsz)
+static void tokcpy(char *dst, const struct coho_smiles_token *t,
+    size_t dstsz)
 {
 	size_t i;
 
@@ -1224,7 +2659,7 @@ static void tokcpy(char *dst, struct token *t, size_t dstsz)
  */
 static int wildcard(struct coho_smiles *x, struct coho_smiles_atom *a)
 {
-	struct token t;
+	struct coho_smiles_token t;
 
 	if (!match(x, &t, 0, WILDCARD))
 		return 0;
@@ -1232,858 +2667,54 @@ static int wildcard(struct coho_smiles *x, struct coho_smiles_atom *a)
 	a->position = t.position;
 	a->atomic_number = 0;
 	a->length = t.n;
-	tokcpy(a->symbol, &t, sizeof(a->symbol));
+	if (!(x->flags & COHO_SMILES_NO_SYMBOLS))
+		tokcpy(a->symbol, &t, sizeof(a->symbol));
 	return 1;
 }
 
 /*
- * Reads next token from SMILES string.
+ * Returns the token at the current position, or NULL at the end of the
+ * SMILES string.
  * The inbracket parameter should be set to true when parsing is
  * inside a bracket atom.
- * Returns the token type or zero if no token could be read.
+ * The token is kept in x->token until the position moves, so trying
+ * several token types in turn reads its bytes only once.
  * The token type is a bitmask since a particular token can belong
  * to multiple categories.  For example, the symbol for
  * hydrogen will have type ELEMENT | HYDROGEN.
  */
-static unsigned int lex(struct coho_smiles *x, struct token *t, int inbracket)
+static const struct coho_smiles_token *lex(struct coho_smiles *x,
+    int inbracket)
 {
-	int c0, c1;
+	struct coho_smiles_token *t = &x->token;
+	const struct lexeme *e;
+	const struct lexpair *p;
 	const char *s;
+	int col;
 
+	if (t->position == x->position && x->token_inbracket == inbracket)
+		return t;
 	if (x->position == x->end)
-		return 0;
-
-	s = x->smiles + x->position;
-	c0 = s[0];
-	c1 = 0;
-
-	if (x->position < x->end)
-		c1 = s[1];
+		return NULL;
 
+	s = x->smiles + (x->position - x->smiles_base);
+	e = &lexemes[inbracket][(unsigned char)s[0]];
 	t->s = s;
 	t->position = x->position;
-	t->n = 1;
-	t->type = 0;
-	t->intval = -1;
-	t->flags = 0;
-
-	switch (c0) {
-	case 'a':
-		if (inbracket && c1 == 's') {
-			t->n = 2;
-			t->type = AROMATIC;
-			t->intval = 33;
-			goto out;
-		}
-		return 0;
-	case 'b':
-		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
-		t->intval = 5;
-		goto out;
-	case 'c':
-		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
-		t->intval = 6;
-		goto out;
-	case 'n':
-		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
-		t->intval = 7;
-		goto out;
-	case 'o':
-		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
-		t->intval = 8;
-		goto out;
-	case 'p':
-		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
-		t->intval = 15;
-		goto out;
-	case 's':
-		if (!inbracket) {
-			t->type = AROMATIC_ORGANIC;
-			t->intval = 16;
-			goto out;
-		}
-		switch (c1) {
-		case 'e':
-			t->type = AROMATIC;
-			t->n = 2;
-			t->intval = 34;
-			goto out;
-		default:
-			t->type = AROMATIC;
-			t->intval = 16;
-			goto out;
-		}
-	case 'A':
-		switch (c1) {
-		case 'c':
-			t->type = ELEMENT;
-			t->intval = 89;
-			t->n = 2;
-			goto out;
-		case 'g':
-			t->type = ELEMENT;
-			t->intval = 47;
-			t->n = 2;
-			goto out;
-		case 'l':
-			t->type = ELEMENT;
-			t->intval = 13;
-			t->n = 2;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->intval = 95;
-			t->n = 2;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->intval = 18;
-			t->n = 2;
-			goto out;
-		case 's':
-			t->type = ELEMENT;
-			t->intval = 33;
-			t->n = 2;
-			goto out;
-		case 't':
-			t->type = ELEMENT;
-			t->intval = 85;
-			t->n = 2;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->intval = 79;
-			t->n = 2;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'B':
-		if (!inbracket) {
-			if (c1 == 'r') {
-				t->intval = 35;
-				t->n = 2;
-			} else {
-				t->intval = 5;
-			}
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->intval = 56;
-			t->n = 2;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->intval = 4;
-			t->n = 2;
-			goto out;
-		case 'h':
-			t->type = ELEMENT;
-			t->intval = 107;
-			t->n = 2;
-			goto out;
-		case 'i':
-			t->type = ELEMENT;
-			t->intval = 83;
-			t->n = 2;
-			goto out;
-		case 'k':
-			t->type = ELEMENT;
-			t->intval = 97;
-			t->n = 2;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->intval = 35;
-			t->n = 2;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 5;
-			goto out;
-		}
-	case 'C':
-		if (!inbracket) {
-			if (c1 == 'l') {
-				t->intval = 17;
-				t->n = 2;
-			} else {
-				t->intval = 6;
-			}
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 20;
-			goto out;
-		case 'd':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 20;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 58;
-			goto out;
-		case 'f':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 98;
-			goto out;
-		case 'l':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 17;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 96;
-			goto out;
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 112;
-			goto out;
-		case 'o':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 27;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 24;
-			goto out;
-		case 's':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 55;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 29;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 6;
-			goto out;
-		}
-	case 'D':
-		switch (c1) {
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 105;
-			goto out;
-		case 's':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 110;
-			goto out;
-		case 'y':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 66;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'E':
-		switch (c1) {
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 68;
-			goto out;
-		case 's':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 99;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 63;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'F':
-		if (!inbracket) {
-			t->intval = 9;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 26;
-			goto out;
-		case 'l':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 114;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 100;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 87;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 9;
-			goto out;
-		}
-	case 'G':
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 31;
-			goto out;
-		case 'd':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 64;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 32;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'H':
-		switch (c1) {
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 2;
-			goto out;
-		case 'f':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 72;
-			goto out;
-		case 'g':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 80;
-			goto out;
-		case 'o':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 67;
-			goto out;
-		case 's':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 108;
-			goto out;
-		default:
-			t->type = ELEMENT | HYDROGEN;
-			t->intval = 1;
-			goto out;
-		}
-	case 'I':
-		if (!inbracket) {
-			t->intval = 53;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 49;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 77;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 53;
-			goto out;
-		}
-	case 'K':
-		switch (c1) {
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 36;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 19;
-			goto out;
-		}
-	case 'L':
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 57;
-			goto out;
-		case 'i':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 3;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 103;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 71;
-			goto out;
-		case 'v':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 116;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'M':
-		switch (c1) {
-		case 'd':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 101;
-			goto out;
-		case 'g':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 12;
-			goto out;
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 25;
-			goto out;
-		case 'o':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 42;
-			goto out;
-		case 't':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 109;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'N':
-		if (!inbracket) {
-			t->intval = 7;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 11;
-			goto out;
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 41;
-			goto out;
-		case 'd':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 101;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 10;
-			goto out;
-		case 'i':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 28;
-			goto out;
-		case 'o':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 102;
-			goto out;
-		case 'p':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 93;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 7;
-			goto out;
-		}
-	case 'O':
-		if (!inbracket) {
-			t->intval = 8;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 's':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 76;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 8;
-			goto out;
-		}
-	case 'P':
-		if (!inbracket) {
-			t->intval = 15;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 91;
-			goto out;
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 82;
-			goto out;
-		case 'd':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 46;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 61;
-			goto out;
-		case 'o':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 84;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 59;
-			goto out;
-		case 't':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 78;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 94;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 15;
-			goto out;
-		}
-	case 'R':
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 88;
-			goto out;
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 37;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 75;
-			goto out;
-		case 'f':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 104;
-			goto out;
-		case 'g':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 111;
-			goto out;
-		case 'h':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 45;
-			goto out;
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 86;
-			goto out;
-		case 'u':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 44;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'S':
-		if (!inbracket) {
-			t->intval = 16;
-			t->type = ALIPHATIC_ORGANIC;
-			goto out;
-		}
-		switch (c1) {
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 51;
-			goto out;
-		case 'c':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 21;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 34;
-			goto out;
-		case 'g':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 106;
-			goto out;
-		case 'i':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 14;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 62;
-			goto out;
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 50;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 38;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 16;
-			goto out;
-		}
-	case 'T':
-		switch (c1) {
-		case 'a':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 73;
-			goto out;
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 65;
-			goto out;
-		case 'c':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 43;
-			goto out;
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 52;
-			goto out;
-		case 'h':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 90;
-			goto out;
-		case 'i':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 22;
-			goto out;
-		case 'l':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 81;
-			goto out;
-		case 'm':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 69;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'U':
-		t->type = ELEMENT;
-		t->intval = 92;
-		goto out;
-	case 'V':
-		t->type = ELEMENT;
-		t->intval = 23;
-		goto out;
-	case 'W':
-		t->type = ELEMENT;
-		t->intval = 74;
-		goto out;
-	case 'X':
-		switch (c1) {
-		case 'e':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 54;
-			goto out;
-		default:
-			return 0;
-		}
-	case 'Y':
-		switch (c1) {
-		case 'b':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 70;
-			goto out;
-		default:
-			t->type = ELEMENT;
-			t->intval = 39;
-			goto out;
-		}
-	case 'Z':
-		switch (c1) {
-		case 'n':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 30;
-			goto out;
-		case 'r':
-			t->type = ELEMENT;
-			t->n = 2;
-			t->intval = 40;
-			goto out;
-		default:
-			return 0;
-		}
-	case '0':
-	case '1':
-	case '2':
-	case '3':
-	case '4':
-	case '5':
-	case '6':
-	case '7':
-	case '8':
-	case '9':
-		t->type = DIGIT;
-		t->intval = c0 - '0';
-		goto out;
-	case '*':
-		t->type = WILDCARD;
-		t->intval = 0;
-		goto out;
-	case '[':
-		t->type = BRACKET_OPEN;
-		goto out;
-	case ']':
-		t->type = BRACKET_CLOSE;
-		goto out;
-	case '(':
-		t->type = PAREN_OPEN;
-		goto out;
-	case ')':
-		t->type = PAREN_CLOSE;
-		goto out;
-	case '+':
-		t->type = PLUS;
-		t->intval = 1;
-		goto out;
-	case '-':
-		t->type   = inbracket ? MINUS : BOND;
-		t->intval = inbracket ? -1 : COHO_SMILES_BOND_SINGLE;
-		goto out;
-	case '%':
-		t->type = PERCENT;
-		goto out;
-	case '=':
-		t->type = BOND;
-		t->intval = COHO_SMILES_BOND_DOUBLE;
-		goto out;
-	case '#':
-		t->type = BOND;
-		t->intval = COHO_SMILES_BOND_TRIPLE;
-		goto out;
-	case '$':
-		t->type = BOND;
-		t->intval = COHO_SMILES_BOND_QUAD;
-		goto out;
-	case ':':
-		if (inbracket) {
-			t->type = COLON;
-		} else {
-			t->type = BOND;
-			t->intval = COHO_SMILES_BOND_AROMATIC;
-		}
-		goto out;
-	case '/':
-		t->type = BOND;
-		t->intval = COHO_SMILES_BOND_SINGLE;
-		t->flags = COHO_SMILES_BOND_STEREO_UP;
-		goto out;
-	case '\\':
-		t->type = BOND;
-		t->intval = COHO_SMILES_BOND_SINGLE;
-		t->flags = COHO_SMILES_BOND_STEREO_DOWN;
-		goto out;
-	case '.':
-		t->type = DOT;
-		goto out;
-	case '@':
-		t->type = CHIRALITY;
-		if (c1 == '@')
-			t->n = 2;
-		goto out;
-	default:
-		return 0;
+	x->token_inbracket = inbracket;
+
+	if (e->pair && x->position + 1 < x->end &&
+	    (col = pair_column(s[1])) != -1 &&
+	    (p = &lex_pairs[e->pair])->intval[col]) {
+		t->type = p->type;
+		t->intval = p->intval[col];
+		t->n = 2;
+		t->flags = 0;
+	} else {
+		t->type = e->type;
+		t->intval = e->intval;
+		t->n = e->n;
+		t->flags = e->flags;
 	}
-
-out:
-	return t->type;
+	return t;
 }
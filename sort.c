@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "internal.h"
+
+/*
+ * Sorts n elements of the given size like qsort(), but by insertion if
+ * there are few, as there usually are.  Elements may be at most 32
+ * bytes.
+ */
+void coho_sort(void *base, size_t n, size_t size,
+    int (*compar)(const void *, const void *))
+{
+	unsigned char t[32], *b = base;
+	size_t i, j;
+
+	assert(size <= sizeof(t));
+
+	if (n > 16) {
+		qsort(base, n, size, compar);
+		return;
+	}
+	for (i = 1; i < n; i++) {
+		for (j = i; j > 0 && compar(b + (j - 1) * size,
+		    b + i * size) > 0; j--)
+			;
+		if (j == i)
+			continue;
+		memcpy(t, b + i * size, size);
+		memmove(b + (j + 1) * size, b + j * size, (i - j) * size);
+		memcpy(b + j * size, t, size);
+	}
+}
@@ -0,0 +1,227 @@
+/*
+ * Checks allocation through user callbacks and the bump arena.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "counter.h"
+
+static char long_smiles[201];
+
+static int count_atom(void *ud, const struct coho_smiles_atom *a, int i)
+{
+	(void)a;
+	*(int *)ud = i + 1;
+	return 0;
+}
+
+static void test_callbacks(void)
+{
+	struct coho_allocator a;
+	struct coho_smiles x;
+	struct counter c;
+	size_t allocs;
+
+	counter_init(&c, &a, (size_t)-1);
+
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_memory(&x) == 0);
+
+	/*
+	 * Short strings are parsed using the context's inline storage,
+	 * so only the neighbor lists are allocated, and only once.
+	 */
+	assert(coho_smiles_read(&x, "CC(=O)Nc1ccc(O)cc1", 0) == COHO_OK);
+	assert(x.atoms == x.storage.atoms);
+	assert(c.allocs > 0);
+	allocs = c.allocs;
+	assert(coho_smiles_read(&x, "c1ccccc1CCN", 0) == COHO_OK);
+	assert(c.allocs == allocs);
+	assert(coho_smiles_memory(&x) == c.bytes);
+
+	x.flags |= COHO_SMILES_PACKED | COHO_SMILES_COLUMNS;
+	assert(coho_smiles_read(&x, "c1ccccc1C(=O)O", 0) == COHO_OK);
+	assert(c.allocs > 0);
+	assert(coho_smiles_memory(&x) == c.bytes);
+
+	assert(coho_smiles_read(&x, long_smiles, 0) == COHO_OK);
+	assert(x.atom_count == 200);
+	assert(x.atoms != x.storage.atoms);
+	assert(coho_smiles_memory(&x) == c.bytes);
+	assert(coho_smiles_read(&x, "CC", 0) == COHO_OK);
+	assert(coho_smiles_memory(&x) == c.bytes);
+
+	coho_smiles_free(&x);
+	assert(c.bytes == 0);
+	assert(c.frees == c.allocs);
+
+	/* Allocation failure part way through leaves nothing held. */
+	c.limit = 1000;
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_read(&x, long_smiles, 0) == COHO_NOMEM);
+	assert(coho_smiles_memory(&x) == 0);
+	assert(c.bytes == 0);
+	coho_smiles_free(&x);
+}
+
+static void test_exact(void)
+{
+	struct coho_smiles x;
+	char smi[200];
+	int i;
+
+	/* 170 bytes, but only 10 atoms: fits the inline storage. */
+	smi[0] = '\0';
+	for (i = 0; i < 10; i++)
+		strcat(smi, i ? ".[12CH4:1234567]" : "[12CH4:12345678]");
+	assert(strlen(smi) == 160);
+
+	coho_smiles_init(&x);
+	assert(coho_smiles_read(&x, smi, 0) == COHO_OK);
+	assert(x.atoms != x.storage.atoms);
+	coho_smiles_shrink(&x);
+	assert(coho_smiles_memory(&x) == 0);
+
+	x.flags |= COHO_SMILES_EXACT;
+	assert(coho_smiles_read(&x, smi, 0) == COHO_OK);
+	assert(x.atom_count == 10);
+	assert(x.atoms == x.storage.atoms);
+
+	assert(coho_smiles_read(&x, "C1CC2CC3CC4CC5CC%10CC5CC4CC3CC2CC1%10",
+	    0) == COHO_OK);
+	assert(x.bond_count == 26);
+
+	/* Arrays are sized from the counts, not the length. */
+	assert(coho_smiles_read(&x, long_smiles, 0) == COHO_OK);
+	assert(x.atoms_cap == 200);
+	assert(x.bonds_cap == 199);
+	assert(x.paren_stack_cap == 1);
+
+	/* Trimmed on the second parse while holding more than 10000 bytes. */
+	coho_smiles_set_trim(&x, 2, 10000);
+	assert(coho_smiles_read(&x, "CC", 0) == COHO_OK);
+	assert(coho_smiles_memory(&x) > 10000);
+	assert(coho_smiles_read(&x, "CC", 0) == COHO_OK);
+	assert(coho_smiles_memory(&x) < 10000);
+	assert(x.atoms == x.storage.atoms);
+	assert(x.atom_count == 2);
+
+	coho_smiles_free(&x);
+}
+
+static void test_validate(void)
+{
+	struct coho_allocator a;
+	struct coho_smiles x;
+	struct counter c;
+	struct coho_smiles_handler h;
+	char *smi;
+	size_t i, n = 100000;
+	int atoms = 0;
+
+	counter_init(&c, &a, (size_t)-1);
+
+	smi = malloc(n + 1);
+	for (i = 0; i < n; i += 8)
+		memcpy(smi + i, "C1CCCCC1", 8);
+	smi[n] = '\0';
+
+	/* Nothing is allocated, however long the string. */
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_validate(&x, smi, n) == COHO_OK);
+	assert(c.allocs == 0);
+
+	/* Nor to pass the atoms and bonds to a handler. */
+	memset(&h, 0, sizeof(h));
+	h.on_atom = count_atom;
+	h.ud = &atoms;
+	assert(coho_smiles_read_events(&x, smi, n, &h) == COHO_OK);
+	assert(atoms == (int)(n / 8 * 6));
+	assert(x.atoms == NULL && x.neighbor_offsets == NULL);
+	assert(x.bonds == x.storage.bonds);
+	assert(c.allocs == 0);
+
+	/* Nor to find an error. */
+	smi[n - 1] = '(';
+	assert(coho_smiles_validate(&x, smi, n) == COHO_ERROR);
+	assert(x.error_position == (int)n - 1);
+	assert(c.allocs == 0);
+
+	/* Deep branches grow only the parenthesis stack. */
+	for (i = 0; i < 200; i++)
+		memcpy(smi + 2 * i, "C(", 2);
+	smi[400] = 'C';
+	memset(smi + 401, ')', 200);
+	assert(coho_smiles_validate(&x, smi, 601) == COHO_OK);
+	assert(c.allocs == 1);
+	assert(x.paren_stack_cap == 2 * COHO_SMILES_INLINE);
+	assert(x.atoms == NULL);
+	coho_smiles_free(&x);
+	assert(c.bytes == 0);
+
+	c.limit = 1000;
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_validate(&x, smi, 601) == COHO_NOMEM);
+	coho_smiles_free(&x);
+	assert(c.bytes == 0);
+	free(smi);
+}
+
+static void test_arena(void)
+{
+	struct coho_allocator a;
+	struct coho_arena arena;
+	struct coho_smiles x;
+	unsigned char *p, *q;
+	const struct coho_smiles_atom *atoms;
+
+	coho_arena_init(&arena, 4096);
+	coho_arena_allocator(&a, &arena);
+
+	/* The most recent allocation grows and shrinks in place. */
+	p = coho_mem_alloc(&a, 10, 1);
+	memset(p, 'x', 10);
+	assert(coho_mem_realloc(&a, p, 10, 100, 1) == p);
+	q = coho_mem_alloc(&a, 10, 1);
+	assert(((size_t)q & 15) == 0);
+	assert(q >= p + 100);
+	p = coho_mem_realloc(&a, p, 100, 200, 1);
+	assert(p > q && p[0] == 'x' && p[9] == 'x');
+
+	/* Allocations larger than a chunk get their own. */
+	p = coho_mem_alloc(&a, 10000, 1);
+	assert(p != NULL);
+	memset(p, 0, 10000);
+
+	coho_arena_reset(&arena);
+	assert(coho_mem_alloc(&a, 10, 1) == q - 112);
+
+	coho_arena_reset(&arena);
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_read(&x, long_smiles, 0) == COHO_OK);
+	assert(x.atom_count == 200);
+	atoms = x.atoms;
+	assert(coho_smiles_memory(&x) > 0);
+
+	/* After a reset the same memory is handed out again. */
+	coho_arena_reset(&arena);
+	coho_smiles_init_with_allocator(&x, &a);
+	assert(coho_smiles_read(&x, long_smiles, 0) == COHO_OK);
+	assert(x.atoms == atoms);
+
+	coho_arena_free(&arena);
+}
+
+int main(void)
+{
+	memset(long_smiles, 'C', 200);
+	test_callbacks();
+	test_exact();
+	test_validate();
+	test_arena();
+	return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Checks batch parsing against parsing one string at a time.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "coho.h"
+
+static const char buf[] = "CC\nc1ccccc1\r\nC(\n\n[NH4+]\0O=O";
+
+/*
+ * Checks molecule i of the batch against a separate parse of smi.
+ */
+static void check(struct coho_smiles_batch *b, size_t i, const char *smi)
+{
+	struct coho_smiles x;
+	size_t ao, bo;
+	int k;
+
+	coho_smiles_init(&x);
+	assert(b->status[i] == coho_smiles_read(&x, smi, strlen(smi)));
+
+	ao = b->atom_offsets[i];
+	bo = b->bond_offsets[i];
+	if (b->status[i] != COHO_OK) {
+		assert(b->error_positions[i] == x.error_position);
+		assert(b->atom_offsets[i + 1] == ao);
+		assert(b->bond_offsets[i + 1] == bo);
+		coho_smiles_free(&x);
+		return;
+	}
+
+	assert(b->error_positions[i] == -1);
+	assert(b->atom_offsets[i + 1] - ao == (size_t)x.atom_count);
+	assert(b->bond_offsets[i + 1] - bo == (size_t)x.bond_count);
+	for (k = 0; k < x.atom_count; k++) {
+		assert(b->columns.atomic_number[ao + k] ==
+		    x.atoms[k].atomic_number);
+		assert(b->columns.charge[ao + k] == x.atoms[k].charge);
+	}
+	for (k = 0; k < x.bond_count; k++) {
+		assert(b->columns.atom0[bo + k] == x.bonds[k].atom0);
+		assert(b->columns.atom1[bo + k] == x.bonds[k].atom1);
+		assert(b->columns.order[bo + k] == x.bonds[k].order);
+	}
+	coho_smiles_free(&x);
+}
+
+int main(void)
+{
+	struct coho_smiles_batch b;
+	const char *smiles[1000];
+	char strs[1000][16], big[4001];
+	size_t i;
+
+	coho_smiles_batch_init(&b);
+
+	assert(coho_smiles_read_batch(&b, buf, sizeof(buf) - 1) == COHO_OK);
+	assert(b.count == 6);
+	check(&b, 0, "CC");
+	check(&b, 1, "c1ccccc1");
+	check(&b, 2, "C(");
+	assert(b.status[3] == COHO_ERROR);
+	check(&b, 4, "[NH4+]");
+	check(&b, 5, "O=O");
+	assert(b.atom_offsets[6] == 11);
+
+	/* A trailing separator does not start another molecule. */
+	assert(coho_smiles_read_batch(&b, "CC\n", 3) == COHO_OK);
+	assert(b.count == 1);
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(strs[i], sizeof(strs[i]), "C%zuCC%zuO%s", i % 10,
+		    i % 10, i % 7 ? "" : "(");
+		smiles[i] = strs[i];
+	}
+	assert(coho_smiles_read_batch_array(&b, smiles, NULL, 1000) ==
+	    COHO_OK);
+	assert(b.count == 1000);
+	for (i = 0; i < 1000; i++)
+		check(&b, i, smiles[i]);
+
+	/* Threaded results match, with and without lengths. */
+	assert(coho_smiles_read_batch_threads(&b, smiles, NULL, 1000, 4) ==
+	    COHO_OK);
+	assert(b.count == 1000);
+	for (i = 0; i < 1000; i++)
+		check(&b, i, smiles[i]);
+
+	/* A few large molecules, each forming a chunk of its own. */
+	memset(big, 'C', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	for (i = 0; i < 1000; i += 250)
+		smiles[i] = big;
+	assert(coho_smiles_read_batch_threads(&b, smiles, NULL, 1000, 3) ==
+	    COHO_OK);
+	assert(b.count == 1000);
+	for (i = 0; i < 1000; i++)
+		check(&b, i, smiles[i]);
+
+	/* More threads than molecules. */
+	assert(coho_smiles_read_batch_threads(&b, smiles, NULL, 3, 8) ==
+	    COHO_OK);
+	assert(b.count == 3);
+	for (i = 0; i < 3; i++)
+		check(&b, i, smiles[i]);
+
+	coho_smiles_batch_free(&b);
+	return 0;
+}
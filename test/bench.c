@@ -0,0 +1,168 @@
+/*
+ * Measures the cost per byte of parsing typical and ring-heavy SMILES.
+ * Reports instructions per byte where the kernel provides a counter,
+ * and nanoseconds per byte.  Also measures the cost per molecule of
+ * reading SMILES and writing it back out.
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "coho.h"
+
+#define ROUNDS	20000
+
+static const char *typical[] = {
+	"CC(=O)Oc1ccccc1C(=O)O",
+	"CN1C=NC2=C1C(=O)N(C(=O)N2C)C",
+	"CC(C)Cc1ccc(cc1)[C@@H](C)C(=O)O",
+	"CC(=O)Nc1ccc(O)cc1",
+	"O=C(O)C[C@@H](N)C(=O)N[C@@H](Cc1ccccc1)C(=O)OC",
+	"CN(C)CCCN1c2ccccc2CCc3ccccc13",
+	"Clc1ccc2N=C(c3ccccc3)CC(=O)N(C)c2c1",
+	"COc1ccc2[nH]cc(CCNC(C)=O)c2c1",
+	"CC1(C)S[C@@H]2[C@H](NC(=O)Cc3ccccc3)C(=O)N2[C@H]1C(=O)O",
+	"OC[C@H]1O[C@@H](O)[C@H](O)[C@@H](O)[C@@H]1O",
+	"C[N+](C)(C)CCOC(=O)C",
+	"FC(F)(F)c1ccc(OC(CCNC)c2ccccc2)cc1",
+	"NS(=O)(=O)c1cc(C(=O)O)c(NCc2ccco2)cc1Cl",
+	"CCN(CC)C(=O)[C@H]1CN(C)[C@@H]2Cc3c[nH]c4cccc(C2=C1)c34",
+	"O=C1N(C)C(=O)C(CC)(c2ccccc2)C1",
+	"[Na+].[O-]C(=O)c1ccccc1",
+};
+
+static const char *ring_heavy[] = {
+	"c1ccc2cc3ccccc3cc2c1",
+	"c1cc2ccc3cccc4ccc(c1)c2c34",
+	"C1CC2CC3CC1CC(C2)C3",
+	"C12C3C4C1C5C2C3C45",
+	"c1cc2ccc3ccc4ccc5ccc6ccc1c7c2c3c4c5c67",
+	"C1CCC2(CC1)CCC1(CC2)CCC2(CC1)CCCCC2",
+	"C%10CC%11CC%12CC%13CC%14CC%10C%11C%12C%13C%14",
+	"O=C1c2ccccc2C(=O)c2c1ccc1c2ccc2c1ccc1ccccc21",
+};
+
+/*
+ * Opens a counter of the instructions this thread executes in user
+ * space, or returns -1 if there is none.
+ */
+static int open_counter(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static uint64_t read_counter(int fd)
+{
+	uint64_t n = 0;
+
+#ifdef __linux__
+	if (fd == -1 || read(fd, &n, sizeof(n)) != sizeof(n))
+		return 0;
+#endif
+	return n;
+}
+
+/*
+ * Parses each of the count strings ROUNDS times.
+ */
+static void run(const char *name, const char **s, size_t count, int fd)
+{
+	struct coho_smiles x;
+	struct timespec t0, t1;
+	uint64_t i0, i1;
+	size_t i, k, bytes = 0;
+	double ns;
+
+	coho_smiles_init(&x);
+	for (k = 0; k < count; k++) {
+		assert(coho_smiles_read(&x, s[k], strlen(s[k])) == COHO_OK);
+		bytes += strlen(s[k]);
+	}
+	bytes *= ROUNDS;
+
+	i0 = read_counter(fd);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < ROUNDS; i++) {
+		for (k = 0; k < count; k++)
+			coho_smiles_read(&x, s[k], strlen(s[k]));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	i1 = read_counter(fd);
+	coho_smiles_free(&x);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	printf("%-12s", name);
+	if (fd != -1)
+		printf(" %8.1f instructions/byte", (double)(i1 - i0) / bytes);
+	printf(" %8.2f ns/byte\n", ns / bytes);
+}
+
+/*
+ * Reads and writes each of the count strings ROUNDS times.
+ */
+static void run_write(const char *name, const char **s, size_t count)
+{
+	struct coho_smiles x;
+	struct coho_smiles_writer w;
+	struct timespec t0, t1;
+	size_t i, k;
+	double ns;
+
+	coho_smiles_init(&x);
+	coho_smiles_writer_init(&w);
+	for (k = 0; k < count; k++) {
+		assert(coho_smiles_read(&x, s[k], strlen(s[k])) == COHO_OK);
+		assert(coho_smiles_write(&w, &x) == COHO_OK);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < ROUNDS; i++) {
+		for (k = 0; k < count; k++) {
+			coho_smiles_read(&x, s[k], strlen(s[k]));
+			coho_smiles_write(&w, &x);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	coho_smiles_writer_free(&w);
+	coho_smiles_free(&x);
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	ns /= (double)ROUNDS * count;
+	printf("%-12s %8.0f ns/molecule %8.2e molecules/hour\n", name, ns,
+	    3.6e12 / ns);
+}
+
+int main(void)
+{
+	int fd;
+
+	fd = open_counter();
+	run("typical", typical, sizeof(typical) / sizeof(typical[0]), fd);
+	run("ring-heavy", ring_heavy,
+	    sizeof(ring_heavy) / sizeof(ring_heavy[0]), fd);
+	run_write("round trip", typical, sizeof(typical) / sizeof(typical[0]));
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Allocator for tests that counts allocations and the bytes held, and
+ * fails allocations beyond a limit.  It is safe to call from several
+ * threads.  Include after <pthread.h>, <stdlib.h> and coho.h.
+ */
+
+struct counter {
+	pthread_mutex_t lock;
+	size_t allocs;
+	size_t reallocs;
+	size_t frees;
+	size_t bytes;
+	size_t limit;		/* fail allocations beyond this many bytes */
+};
+
+static void *counting_alloc(void *ud, size_t size)
+{
+	struct counter *c = ud;
+	void *p = NULL;
+
+	pthread_mutex_lock(&c->lock);
+	if (c->bytes + size <= c->limit && (p = malloc(size)) != NULL) {
+		c->allocs++;
+		c->bytes += size;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return p;
+}
+
+static void counting_free(void *ud, void *p, size_t size)
+{
+	struct counter *c = ud;
+
+	pthread_mutex_lock(&c->lock);
+	c->frees++;
+	c->bytes -= size;
+	pthread_mutex_unlock(&c->lock);
+	free(p);
+}
+
+static void *counting_realloc(void *ud, void *p, size_t old, size_t size)
+{
+	struct counter *c = ud;
+	void *np = NULL;
+
+	pthread_mutex_lock(&c->lock);
+	if (c->bytes - old + size <= c->limit &&
+	    (np = realloc(p, size)) != NULL) {
+		c->reallocs++;
+		c->bytes = c->bytes - old + size;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return np;
+}
+
+/*
+ * Clears the counts of c, sets its limit, and sets allocator a to count
+ * through it.
+ */
+static void counter_init(struct counter *c, struct coho_allocator *a,
+    size_t limit)
+{
+	pthread_mutex_init(&c->lock, NULL);
+	c->allocs = 0;
+	c->reallocs = 0;
+	c->frees = 0;
+	c->bytes = 0;
+	c->limit = limit;
+	coho_allocator_init(a);
+	a->alloc = counting_alloc;
+	a->realloc = counting_realloc;
+	a->free = counting_free;
+	a->ud = c;
+}
@@ -0,0 +1,115 @@
+/*
+ * Checks the splitting of SMILES files into records.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+
+static const char buf[] =
+    "CCO ethanol\n"
+    "\n"
+    "c1ccccc1\tbenzene ring  \r\n"
+    "   \n"
+    "[NH4+]\n"
+    "O=O oxygen";
+
+static const char *smiles[] = {"CCO", "c1ccccc1", "[NH4+]", "O=O"};
+static const char *names[] = {"ethanol", "benzene ring", "", "oxygen"};
+static const size_t offsets[] = {0, 13, 42, 49};
+
+/*
+ * Checks that the records of f are records first up to last.
+ */
+static void check(struct coho_smiles_file *f, int first, int last)
+{
+	struct coho_smiles_record r;
+	int i;
+
+	for (i = first; i < last; i++) {
+		assert(coho_smiles_file_next(f, &r) == 1);
+		assert(r.smiles_length == strlen(smiles[i]));
+		assert(memcmp(r.smiles, smiles[i], r.smiles_length) == 0);
+		assert(r.name_length == strlen(names[i]));
+		assert(memcmp(r.name, names[i], r.name_length) == 0);
+		assert(r.offset == offsets[i]);
+	}
+	assert(coho_smiles_file_next(f, &r) == 0);
+	assert(coho_smiles_file_next(f, &r) == 0);
+}
+
+/*
+ * Returns the number of records starting before offset off.
+ */
+static int before(size_t off)
+{
+	int i;
+
+	for (i = 0; i < 4 && offsets[i] < off; i++)
+		;
+	return i;
+}
+
+int main(void)
+{
+	struct coho_smiles_file f;
+	struct coho_smiles_record r;
+	struct coho_smiles x;
+	char path[] = "/tmp/coho-file-XXXXXX";
+	size_t sz = sizeof(buf) - 1, i, j;
+	FILE *fp;
+	int fd;
+
+	coho_smiles_file_init(&f, buf, sz);
+	check(&f, 0, 4);
+
+	/* Every split assigns each record to exactly one part. */
+	for (i = 0; i <= sz; i++) {
+		for (j = i; j <= sz; j++) {
+			coho_smiles_file_init(&f, buf, sz);
+			coho_smiles_file_range(&f, 0, i);
+			check(&f, 0, before(i));
+			coho_smiles_file_range(&f, i, j);
+			check(&f, before(i), before(j));
+			coho_smiles_file_range(&f, j, sz);
+			check(&f, before(j), 4);
+		}
+	}
+
+	/* Records parse in place. */
+	coho_smiles_init(&x);
+	coho_smiles_file_init(&f, buf, sz);
+	while (coho_smiles_file_next(&f, &r))
+		assert(coho_smiles_read(&x, r.smiles, r.smiles_length) ==
+		    COHO_OK);
+	coho_smiles_free(&x);
+
+	assert((fd = mkstemp(path)) != -1);
+	assert((fp = fdopen(fd, "w")) != NULL);
+	assert(fwrite(buf, 1, sz, fp) == sz);
+	assert(fclose(fp) == 0);
+
+	assert(coho_smiles_file_open(&f, path) == 0);
+	assert(f.size == sz);
+	check(&f, 0, 4);
+	coho_smiles_file_range(&f, 20, sz);
+	check(&f, 2, 4);
+	coho_smiles_file_close(&f);
+
+	/* Empty files have no records. */
+	assert((fp = fopen(path, "w")) != NULL);
+	assert(fclose(fp) == 0);
+	assert(coho_smiles_file_open(&f, path) == 0);
+	check(&f, 0, 0);
+	coho_smiles_file_close(&f);
+
+	unlink(path);
+	assert(coho_smiles_file_open(&f, path) == -1);
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * Checks reading of gzip-compressed SMILES files.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "coho.h"
+#include "counter.h"
+
+#define LINES	50000
+
+struct totals {
+	pthread_mutex_t lock;
+	const char *data;
+	size_t records;
+	size_t atoms;
+	size_t errors;
+	size_t offsets;
+};
+
+static int count(void *ud, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	struct totals *t = ud;
+
+	assert(memcmp(t->data + r->offset, r->smiles, r->smiles_length) == 0);
+
+	pthread_mutex_lock(&t->lock);
+	t->records++;
+	if (rc == COHO_OK)
+		t->atoms += x->atom_count;
+	else
+		t->errors++;
+	t->offsets += r->offset;
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+static int tally(void *ud, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	struct totals *t = ud;
+
+	(void)x;
+	(void)r;
+	(void)rc;
+	pthread_mutex_lock(&t->lock);
+	t->records++;
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+static int stop(void *ud, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	(void)ud;
+	(void)x;
+	(void)r;
+	(void)rc;
+	return 7;
+}
+
+/*
+ * Reads path with nthreads threads and checks the totals against a
+ * serial reading of the uncompressed data.
+ */
+static void check(const char *path, int nthreads, const char *data,
+    size_t sz)
+{
+	struct coho_smiles_file f;
+	struct coho_smiles_record r;
+	struct coho_smiles x;
+	struct totals want, got;
+
+	memset(&want, 0, sizeof(want));
+	coho_smiles_init(&x);
+	coho_smiles_file_init(&f, data, sz);
+	while (coho_smiles_file_next(&f, &r)) {
+		want.records++;
+		if (coho_smiles_read(&x, r.smiles, r.smiles_length) == COHO_OK)
+			want.atoms += x.atom_count;
+		else
+			want.errors++;
+		want.offsets += r.offset;
+	}
+	coho_smiles_free(&x);
+
+	memset(&got, 0, sizeof(got));
+	pthread_mutex_init(&got.lock, NULL);
+	got.data = data;
+	assert(coho_smiles_read_gz(path, nthreads, 0, count, &got) == 0);
+	pthread_mutex_destroy(&got.lock);
+
+	assert(got.records == want.records);
+	assert(got.atoms == want.atoms);
+	assert(got.errors == want.errors);
+	assert(got.offsets == want.offsets);
+}
+
+/*
+ * Reads path through a counting allocator, checking that everything
+ * allocated is freed, and that allocation failure is reported.
+ */
+static void check_allocator(const char *path)
+{
+	struct coho_allocator a;
+	struct counter c;
+	struct totals got;
+
+	counter_init(&c, &a, (size_t)-1);
+
+	memset(&got, 0, sizeof(got));
+	pthread_mutex_init(&got.lock, NULL);
+	got.data = NULL;
+	assert(coho_smiles_read_gz_with_allocator(path, 3, 0, &a, tally,
+	    &got) == 0);
+	assert(got.records > 0);
+	assert(c.allocs > 0);
+	assert(c.bytes == 0);
+
+	c.limit = 1000;
+	errno = 0;
+	assert(coho_smiles_read_gz_with_allocator(path, 3, 0, &a, tally,
+	    &got) == -1);
+	assert(errno == ENOMEM);
+	assert(c.bytes == 0);
+
+	pthread_mutex_destroy(&got.lock);
+	pthread_mutex_destroy(&c.lock);
+}
+
+int main(void)
+{
+	char path[] = "/tmp/coho-gz-XXXXXX";
+	char *data, *p;
+	size_t sz, i;
+	gzFile gz;
+	FILE *fp;
+	int fd;
+
+	/* Short lines, and one longer than a buffer. */
+	sz = LINES * 32 + 3000000;
+	assert((data = malloc(sz)) != NULL);
+	p = data;
+	for (i = 0; i < LINES; i++) {
+		if (i == LINES / 2) {
+			p += sprintf(p, "CCO ");
+			memset(p, 'x', 2500000);
+			p += 2500000;
+			*p++ = '\n';
+		}
+		p += sprintf(p, "C%zuCC%zuO%s mol%zu\n", i % 10, i % 10,
+		    i % 7 ? "" : "(", i);
+	}
+	sz = p - data;
+
+	assert((fd = mkstemp(path)) != -1);
+	close(fd);
+	assert((gz = gzopen(path, "wb")) != NULL);
+	assert(gzwrite(gz, data, sz) == (int)sz);
+	assert(gzclose(gz) == Z_OK);
+
+	check(path, 1, data, sz);
+	check(path, 4, data, sz);
+	assert(coho_smiles_read_gz(path, 4, 0, stop, NULL) == 7);
+	check_allocator(path);
+
+	/* Uncompressed files are read as they are. */
+	assert((fp = fopen(path, "wb")) != NULL);
+	assert(fwrite(data, 1, sz - 1, fp) == sz - 1);
+	assert(fclose(fp) == 0);
+	check(path, 3, data, sz - 1);
+
+	unlink(path);
+	assert(coho_smiles_read_gz(path, 2, 0, count, NULL) == -1);
+
+	free(data);
+	return 0;
+}
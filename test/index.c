@@ -0,0 +1,143 @@
+/*
+ * Checks record indexes of SMILES files.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+#include "counter.h"
+
+#define RECORDS	1000
+
+static size_t offsets[RECORDS];
+
+/*
+ * Checks that f next reads records first up to last.
+ */
+static void check(struct coho_smiles_file *f, size_t first, size_t last)
+{
+	struct coho_smiles_record r;
+	size_t i;
+
+	for (i = first; i < last; i++) {
+		assert(coho_smiles_file_next(f, &r) == 1);
+		assert(r.offset == offsets[i]);
+	}
+	assert(coho_smiles_file_next(f, &r) == 0);
+}
+
+/*
+ * Builds and reads back the index at ipath of the file at path through
+ * a counting allocator, checking that everything allocated is freed,
+ * and that allocation failure is reported.
+ */
+static void check_allocator(const char *path, const char *ipath)
+{
+	struct coho_smiles_index idx;
+	struct coho_allocator a;
+	struct counter c;
+
+	counter_init(&c, &a, (size_t)-1);
+	assert(coho_smiles_index_build_with_allocator(&idx, path, 7, &a) == 0);
+	assert(c.bytes > 0 && idx.allocator.held == c.bytes);
+	coho_smiles_index_free(&idx);
+	assert(c.bytes == 0);
+	assert(coho_smiles_index_read_with_allocator(&idx, ipath, path,
+	    &a) == 0);
+	assert(idx.count == (RECORDS + 6) / 7);
+	assert(c.bytes > 0);
+	coho_smiles_index_free(&idx);
+	assert(c.bytes == 0);
+
+	c.limit = 1000;
+	errno = 0;
+	assert(coho_smiles_index_build_with_allocator(&idx, path, 7, &a) == -1);
+	assert(errno == ENOMEM);
+	assert(c.bytes == 0);
+	errno = 0;
+	assert(coho_smiles_index_read_with_allocator(&idx, ipath, path,
+	    &a) == -1);
+	assert(errno == ENOMEM);
+	assert(c.bytes == 0);
+
+	pthread_mutex_destroy(&c.lock);
+}
+
+int main(void)
+{
+	struct coho_smiles_index idx, idx2;
+	struct coho_smiles_file f;
+	char path[] = "/tmp/coho-index-XXXXXX", ipath[64];
+	size_t i, n, part;
+	FILE *fp;
+	int fd;
+
+	assert((fd = mkstemp(path)) != -1);
+	assert((fp = fdopen(fd, "w")) != NULL);
+	n = 0;
+	for (i = 0; i < RECORDS; i++) {
+		if (i % 10 == 0)
+			n += fprintf(fp, "\n");
+		offsets[i] = n;
+		n += fprintf(fp, "C%zuCC%zuO mol%zu\n", i % 10, i % 10, i);
+	}
+	assert(fclose(fp) == 0);
+	snprintf(ipath, sizeof(ipath), "%s.idx", path);
+
+	assert(coho_smiles_index_build(&idx, path, 7) == 0);
+	assert(idx.records == RECORDS);
+	assert(idx.count == (RECORDS + 6) / 7);
+	assert(coho_smiles_index_write(&idx, ipath) == 0);
+
+	assert(coho_smiles_index_read(&idx2, ipath, path) == 0);
+	assert(idx2.records == idx.records);
+	assert(idx2.interval == 7);
+	assert(idx2.count == idx.count);
+	assert(memcmp(idx2.offsets, idx.offsets,
+	    idx.count * sizeof(idx.offsets[0])) == 0);
+	coho_smiles_index_free(&idx);
+
+	assert(coho_smiles_file_open(&f, path) == 0);
+	for (i = 0; i < RECORDS; i += 37) {
+		assert(coho_smiles_index_seek(&idx2, &f, i) == 0);
+		check(&f, i, RECORDS);
+	}
+	assert(coho_smiles_index_seek(&idx2, &f, RECORDS) == -1);
+
+	/* Balanced parts cover every record once. */
+	for (part = 0; part < 6; part++) {
+		assert(coho_smiles_index_range(&idx2, &f,
+		    RECORDS * part / 6, RECORDS * (part + 1) / 6) == 0);
+		check(&f, RECORDS * part / 6, RECORDS * (part + 1) / 6);
+	}
+	assert(coho_smiles_index_range(&idx2, &f, 5, 5) == 0);
+	check(&f, 5, 5);
+	assert(coho_smiles_index_range(&idx2, &f, 5, RECORDS + 1) == -1);
+	coho_smiles_file_close(&f);
+	coho_smiles_index_free(&idx2);
+	check_allocator(path, ipath);
+
+	/* A changed file makes the index stale. */
+	assert((fp = fopen(path, "a")) != NULL);
+	assert(fprintf(fp, "CC\n") == 3);
+	assert(fclose(fp) == 0);
+	assert(coho_smiles_index_read(&idx2, ipath, path) == -1);
+	assert(errno == ESTALE);
+
+	/* Truncated indexes are rejected. */
+	assert(truncate(ipath, 60) == 0);
+	assert(coho_smiles_index_read(&idx2, ipath, NULL) == -1);
+	assert(errno == EINVAL);
+
+	unlink(ipath);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Checks reading of many SMILES files at once.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+#include "counter.h"
+
+#define FILES	5
+
+struct totals {
+	size_t records;
+	size_t atoms;
+	size_t errors;
+	size_t offsets;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char *data[FILES];
+static size_t sizes[FILES];
+static struct totals want[FILES], got[FILES];
+
+static void add(struct totals *t, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	t->records++;
+	if (rc == COHO_OK)
+		t->atoms += x->atom_count;
+	else
+		t->errors++;
+	t->offsets += r->offset;
+}
+
+static int count(void *ud, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	(void)ud;
+	assert(r->file < FILES);
+	assert(r->offset + r->smiles_length <= sizes[r->file]);
+	assert(memcmp(data[r->file] + r->offset, r->smiles,
+	    r->smiles_length) == 0);
+
+	pthread_mutex_lock(&lock);
+	add(&got[r->file], x, r, rc);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+static int stop(void *ud, struct coho_smiles *x,
+    const struct coho_smiles_record *r, int rc)
+{
+	(void)ud;
+	(void)x;
+	(void)r;
+	(void)rc;
+	return 5;
+}
+
+static void check(const char *const *paths, int io_uring, int nthreads,
+    int depth, int buffers, size_t buffer_size)
+{
+	struct coho_smiles_ingest opts;
+	int i;
+
+	coho_smiles_ingest_init(&opts);
+	opts.io_uring = io_uring;
+	opts.nthreads = nthreads;
+	opts.queue_depth = depth;
+	opts.buffers = buffers;
+	opts.buffer_size = buffer_size;
+
+	memset(got, 0, sizeof(got));
+	assert(coho_smiles_read_files(&opts, paths, FILES, count, NULL) == 0);
+	for (i = 0; i < FILES; i++) {
+		assert(got[i].records == want[i].records);
+		assert(got[i].atoms == want[i].atoms);
+		assert(got[i].errors == want[i].errors);
+		assert(got[i].offsets == want[i].offsets);
+	}
+}
+
+/*
+ * Reads the files through a counting allocator, checking that
+ * everything allocated is freed, and that allocation failure is
+ * reported.
+ */
+static void check_allocator(const char *const *paths, int io_uring)
+{
+	struct coho_smiles_ingest opts;
+	struct coho_allocator a;
+	struct counter c;
+	int i;
+
+	counter_init(&c, &a, (size_t)-1);
+	coho_smiles_ingest_init(&opts);
+	opts.io_uring = io_uring;
+	opts.nthreads = 3;
+	opts.buffers = 4;
+	opts.buffer_size = 4096;
+
+	memset(got, 0, sizeof(got));
+	assert(coho_smiles_read_files_with_allocator(&opts, &a, paths, FILES,
+	    count, NULL) == 0);
+	for (i = 0; i < FILES; i++)
+		assert(got[i].records == want[i].records);
+	assert(c.allocs > 0);
+	assert(c.bytes == 0);
+
+	/* Enough for the buffers, but not the long line of file 3. */
+	c.limit = 40000;
+	errno = 0;
+	assert(coho_smiles_read_files_with_allocator(&opts, &a, paths, FILES,
+	    count, NULL) == -1);
+	assert(errno == ENOMEM);
+	assert(c.bytes == 0);
+
+	c.limit = 1000;
+	errno = 0;
+	assert(coho_smiles_read_files_with_allocator(&opts, &a, paths, FILES,
+	    count, NULL) == -1);
+	assert(errno == ENOMEM);
+	assert(c.bytes == 0);
+
+	pthread_mutex_destroy(&c.lock);
+}
+
+int main(void)
+{
+	struct coho_smiles_ingest opts;
+	struct coho_smiles_file f;
+	struct coho_smiles_record r;
+	struct coho_smiles x;
+	char paths[FILES][32];
+	const char *p[FILES], *missing[1];
+	size_t i, n;
+	FILE *fp;
+	int k, fd;
+
+	coho_smiles_init(&x);
+	for (k = 0; k < FILES; k++) {
+		/* File 1 is empty, and file 3 has a line of 20000 bytes. */
+		n = k == 1 ? 0 : 1000 * (k + 1);
+		assert((data[k] = malloc(n * 32 + 30000)) != NULL);
+		sizes[k] = 0;
+		for (i = 0; i < n; i++) {
+			if (k == 3 && i == n / 2) {
+				memset(data[k] + sizes[k], 'C', 20000);
+				sizes[k] += 20000;
+				data[k][sizes[k]++] = '\n';
+			}
+			sizes[k] += sprintf(data[k] + sizes[k],
+			    "C%zuCC%zuO%s mol%zu\n", i % 10, i % 10,
+			    i % 7 ? "" : "(", i);
+		}
+		/* File 4 has no final newline. */
+		if (k == 4)
+			sizes[k]--;
+
+		snprintf(paths[k], sizeof(paths[k]), "/tmp/coho-ingest-XXXXXX");
+		assert((fd = mkstemp(paths[k])) != -1);
+		assert((fp = fdopen(fd, "w")) != NULL);
+		assert(fwrite(data[k], 1, sizes[k], fp) == sizes[k]);
+		assert(fclose(fp) == 0);
+		p[k] = paths[k];
+
+		coho_smiles_file_init(&f, data[k], sizes[k]);
+		while (coho_smiles_file_next(&f, &r))
+			add(&want[k], &x, &r,
+			    coho_smiles_read(&x, r.smiles, r.smiles_length));
+	}
+	coho_smiles_free(&x);
+
+	for (k = 0; k < 2; k++) {
+		check(p, k, 1, 1, 1, 4096);
+		check(p, k, 1, 3, 2, 4096);
+		check(p, k, 4, 3, 8, 4096);
+		check(p, k, 4, 8, 3, 1000);
+		check(p, k, 2, 8, 32, 1 << 20);
+		check_allocator(p, k);
+	}
+
+	coho_smiles_ingest_init(&opts);
+	opts.nthreads = 3;
+	assert(coho_smiles_read_files(&opts, p, FILES, stop, NULL) == 5);
+
+	missing[0] = "/nonexistent/coho";
+	assert(coho_smiles_read_files(&opts, missing, 1, count, NULL) == -1);
+
+	for (k = 0; k < FILES; k++) {
+		unlink(paths[k]);
+		free(data[k]);
+	}
+	return 0;
+}
@@ -0,0 +1,979 @@
+/*
+ * Differential test of the table-driven lexer against
+ * the original switch-based one.
+ */
+
+#include "../smiles.c"
+
+/*
+ * The switch-based lexer that preceded the table-driven one,
+ * kept as a reference, with Cd and Nd corrected and Nh, Mc, Ts and Og
+ * added.
+ */
+static unsigned int lex_ref(struct coho_smiles *x,
+    struct coho_smiles_token *t, int inbracket)
+{
+	int c0, c1;
+	const char *s;
+
+	if (x->position == x->end)
+		return 0;
+
+	s = x->smiles + x->position;
+	c0 = s[0];
+	c1 = 0;
+
+	if (x->position < x->end)
+		c1 = s[1];
+
+	t->s = s;
+	t->position = x->position;
+	t->n = 1;
+	t->type = 0;
+	t->intval = -1;
+	t->flags = 0;
+
+	switch (c0) {
+	case 'a':
+		if (inbracket && c1 == 's') {
+			t->n = 2;
+			t->type = AROMATIC;
+			t->intval = 33;
+			goto out;
+		}
+		return 0;
+	case 'b':
+		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
+		t->intval = 5;
+		goto out;
+	case 'c':
+		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
+		t->intval = 6;
+		goto out;
+	case 'n':
+		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
+		t->intval = 7;
+		goto out;
+	case 'o':
+		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
+		t->intval = 8;
+		goto out;
+	case 'p':
+		t->type = inbracket ? AROMATIC : AROMATIC_ORGANIC;
+		t->intval = 15;
+		goto out;
+	case 's':
+		if (!inbracket) {
+			t->type = AROMATIC_ORGANIC;
+			t->intval = 16;
+			goto out;
+		}
+		switch (c1) {
+		case 'e':
+			t->type = AROMATIC;
+			t->n = 2;
+			t->intval = 34;
+			goto out;
+		default:
+			t->type = AROMATIC;
+			t->intval = 16;
+			goto out;
+		}
+	case 'A':
+		switch (c1) {
+		case 'c':
+			t->type = ELEMENT;
+			t->intval = 89;
+			t->n = 2;
+			goto out;
+		case 'g':
+			t->type = ELEMENT;
+			t->intval = 47;
+			t->n = 2;
+			goto out;
+		case 'l':
+			t->type = ELEMENT;
+			t->intval = 13;
+			t->n = 2;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->intval = 95;
+			t->n = 2;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->intval = 18;
+			t->n = 2;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->intval = 33;
+			t->n = 2;
+			goto out;
+		case 't':
+			t->type = ELEMENT;
+			t->intval = 85;
+			t->n = 2;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->intval = 79;
+			t->n = 2;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'B':
+		if (!inbracket) {
+			if (c1 == 'r') {
+				t->intval = 35;
+				t->n = 2;
+			} else {
+				t->intval = 5;
+			}
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->intval = 56;
+			t->n = 2;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->intval = 4;
+			t->n = 2;
+			goto out;
+		case 'h':
+			t->type = ELEMENT;
+			t->intval = 107;
+			t->n = 2;
+			goto out;
+		case 'i':
+			t->type = ELEMENT;
+			t->intval = 83;
+			t->n = 2;
+			goto out;
+		case 'k':
+			t->type = ELEMENT;
+			t->intval = 97;
+			t->n = 2;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->intval = 35;
+			t->n = 2;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 5;
+			goto out;
+		}
+	case 'C':
+		if (!inbracket) {
+			if (c1 == 'l') {
+				t->intval = 17;
+				t->n = 2;
+			} else {
+				t->intval = 6;
+			}
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 20;
+			goto out;
+		case 'd':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 48;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 58;
+			goto out;
+		case 'f':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 98;
+			goto out;
+		case 'l':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 17;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 96;
+			goto out;
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 112;
+			goto out;
+		case 'o':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 27;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 24;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 55;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 29;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 6;
+			goto out;
+		}
+	case 'D':
+		switch (c1) {
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 105;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 110;
+			goto out;
+		case 'y':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 66;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'E':
+		switch (c1) {
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 68;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 99;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 63;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'F':
+		if (!inbracket) {
+			t->intval = 9;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 26;
+			goto out;
+		case 'l':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 114;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 100;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 87;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 9;
+			goto out;
+		}
+	case 'G':
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 31;
+			goto out;
+		case 'd':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 64;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 32;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'H':
+		switch (c1) {
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 2;
+			goto out;
+		case 'f':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 72;
+			goto out;
+		case 'g':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 80;
+			goto out;
+		case 'o':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 67;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 108;
+			goto out;
+		default:
+			t->type = ELEMENT | HYDROGEN;
+			t->intval = 1;
+			goto out;
+		}
+	case 'I':
+		if (!inbracket) {
+			t->intval = 53;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 49;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 77;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 53;
+			goto out;
+		}
+	case 'K':
+		switch (c1) {
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 36;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 19;
+			goto out;
+		}
+	case 'L':
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 57;
+			goto out;
+		case 'i':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 3;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 103;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 71;
+			goto out;
+		case 'v':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 116;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'M':
+		switch (c1) {
+		case 'c':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 115;
+			goto out;
+		case 'd':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 101;
+			goto out;
+		case 'g':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 12;
+			goto out;
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 25;
+			goto out;
+		case 'o':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 42;
+			goto out;
+		case 't':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 109;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'N':
+		if (!inbracket) {
+			t->intval = 7;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 11;
+			goto out;
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 41;
+			goto out;
+		case 'd':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 60;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 10;
+			goto out;
+		case 'h':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 113;
+			goto out;
+		case 'i':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 28;
+			goto out;
+		case 'o':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 102;
+			goto out;
+		case 'p':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 93;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 7;
+			goto out;
+		}
+	case 'O':
+		if (!inbracket) {
+			t->intval = 8;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'g':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 118;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 76;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 8;
+			goto out;
+		}
+	case 'P':
+		if (!inbracket) {
+			t->intval = 15;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 91;
+			goto out;
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 82;
+			goto out;
+		case 'd':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 46;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 61;
+			goto out;
+		case 'o':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 84;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 59;
+			goto out;
+		case 't':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 78;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 94;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 15;
+			goto out;
+		}
+	case 'R':
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 88;
+			goto out;
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 37;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 75;
+			goto out;
+		case 'f':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 104;
+			goto out;
+		case 'g':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 111;
+			goto out;
+		case 'h':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 45;
+			goto out;
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 86;
+			goto out;
+		case 'u':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 44;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'S':
+		if (!inbracket) {
+			t->intval = 16;
+			t->type = ALIPHATIC_ORGANIC;
+			goto out;
+		}
+		switch (c1) {
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 51;
+			goto out;
+		case 'c':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 21;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 34;
+			goto out;
+		case 'g':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 106;
+			goto out;
+		case 'i':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 14;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 62;
+			goto out;
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 50;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 38;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 16;
+			goto out;
+		}
+	case 'T':
+		switch (c1) {
+		case 'a':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 73;
+			goto out;
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 65;
+			goto out;
+		case 'c':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 43;
+			goto out;
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 52;
+			goto out;
+		case 'h':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 90;
+			goto out;
+		case 'i':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 22;
+			goto out;
+		case 'l':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 81;
+			goto out;
+		case 'm':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 69;
+			goto out;
+		case 's':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 117;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'U':
+		t->type = ELEMENT;
+		t->intval = 92;
+		goto out;
+	case 'V':
+		t->type = ELEMENT;
+		t->intval = 23;
+		goto out;
+	case 'W':
+		t->type = ELEMENT;
+		t->intval = 74;
+		goto out;
+	case 'X':
+		switch (c1) {
+		case 'e':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 54;
+			goto out;
+		default:
+			return 0;
+		}
+	case 'Y':
+		switch (c1) {
+		case 'b':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 70;
+			goto out;
+		default:
+			t->type = ELEMENT;
+			t->intval = 39;
+			goto out;
+		}
+	case 'Z':
+		switch (c1) {
+		case 'n':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 30;
+			goto out;
+		case 'r':
+			t->type = ELEMENT;
+			t->n = 2;
+			t->intval = 40;
+			goto out;
+		default:
+			return 0;
+		}
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		t->type = DIGIT;
+		t->intval = c0 - '0';
+		goto out;
+	case '*':
+		t->type = WILDCARD;
+		t->intval = 0;
+		goto out;
+	case '[':
+		t->type = BRACKET_OPEN;
+		goto out;
+	case ']':
+		t->type = BRACKET_CLOSE;
+		goto out;
+	case '(':
+		t->type = PAREN_OPEN;
+		goto out;
+	case ')':
+		t->type = PAREN_CLOSE;
+		goto out;
+	case '+':
+		t->type = PLUS;
+		t->intval = 1;
+		goto out;
+	case '-':
+		t->type   = inbracket ? MINUS : BOND;
+		t->intval = inbracket ? -1 : COHO_SMILES_BOND_SINGLE;
+		goto out;
+	case '%':
+		t->type = PERCENT;
+		goto out;
+	case '=':
+		t->type = BOND;
+		t->intval = COHO_SMILES_BOND_DOUBLE;
+		goto out;
+	case '#':
+		t->type = BOND;
+		t->intval = COHO_SMILES_BOND_TRIPLE;
+		goto out;
+	case '$':
+		t->type = BOND;
+		t->intval = COHO_SMILES_BOND_QUAD;
+		goto out;
+	case ':':
+		if (inbracket) {
+			t->type = COLON;
+		} else {
+			t->type = BOND;
+			t->intval = COHO_SMILES_BOND_AROMATIC;
+		}
+		goto out;
+	case '/':
+		t->type = BOND;
+		t->intval = COHO_SMILES_BOND_SINGLE;
+		t->flags = COHO_SMILES_BOND_STEREO_UP;
+		goto out;
+	case '\\':
+		t->type = BOND;
+		t->intval = COHO_SMILES_BOND_SINGLE;
+		t->flags = COHO_SMILES_BOND_STEREO_DOWN;
+		goto out;
+	case '.':
+		t->type = DOT;
+		goto out;
+	case '@':
+		t->type = CHIRALITY;
+		if (c1 == '@')
+			t->n = 2;
+		goto out;
+	default:
+		return 0;
+	}
+
+out:
+	return t->type;
+}
+
+static unsigned int ttypes[] = {
+	ALIPHATIC_ORGANIC, AROMATIC, AROMATIC_ORGANIC, BOND, BRACKET_CLOSE,
+	BRACKET_OPEN, CHIRALITY, COLON, DIGIT, DOT, ELEMENT, HYDROGEN, MINUS,
+	PAREN_CLOSE, PAREN_OPEN, PERCENT, PLUS, WILDCARD,
+};
+
+/*
+ * Lexes the first sz bytes of s with both lexers and checks that they agree.
+ * The reference lexer always examines the byte following the first,
+ * so it is given a copy of s with that byte cleared when sz is 1.
+ */
+static void check(const char *s, size_t sz, int inbracket)
+{
+	struct coho_smiles x, y;
+	const struct coho_smiles_token *p;
+	struct coho_smiles_token t, u;
+	unsigned int type, rtype;
+	char buf[3];
+	size_t i, n;
+
+	coho_smiles_init(&x);
+	coho_smiles_init(&y);
+
+	buf[0] = s[0];
+	buf[1] = sz > 1 ? s[1] : 0;
+	buf[2] = 0;
+
+	x.smiles = s;
+	x.end = sz;
+	y.smiles = buf;
+	y.end = sz;
+
+	p = lex(&x, inbracket);
+	type = p ? p->type : 0;
+	rtype = lex_ref(&y, &u, inbracket);
+	assert(type == rtype);
+
+	n = 0;
+	if (type) {
+		n = u.n;
+		assert(p->type == u.type);
+		assert(p->position == u.position);
+		assert(p->s == s);
+		assert(p->n == u.n);
+		assert(p->intval == u.intval);
+		assert(p->flags == u.flags);
+
+		/* The token is read once per position. */
+		assert(lex(&x, inbracket) == p);
+	}
+
+	for (i = 0; i < sizeof(ttypes) / sizeof(ttypes[0]); i++) {
+		x.position = 0;
+		assert(match(&x, &t, inbracket, ttypes[i]) ==
+		    ((rtype & ttypes[i]) != 0));
+		assert(x.position == (int)((rtype & ttypes[i]) ? n : 0));
+	}
+}
+
+/*
+ * Checks that the symbol of each element is read inside brackets as
+ * one token with its atomic number.
+ */
+static void check_elements(void)
+{
+	struct coho_smiles x;
+	const struct coho_smiles_token *p;
+	size_t i;
+
+	coho_smiles_init(&x);
+	for (i = 1; i < sizeof(elements) / sizeof(elements[0]); i++) {
+		x.smiles = elements[i].symbol;
+		x.position = 0;
+		x.end = strlen(x.smiles);
+		x.token.position = -1;
+		assert((p = lex(&x, 1)) != NULL);
+		assert(p->type & ELEMENT);
+		assert(p->intval == (int)i);
+		assert(p->n == strlen(x.smiles));
+	}
+}
+
+int main(void)
+{
+	char s[3];
+	int c0, c1, inbracket;
+
+	s[2] = 0;
+
+	for (inbracket = 0; inbracket < 2; inbracket++) {
+		for (c0 = 0; c0 < 256; c0++) {
+			s[0] = c0;
+			s[1] = 0;
+			check(s, 1, inbracket);
+			for (c1 = 0; c1 < 256; c1++) {
+				s[1] = c1;
+				check(s, 2, inbracket);
+			}
+		}
+	}
+	check_elements();
+	return 0;
+}
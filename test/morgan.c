@@ -0,0 +1,152 @@
+/*
+ * Checks circular fingerprints.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "counter.h"
+
+#define LENGTH	1024
+#define WORDS	COHO_FINGERPRINT_WORDS(LENGTH)
+
+static const char *molecules[] = {
+	"CCO",
+	"c1ccccc1",
+	"C1CCCCC1",
+	"CCCCCC",
+	"CC(=O)Oc1ccccc1C(=O)O",
+	"C[C@H](N)C(=O)O",
+	"[Na+].[Cl-]",
+	"[13CH4]",
+	"C1CC2CCC1CC2",
+	"c1ccc2[nH]ccc2c1",
+};
+
+/*
+ * Spellings of the same molecules.
+ */
+static const char *same[][4] = {
+	{"CCO", "OCC", "C(O)C", "[CH3][CH2][OH]"},
+	{"OC(=O)c1ccccc1", "c1ccccc1C(O)=O", "c1cc(C(=O)O)ccc1",
+	    "O=C(O)c1ccccc1"},
+	{"C1CC2CCC1CC2", "C12CCC(CC1)CC2", "C1(CC2)CCC2CC1",
+	    "C2CC1CCC2CC1"},
+};
+
+static void bits(struct coho_fingerprint *f, struct coho_smiles *x,
+    const char *smi, unsigned long long *v)
+{
+	assert(coho_smiles_read(x, smi, strlen(smi)) == COHO_OK);
+	assert(coho_fingerprint_bits(f, x, v) == COHO_OK);
+}
+
+/*
+ * Returns the number of distinct features of smi.
+ */
+static size_t counts(struct coho_fingerprint *f, struct coho_smiles *x,
+    const char *smi, struct coho_fingerprint_count *c, size_t cap)
+{
+	size_t i, n;
+	int total = 0;
+
+	assert(coho_smiles_read(x, smi, strlen(smi)) == COHO_OK);
+	assert(coho_fingerprint_counts(f, x, c, cap, &n) == COHO_OK);
+	for (i = 0; i < n && i < cap; i++) {
+		assert(i == 0 || c[i - 1].id < c[i].id);
+		total += c[i].count;
+	}
+	if (n <= cap)
+		assert(total == x->atom_count * (f->radius + 1));
+	return n;
+}
+
+int main(void)
+{
+	struct coho_allocator a;
+	struct coho_fingerprint f;
+	struct coho_fingerprint_count c[64], d[64];
+	struct coho_smiles_batch b;
+	struct coho_smiles x;
+	unsigned long long v[WORDS], w[WORDS];
+	unsigned long long *all;
+	struct counter ctr;
+	size_t i, k, n, count = sizeof(molecules) / sizeof(molecules[0]);
+
+	coho_smiles_init(&x);
+
+	/* Ethanol has three kinds of atom, cyclohexane one. */
+	coho_fingerprint_init(&f, 0, LENGTH);
+	assert(counts(&f, &x, "CCO", c, 64) == 3);
+	assert(counts(&f, &x, "C1CCCCC1", c, 64) == 1);
+	assert(c[0].count == 6);
+	assert(counts(&f, &x, "CCCCCC", d, 64) == 2);
+	assert(c[0].id != d[0].id && c[0].id != d[1].id);
+	coho_fingerprint_free(&f);
+	coho_fingerprint_init(&f, 2, LENGTH);
+
+	/* Features don't depend on the order atoms were written. */
+	for (i = 0; i < sizeof(same) / sizeof(same[0]); i++) {
+		bits(&f, &x, same[i][0], v);
+		n = counts(&f, &x, same[i][0], c, 64);
+		for (k = 1; k < 4; k++) {
+			bits(&f, &x, same[i][k], w);
+			assert(memcmp(v, w, sizeof(v)) == 0);
+			assert(counts(&f, &x, same[i][k], d, 64) == n);
+			assert(memcmp(c, d, n * sizeof(c[0])) == 0);
+		}
+	}
+
+	/* Different molecules have different fingerprints. */
+	for (i = 0; i < count; i++) {
+		bits(&f, &x, molecules[i], v);
+		for (k = 0; k < i; k++) {
+			bits(&f, &x, molecules[k], w);
+			assert(memcmp(v, w, sizeof(v)) != 0);
+		}
+	}
+
+	/* Counts beyond the space given are counted but not stored. */
+	n = counts(&f, &x, molecules[4], c, 64);
+	assert(n > 4);
+	assert(counts(&f, &x, molecules[4], d, 4) == n);
+	assert(memcmp(c, d, 4 * sizeof(c[0])) == 0);
+
+	/* A batch gives the same fingerprints as its molecules alone. */
+	coho_smiles_batch_init(&b);
+	assert(coho_smiles_read_batch_array(&b, molecules, NULL, count) ==
+	    COHO_OK);
+	assert((all = calloc(count * WORDS, sizeof(all[0]))) != NULL);
+	assert(coho_fingerprint_batch(&f, &b, 0, count, all) == COHO_OK);
+	for (i = 0; i < count; i++) {
+		bits(&f, &x, molecules[i], v);
+		assert(memcmp(v, all + i * WORDS, sizeof(v)) == 0);
+	}
+	memset(all, 0xff, count * WORDS * sizeof(all[0]));
+	assert(coho_fingerprint_batch(&f, &b, 3, 2, all) == COHO_OK);
+	bits(&f, &x, molecules[4], v);
+	assert(memcmp(v, all + WORDS, sizeof(v)) == 0);
+	free(all);
+	coho_smiles_batch_free(&b);
+	coho_fingerprint_free(&f);
+
+	/* Once warmed up, fingerprinting allocates nothing. */
+	counter_init(&ctr, &a, (size_t)-1);
+	coho_fingerprint_init_with_allocator(&f, 2, LENGTH, &a);
+	bits(&f, &x, molecules[4], v);
+	k = ctr.allocs + ctr.reallocs;
+	for (i = 0; i < 100; i++) {
+		bits(&f, &x, molecules[i % count], v);
+		counts(&f, &x, molecules[i % count], c, 64);
+	}
+	assert(ctr.allocs + ctr.reallocs == k);
+	assert(f.allocator.held > 0);
+	coho_fingerprint_free(&f);
+	assert(f.allocator.held == 0);
+
+	coho_smiles_free(&x);
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Checks that packed atoms and bonds and the column view reproduce
+ * the parser's atoms and bonds.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "coho.h"
+
+static const char *smiles[] = {
+	"CC",
+	"c1ccccc1O",
+	"[13CH3:7][NH4+].[Na+]",
+	"[99999Se@@H2--:99999999]=C/C=C\\[2H]",
+	"*C#N$[O]%(100)CC%(100)",
+	"F[C@](Cl)(Br)I",
+	NULL,
+};
+
+static void check(struct coho_smiles *x, const char *smi)
+{
+	struct coho_smiles_atom a;
+	struct coho_smiles_bond b;
+	const struct coho_smiles_atom *xa;
+	const struct coho_smiles_bond *xb;
+	int i;
+
+	assert(coho_smiles_read(x, smi, 0) == COHO_OK);
+
+	for (i = 0; i < x->atom_count; i++) {
+		xa = &x->atoms[i];
+		coho_smiles_unpack_atom(&a, &x->packed_atoms[i], smi);
+		assert(a.atomic_number == xa->atomic_number);
+		assert(strcmp(a.symbol, xa->symbol) == 0);
+		assert(a.isotope == xa->isotope);
+		assert(a.charge == xa->charge);
+		assert(a.hydrogen_count == xa->hydrogen_count);
+		assert(a.implicit_hydrogen_count ==
+		    xa->implicit_hydrogen_count);
+		assert(a.is_bracket == xa->is_bracket);
+		assert(a.is_organic == xa->is_organic);
+		assert(a.is_aromatic == xa->is_aromatic);
+		assert(strcmp(a.chirality, xa->chirality) == 0);
+		assert(a.atom_class == xa->atom_class);
+		assert(a.position == xa->position);
+		assert(a.length == xa->length);
+
+		assert(x->columns.atomic_number[i] == xa->atomic_number);
+		assert(x->columns.charge[i] == xa->charge);
+		assert(x->columns.hydrogen_count[i] == xa->hydrogen_count);
+		assert(x->columns.implicit_hydrogen_count[i] ==
+		    xa->implicit_hydrogen_count);
+		assert(x->columns.is_aromatic[i] == xa->is_aromatic);
+		assert(x->columns.isotope[i] == xa->isotope);
+	}
+
+	for (i = 0; i < x->bond_count; i++) {
+		xb = &x->bonds[i];
+		coho_smiles_unpack_bond(&b, &x->packed_bonds[i]);
+		assert(b.atom0 == xb->atom0);
+		assert(b.atom1 == xb->atom1);
+		assert(b.order == xb->order);
+		assert(b.stereo == xb->stereo);
+		assert(b.is_implicit == xb->is_implicit);
+		assert(b.is_ring == xb->is_ring);
+		assert(b.position == xb->position);
+		assert(b.length == xb->length);
+
+		assert(x->columns.atom0[i] == xb->atom0);
+		assert(x->columns.atom1[i] == xb->atom1);
+		assert(x->columns.order[i] == xb->order);
+	}
+}
+
+int main(void)
+{
+	struct coho_smiles x;
+	int i;
+
+	assert(sizeof(struct coho_smiles_packed_atom) == 16);
+	assert(sizeof(struct coho_smiles_packed_bond) == 16);
+
+	coho_smiles_init(&x);
+	x.flags |= COHO_SMILES_PACKED | COHO_SMILES_COLUMNS;
+
+	for (i = 0; smiles[i] != NULL; i++)
+		check(&x, smiles[i]);
+
+	coho_smiles_free(&x);
+	return 0;
+}
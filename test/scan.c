@@ -0,0 +1,157 @@
+/*
+ * Compares the scalar and vectorized scanners with a simple
+ * reference on random input.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../scan.c"
+
+#define WORDS	((200 + BLOCK - 1) / BLOCK)
+
+static const char alphabet[] = "CNOcn[]()=#123%@H+-. \t\200,";
+
+/*
+ * Mask arrays of the reference and of the scanner being checked.
+ */
+static unsigned long ref_masks[4][WORDS], masks[4][WORDS];
+
+static void reference(struct coho_smiles_scan *sc, const unsigned char *s,
+    size_t sz)
+{
+	unsigned long bit;
+	size_t i;
+	int c, inside = 0;
+
+	memset(ref_masks, 0, sizeof(ref_masks));
+
+	sc->illegal = -1;
+	sc->atoms = 0;
+	sc->rings = 0;
+	sc->parens = 0;
+
+	for (i = 0; i < sz; i++) {
+		c = s[i];
+		bit = 1UL << i % BLOCK;
+		if (sc->illegal == -1 && !legal(c))
+			sc->illegal = i;
+		if (inside || c == '[' || c == ']')
+			ref_masks[0][i / BLOCK] |= bit;
+		if (c == '[') {
+			inside = 1;
+			sc->atoms++;
+		} else if (c == ']') {
+			inside = 0;
+		} else if (!inside && (c == '*' ||
+		    (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))) {
+			sc->atoms++;
+		} else if (!inside && c >= '0' && c <= '9') {
+			sc->rings++;
+			ref_masks[1][i / BLOCK] |= bit;
+		}
+		if (c == '(') {
+			sc->parens++;
+			ref_masks[2][i / BLOCK] |= bit;
+		}
+		if (c == ')')
+			ref_masks[3][i / BLOCK] |= bit;
+	}
+}
+
+static void check_equal(struct coho_smiles_scan *a, struct coho_smiles_scan *b)
+{
+	assert(a->illegal == b->illegal);
+	assert(a->atoms == b->atoms);
+	assert(a->rings == b->rings);
+	assert(a->parens == b->parens);
+	assert(memcmp(ref_masks, masks, sizeof(masks)) == 0);
+}
+
+static void start(struct state *st, struct coho_smiles_scan *sc,
+    struct coho_smiles_scan_masks *out)
+{
+	memset(masks, 0, sizeof(masks));
+	st->sc = sc;
+	st->out = out;
+	st->inside = 0;
+	sc->illegal = -1;
+	sc->atoms = sc->rings = sc->parens = 0;
+}
+
+static void check(const unsigned char *s, size_t sz)
+{
+	struct coho_smiles_scan ref, sc;
+	struct coho_smiles_scan_masks out;
+	struct state st;
+	size_t done;
+
+	out.brackets = masks[0];
+	out.rings = masks[1];
+	out.parens = masks[2];
+	out.close_parens = masks[3];
+	reference(&ref, s, sz);
+
+	start(&st, &sc, &out);
+	scan_scalar(&st, s, 0, sz);
+	check_equal(&ref, &sc);
+
+#ifdef SCAN_X86
+	start(&st, &sc, &out);
+	done = scan_sse2(&st, s, sz);
+	scan_scalar(&st, s, done, sz);
+	check_equal(&ref, &sc);
+
+	if (__builtin_cpu_supports("avx2")) {
+		start(&st, &sc, &out);
+		done = scan_avx2(&st, s, sz);
+		scan_scalar(&st, s, done, sz);
+		check_equal(&ref, &sc);
+	}
+#else
+	(void)done;
+#endif
+}
+
+int main(void)
+{
+	unsigned char s[200];
+	struct coho_smiles_scan sc;
+	struct coho_smiles_scan_masks out;
+	unsigned long rings[2];
+	size_t i, n;
+	int trial;
+
+	srand(1);
+
+	for (trial = 0; trial < 20000; trial++) {
+		n = rand() % sizeof(s);
+		for (i = 0; i < n; i++) {
+			if (rand() % 8)
+				s[i] = alphabet[rand() % 11];
+			else
+				s[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+		}
+		check(s, n);
+	}
+
+	assert(coho_smiles_scan(&sc, "C[NH4+]C(=O)c1ccccc1", 0) == COHO_OK);
+	assert(sc.illegal == -1);
+	assert(sc.atoms == 10);
+	assert(sc.rings == 2);
+	assert(sc.parens == 1);
+
+	assert(coho_smiles_scan(&sc, "CCO ethanol", 0) == COHO_ERROR);
+	assert(sc.illegal == 3);
+
+	/* Masks not asked for are left alone. */
+	memset(&out, 0, sizeof(out));
+	out.rings = rings;
+	assert(coho_smiles_scan_masks(&sc, "C[NH4+]C(=O)c1ccccc1", 0, &out) ==
+	    COHO_OK);
+	assert(rings[0] == (1UL << 13 | 1UL << 19));
+	assert(sc.rings == 2);
+
+	return 0;
+}
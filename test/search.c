@@ -0,0 +1,224 @@
+/*
+ * Checks similarity search against a search of every fingerprint.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+
+#define LENGTH	1000
+#define WORDS	COHO_FINGERPRINT_WORDS(LENGTH)
+#define COUNT	3000
+
+static const char *molecules[] = {
+	"CCO",
+	"CCCO",
+	"c1ccccc1",
+	"c1ccccc1O",
+	"CC(=O)Oc1ccccc1C(=O)O",
+	"OC(=O)c1ccccc1O",
+	"C[C@H](N)C(=O)O",
+	"CN1C=NC2=C1C(=O)N(C(=O)N2C)C",
+};
+
+static unsigned long long fingerprints[COUNT * WORDS];
+
+static unsigned long long next_random(void)
+{
+	static unsigned long long x = 88172645463325252ULL;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+static int popcount(unsigned long long x)
+{
+	int n = 0;
+
+	for (; x != 0; x &= x - 1)
+		n++;
+	return n;
+}
+
+/*
+ * Returns the similarity of fingerprints p and q.
+ */
+static double similarity(const unsigned long long *p,
+    const unsigned long long *q)
+{
+	int i, a = 0, b = 0, c = 0;
+
+	for (i = 0; i < WORDS; i++) {
+		a += popcount(p[i]);
+		b += popcount(q[i]);
+		c += popcount(p[i] & q[i]);
+	}
+	return a + b - c > 0 ? (double)c / (a + b - c) : 0;
+}
+
+/*
+ * Returns the number of fingerprints at least threshold similar to q.
+ */
+static size_t count_similar(const unsigned long long *q, double threshold)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < COUNT; i++)
+		n += similarity(q, fingerprints + i * WORDS) >= threshold;
+	return n;
+}
+
+static int compare_hits(const void *p, const void *q)
+{
+	const struct coho_fingerprint_hit *a = p, *b = q;
+
+	if (a->similarity != b->similarity)
+		return a->similarity > b->similarity ? -1 : 1;
+	return a->id < b->id ? -1 : a->id > b->id;
+}
+
+/*
+ * Checks the search of s against the similarities of every fingerprint.
+ */
+static void check(const struct coho_fingerprint_store *s,
+    const unsigned long long *query, double threshold, size_t k,
+    int nthreads)
+{
+	static struct coho_fingerprint_hit all[COUNT];
+	struct coho_fingerprint_hits hits;
+	size_t i, n = 0;
+	double t;
+
+	for (i = 0; i < COUNT; i++) {
+		t = similarity(query, fingerprints + i * WORDS);
+		if (t >= threshold) {
+			all[n].id = i;
+			all[n++].similarity = t;
+		}
+	}
+	qsort(all, n, sizeof(all[0]), compare_hits);
+	if (k > 0 && n > k)
+		n = k;
+
+	coho_fingerprint_hits_init(&hits);
+	assert(coho_fingerprint_search(s, query, threshold, k, nthreads,
+	    &hits) == COHO_OK);
+	assert(hits.count == n);
+	for (i = 0; i < n; i++) {
+		assert(hits.hits[i].id == all[i].id);
+		assert(hits.hits[i].similarity == all[i].similarity);
+	}
+	coho_fingerprint_hits_free(&hits);
+}
+
+int main(void)
+{
+	struct coho_fingerprint f;
+	struct coho_fingerprint_store s, m;
+	struct coho_smiles_batch b;
+	size_t i, j, k, n, count = sizeof(molecules) / sizeof(molecules[0]);
+	char path[] = "/tmp/coho-search-XXXXXX";
+	const unsigned long long *q;
+	int fd, best, kernel, density;
+	FILE *fp;
+
+	/* Fingerprints of molecules, then random ones of varied density. */
+	coho_smiles_batch_init(&b);
+	assert(coho_smiles_read_batch_array(&b, molecules, NULL, count) ==
+	    COHO_OK);
+	coho_fingerprint_init(&f, 2, LENGTH);
+	assert(coho_fingerprint_batch(&f, &b, 0, count, fingerprints) ==
+	    COHO_OK);
+	coho_fingerprint_free(&f);
+	coho_smiles_batch_free(&b);
+	for (i = count; i < COUNT; i++) {
+		density = i % 7;
+		for (j = 0; j < WORDS; j++) {
+			fingerprints[i * WORDS + j] = next_random();
+			if (density < 6)
+				fingerprints[i * WORDS + j] &= next_random();
+			if (density < 3)
+				fingerprints[i * WORDS + j] &= next_random();
+		}
+		fingerprints[i * WORDS + WORDS - 1] &= (1ULL << LENGTH % 64) - 1;
+	}
+	/* Near copies of the first molecule. */
+	for (i = count; i < count + 20; i++) {
+		memcpy(fingerprints + i * WORDS, fingerprints, WORDS * 8);
+		fingerprints[i * WORDS + i % WORDS] ^= 1ULL << i % 64;
+	}
+
+	coho_fingerprint_store_init(&s);
+	assert(coho_fingerprint_store_build(&s, fingerprints, COUNT,
+	    LENGTH) == COHO_OK);
+	assert(s.count == COUNT);
+	assert(s.stride % 8 == 0);
+	assert((uintptr_t)s.fingerprints % 64 == 0);
+	assert(s.offsets[0] == 0 && s.offsets[LENGTH + 1] == COUNT);
+	for (i = 0; i <= LENGTH; i++) {
+		for (j = s.offsets[i]; j < s.offsets[i + 1]; j++) {
+			for (k = 0, n = 0; k < s.stride; k++)
+				n += popcount(s.fingerprints[j * s.stride + k]);
+			assert(n == i);
+			assert(j == s.offsets[i] || s.ids[j - 1] < s.ids[j]);
+		}
+	}
+
+	/* Each kernel up to the best the CPU supports. */
+	best = s.kernel;
+	for (kernel = COHO_FINGERPRINT_KERNEL_SCALAR; kernel <= best;
+	    kernel++) {
+		s.kernel = kernel;
+		for (i = 0; i < 12; i++) {
+			q = fingerprints + (i * 251 % COUNT) * WORDS;
+			if (i < count)
+				q = fingerprints + i * WORDS;
+			check(&s, q, 0.7, 0, 1);
+			check(&s, q, 0.3, 0, 3);
+			check(&s, q, 0, 10, 1);
+			check(&s, q, 0, 10, 4);
+			check(&s, q, 0.5, 100, 2);
+			check(&s, q, 1, 0, 1);
+		}
+	}
+	s.kernel = best;
+	assert(count_similar(fingerprints, 0.7) > 20);
+	check(&s, fingerprints, 0, 0, 1);
+	check(&s, fingerprints, 0, 1, 16);
+
+	/* A written store maps back unchanged. */
+	assert((fd = mkstemp(path)) != -1);
+	close(fd);
+	assert(coho_fingerprint_store_write(&s, path) == 0);
+	coho_fingerprint_store_init(&m);
+	assert(coho_fingerprint_store_open(&m, path) == 0);
+	assert(m.is_mapped);
+	assert(m.count == s.count && m.length == s.length);
+	assert((uintptr_t)m.fingerprints % 64 == 0);
+	assert(memcmp(m.fingerprints, s.fingerprints,
+	    s.count * s.stride * 8) == 0);
+	check(&m, fingerprints + 3 * WORDS, 0.7, 0, 2);
+	check(&m, fingerprints + 3 * WORDS, 0, 5, 2);
+	coho_fingerprint_store_free(&m);
+
+	/* A truncated file is rejected. */
+	assert((fp = fopen(path, "r+b")) != NULL);
+	assert(ftruncate(fileno(fp), 4096) == 0);
+	fclose(fp);
+	assert(coho_fingerprint_store_open(&m, path) == -1);
+	assert(errno == EINVAL);
+	unlink(path);
+
+	coho_fingerprint_store_free(&s);
+	return 0;
+}
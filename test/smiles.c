@@ -1,5 +1,8 @@
 #include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "coho.h"
 
@@ -11,9 +14,298 @@ static void check_cnts(struct coho_smiles *x, const char *smi, int acnt,
 	assert(x->bond_count == bcnt);
 }
 
+/*
+ * Checks the neighbors of atom i against the n atoms that follow.
+ */
+static void check_neighbors(struct coho_smiles *x, int i, int n, ...)
+{
+	va_list ap;
+	int j, k;
+
+	assert(x->neighbor_offsets[i + 1] - x->neighbor_offsets[i] == n);
+
+	va_start(ap, n);
+	for (j = x->neighbor_offsets[i]; j < x->neighbor_offsets[i + 1]; j++) {
+		k = va_arg(ap, int);
+		assert(x->neighbor_atoms[j] == k);
+		assert(x->bonds[x->neighbor_bonds[j]].atom0 == (i < k ? i : k));
+		assert(x->bonds[x->neighbor_bonds[j]].atom1 == (i < k ? k : i));
+	}
+	va_end(ap);
+}
+
+/*
+ * Checks that the bond list is sorted by atom0 and then atom1.
+ */
+static void check_bond_order(struct coho_smiles *x)
+{
+	int i;
+
+	for (i = 1; i < x->bond_count; i++) {
+		assert(x->bonds[i-1].atom0 <= x->bonds[i].atom0);
+		if (x->bonds[i-1].atom0 == x->bonds[i].atom0)
+			assert(x->bonds[i-1].atom1 < x->bonds[i].atom1);
+	}
+}
+
+/*
+ * Checks that x, after coho_smiles_finish() returned rc, holds the same
+ * results as y.
+ */
+static void check_same(struct coho_smiles *x, int rc, struct coho_smiles *y,
+    int want)
+{
+	int i;
+
+	assert(rc == want);
+	assert(x->error_position == y->error_position);
+	assert(strcmp(x->error, y->error) == 0);
+	if (rc != COHO_OK)
+		return;
+
+	assert(x->atom_count == y->atom_count);
+	assert(x->bond_count == y->bond_count);
+	for (i = 0; i < x->atom_count; i++) {
+		assert(x->atoms[i].atomic_number == y->atoms[i].atomic_number);
+		assert(x->atoms[i].position == y->atoms[i].position);
+		assert(x->atoms[i].length == y->atoms[i].length);
+		assert(x->atoms[i].implicit_hydrogen_count ==
+		    y->atoms[i].implicit_hydrogen_count);
+	}
+	for (i = 0; i < x->bond_count; i++) {
+		assert(x->bonds[i].atom0 == y->bonds[i].atom0);
+		assert(x->bonds[i].atom1 == y->bonds[i].atom1);
+		assert(x->bonds[i].order == y->bonds[i].order);
+		assert(x->bonds[i].is_ring == y->bonds[i].is_ring);
+	}
+	for (i = 0; i <= x->atom_count; i++)
+		assert(x->neighbor_offsets[i] == y->neighbor_offsets[i]);
+}
+
+/*
+ * Checks that feeding smi in two pieces, split anywhere, or a byte at a
+ * time gives the same results as reading it whole.
+ */
+static void check_feed(struct coho_smiles *x, const char *smi)
+{
+	struct coho_smiles y;
+	size_t i, n = strlen(smi);
+	int want;
+
+	coho_smiles_init(&y);
+	want = coho_smiles_read(&y, smi, n);
+
+	for (i = 0; i <= n; i++) {
+		coho_smiles_feed(x, smi, i);
+		coho_smiles_feed(x, smi + i, n - i);
+		check_same(x, coho_smiles_finish(x), &y, want);
+	}
+
+	for (i = 0; i < n; i++)
+		coho_smiles_feed(x, smi + i, 1);
+	check_same(x, coho_smiles_finish(x), &y, want);
+
+	coho_smiles_free(&y);
+}
+
+/*
+ * Checks that validating smi reports the same result as reading it.
+ */
+static void check_validate(struct coho_smiles *x, const char *smi)
+{
+	char error[sizeof(x->error)];
+	int rc, position;
+
+	rc = coho_smiles_read(x, smi, 0);
+	position = x->error_position;
+	strcpy(error, x->error);
+
+	assert(coho_smiles_validate(x, smi, 0) == rc);
+	assert(x->error_position == position);
+	assert(strcmp(x->error, error) == 0);
+	assert(x->atom_count == 0 || rc != COHO_OK);
+}
+
+/*
+ * Deletes, inserts or replaces a byte of the string at smi at random,
+ * using and advancing the random state *r.
+ */
+static void mutate(char *smi, uint64_t *r)
+{
+	static const char alphabet[] = "CNOScnos1209%()[]=#$:.-/\\@H+*BrCl7";
+	size_t len = strlen(smi), pos;
+
+	*r = *r * 6364136223846793005ULL + 1442695040888963407ULL;
+	pos = (*r >> 33) % (len + 1);
+	switch ((*r >> 20) % 3) {
+	case 0:
+		if (pos < len) {
+			memmove(smi + pos, smi + pos + 1, len - pos);
+			len--;
+		}
+		return;
+	case 1:
+		memmove(smi + pos + 1, smi + pos, len - pos + 1);
+		len++;
+		break;
+	}
+	if (pos < len)
+		smi[pos] = alphabet[(*r >> 40) % (sizeof(alphabet) - 1)];
+}
+
+/*
+ * Checks validation against reading over strings made by mutating each
+ * of the n strings of seeds a few times.
+ * Since coho_smiles_validate() has a grammar of its own for valid
+ * strings, this is what keeps the two in step.
+ */
+static void check_validate_mutations(struct coho_smiles *x,
+    const char *const *seeds, size_t n)
+{
+	uint64_t r = 1;
+	char smi[128];
+	size_t i, len;
+	int k, m;
+
+	for (i = 0; i < n; i++) {
+		if ((len = strlen(seeds[i])) >= sizeof(smi) - 8)
+			continue;
+		for (k = 0; k < 500; k++) {
+			memcpy(smi, seeds[i], len + 1);
+			for (m = 0; m < 1 + k % 4; m++)
+				mutate(smi, &r);
+			check_validate(x, smi);
+		}
+	}
+}
+
+struct events {
+	struct coho_smiles_atom atoms[64];
+	struct coho_smiles_bond bonds[64];
+	int atom_count;
+	int bond_count;
+	int rings;
+	int branches;
+	int components;
+	int stop_at;
+};
+
+static int on_atom(void *ud, const struct coho_smiles_atom *a, int i)
+{
+	struct events *e = ud;
+
+	assert(i == e->atom_count);
+	e->atoms[e->atom_count++] = *a;
+	return e->atom_count == e->stop_at;
+}
+
+static int on_bond(void *ud, const struct coho_smiles_bond *b)
+{
+	struct events *e = ud;
+	int i;
+
+	/* Keep the bonds in the order of the bond list. */
+	for (i = e->bond_count++; i > 0; i--) {
+		if (e->bonds[i - 1].atom0 < b->atom0 ||
+		    (e->bonds[i - 1].atom0 == b->atom0 &&
+		    e->bonds[i - 1].atom1 < b->atom1))
+			break;
+		e->bonds[i] = e->bonds[i - 1];
+	}
+	e->bonds[i] = *b;
+	return 0;
+}
+
+static int on_ring_open(void *ud, int n, const struct coho_smiles_bond *b)
+{
+	struct events *e = ud;
+
+	(void)n;
+	assert(b->atom0 == e->atom_count - 1);
+	e->rings++;
+	return 0;
+}
+
+static int on_branch_open(void *ud, int atom)
+{
+	struct events *e = ud;
+
+	assert(atom < e->atom_count);
+	e->branches++;
+	return 0;
+}
+
+static int on_branch_close(void *ud, int atom)
+{
+	struct events *e = ud;
+
+	assert(atom < e->atom_count);
+	e->branches--;
+	return 0;
+}
+
+static int on_component(void *ud, int atom)
+{
+	struct events *e = ud;
+
+	assert(atom == e->atom_count);
+	e->components++;
+	return 0;
+}
+
+/*
+ * Checks that the events of smi describe the same atoms and bonds as
+ * reading it, and returns the number of components.
+ */
+static int check_events(struct coho_smiles *x, const char *smi)
+{
+	struct coho_smiles_handler h = {NULL, on_atom, on_bond, on_ring_open,
+	    on_branch_open, on_branch_close, on_component};
+	struct events e;
+	int i;
+
+	memset(&e, 0, sizeof(e));
+	h.ud = &e;
+	assert(coho_smiles_read_events(x, smi, 0, &h) == COHO_OK);
+	assert(x->atom_count == 0);
+	assert(e.branches == 0);
+
+	assert(coho_smiles_read(x, smi, 0) == COHO_OK);
+	assert(e.atom_count == x->atom_count);
+	assert(e.bond_count == x->bond_count);
+	for (i = 0; i < x->atom_count; i++) {
+		assert(e.atoms[i].atomic_number == x->atoms[i].atomic_number);
+		assert(e.atoms[i].position == x->atoms[i].position);
+	}
+	for (i = 0; i < x->bond_count; i++) {
+		assert(e.bonds[i].atom0 == x->bonds[i].atom0);
+		assert(e.bonds[i].atom1 == x->bonds[i].atom1);
+		assert(e.bonds[i].order == x->bonds[i].order);
+		assert(e.bonds[i].stereo == x->bonds[i].stereo);
+		assert(e.bonds[i].is_ring == x->bonds[i].is_ring);
+		e.rings -= e.bonds[i].is_ring;
+	}
+	assert(e.rings == 0);
+	return e.components;
+}
+
 int main(void)
 {
+	struct coho_smiles_handler h;
 	struct coho_smiles x;
+	struct events e;
+	const char *feed[] = {
+		"CC", "C1.C1", "[*].C", "Clc1ccccc1Br", "C1CC(N)(O)C1",
+		"N[C@@H]1(O)CC1", "C1CC2CC3CC4CC5CC%10CC5CC4CC3CC2CC1%10",
+		"C%(100)CC%(100)", "C=%(99999)CC%(99999)", "[NH4+].[Cl-]",
+		"[13CH3:7]/C=C\\[Fe@TH2]", "OC(=O)c1ccc[nH]1",
+		"C(C(C(C(C(C(C(C(C(C(C(C(C(C(C(C(C))))))))))))))))CCCCCCCCCC",
+		"", "C12CCCCC12", "CC1C1", "C%(12C", "C((C)", "C)", "[Cl",
+		"C[Xx]", "C=", "C..C", "Cl(", "AsC", "C1CC",
+	};
+	char big[600];
+	size_t i, k, n;
+	int atoms;
 
 	coho_smiles_init(&x);
 
@@ -35,6 +327,145 @@ int main(void)
 	assert(coho_smiles_read(&x, "[,*](C)^", 0) == COHO_ERROR);
 	assert(x.error_position == 1);
 
+	check_cnts(&x, "C1CC(N)(O)C1", 6, 6);
+	check_neighbors(&x, 0, 2, 5, 1);
+	check_neighbors(&x, 2, 4, 1, 3, 4, 5);
+	check_neighbors(&x, 5, 2, 2, 0);
+	check_cnts(&x, "N[C@@H]1(O)CC1", 5, 5);
+	check_neighbors(&x, 1, 4, 0, 4, 2, 3);
+	assert(x.atoms[1].implicit_hydrogen_count == -1);
+	assert(x.atoms[3].implicit_hydrogen_count == 2);
+
+	check_cnts(&x, "C1CC2CC3CC4CC5CC%10CC5CC4CC3CC2CC1%10", 21, 26);
+	check_bond_order(&x);
+	check_neighbors(&x, 0, 2, 20, 1);
+	check_neighbors(&x, 20, 3, 19, 0, 10);
+	assert(coho_smiles_read(&x, "C12CCCCC12", 0) == COHO_ERROR);
+	assert(x.error_position == 2);
+	assert(coho_smiles_read(&x, "CC1C1", 0) == COHO_ERROR);
+	assert(x.error_position == 5);
+
+	check_cnts(&x, "C%(100)CC%(100)", 3, 3);
+	assert(x.bonds[1].atom0 == 0 && x.bonds[1].atom1 == 2);
+	assert(x.bonds[1].is_ring == 1);
+	check_cnts(&x, "C=%(99999)CC%(99999)", 3, 3);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_DOUBLE);
+	check_cnts(&x, "C%(5)CC5", 3, 3);
+
+	/* Ring bonds between aromatic atoms are aromatic unless marked. */
+	check_cnts(&x, "c1ccccc1", 6, 6);
+	assert(x.bonds[1].atom1 == 5 && x.bonds[1].is_ring == 1);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_AROMATIC);
+	check_cnts(&x, "c%(100)ccccc%(100)", 6, 6);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_AROMATIC);
+	check_cnts(&x, "c1ccccc-1", 6, 6);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_SINGLE);
+	check_cnts(&x, "c1ccccC1", 6, 6);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_SINGLE);
+	check_cnts(&x, "C1ccccc1", 6, 6);
+	assert(x.bonds[1].order == COHO_SMILES_BOND_SINGLE);
+	assert(coho_smiles_read(&x, "C%(123456)C", 0) == COHO_ERROR);
+	assert(x.error_position == 3);
+	assert(coho_smiles_read(&x, "C%(12C", 0) == COHO_ERROR);
+	assert(x.error_position == 5);
+	assert(coho_smiles_read(&x, "C%(101)C%(100)", 0) == COHO_ERROR);
+	assert(x.error_position == 8);
+	assert(coho_smiles_read(&x, "C%(100)C1", 0) == COHO_ERROR);
+	assert(x.error_position == 8);
+	check_cnts(&x, "C1CC1", 3, 3);
+	check_cnts(&x, "[Cd+2].[Nd].[Og].C[Mc]S(=O)(=O)[Ts]", 9, 5);
+	assert(x.atoms[0].atomic_number == 48);
+	assert(x.atoms[1].atomic_number == 60);
+	assert(x.atoms[2].atomic_number == 118);
+	assert(x.atoms[3].implicit_hydrogen_count == 3);
+	assert(x.atoms[4].atomic_number == 115);
+	assert(x.atoms[5].implicit_hydrogen_count == 0);
+	assert(x.atoms[8].atomic_number == 117);
+	check_cnts(&x, "Cl[Pt](Cl)([NH3])[NH3]", 5, 4);
+	assert(x.atoms[1].atomic_number == 78);
+	assert(x.atoms[0].implicit_hydrogen_count == 0);
+
+	x.flags |= COHO_SMILES_PRESCAN;
+	check_cnts(&x, "C[NH4+]C(=O)c1ccccc1", 10, 10);
+	assert(coho_smiles_read(&x, "C(C)C ethane", 0) == COHO_ERROR);
+	assert(x.error_position == 5);
+	x.flags &= ~COHO_SMILES_PRESCAN;
+
+	x.flags = COHO_SMILES_NO_SPANS | COHO_SMILES_NO_SYMBOLS |
+	    COHO_SMILES_NO_CHIRALITY | COHO_SMILES_NO_HYDROGENS;
+	check_cnts(&x, "N[C@@H]1(O)CC1", 5, 5);
+	check_neighbors(&x, 1, 4, 0, 4, 2, 3);
+	assert(x.atoms[1].atomic_number == 6);
+	assert(x.atoms[1].symbol[0] == '\0');
+	assert(x.atoms[1].chirality[0] == '\0');
+	assert(x.atoms[1].position == -1 && x.atoms[1].length == 0);
+	assert(x.atoms[3].implicit_hydrogen_count == -1);
+	assert(x.bonds[0].position == -1 && x.bonds[0].length == 0);
+	assert(coho_smiles_read(&x, "C12CCCCC12", 0) == COHO_ERROR);
+	assert(x.error_position == 2);
+	assert(coho_smiles_read(&x, "CC1C1", 0) == COHO_ERROR);
+	assert(x.error_position == 5);
+	x.flags |= COHO_SMILES_PACKED;
+	check_cnts(&x, "C[NH4+]", 2, 1);
+	assert(x.atoms[1].position == 1 && x.atoms[1].length == 6);
+	x.flags = 0;
+
+	for (i = 0; i < sizeof(feed) / sizeof(feed[0]); i++) {
+		check_feed(&x, feed[i]);
+		check_validate(&x, feed[i]);
+	}
+	check_validate(&x, "C1(C)C1");
+	check_validate(&x, "C%(100)C%(100)(C%(101)=C%(101))C%(100)");
+	check_validate(&x, "C=1CC-1");
+	check_validate_mutations(&x, feed, sizeof(feed) / sizeof(feed[0]));
+
+	/* Longer than the inline storage, so the arrays grow mid-string. */
+	big[0] = '\0';
+	for (i = 0; i < 50; i++)
+		strcat(big, i % 2 ? "C1CC(O)C1" : "c2cc[nH]c2");
+	check_feed(&x, big);
+	check_validate(&x, big);
+
+	/* Only bytes not yet parsed are kept, unless packing needs them. */
+	n = strlen(big);
+	assert(coho_smiles_read(&x, big, n) == COHO_OK);
+	atoms = x.atom_count;
+	for (k = 0; k < 2; k++) {
+		x.flags = k ? COHO_SMILES_PACKED : 0;
+		coho_smiles_shrink(&x);
+		for (i = 0; i < 20 * n; i += 5)
+			assert(coho_smiles_feed(&x, big + i % n, 5) == COHO_OK);
+		assert(k ? x.stream_cap >= 20 * n : x.stream_cap <= 16);
+		assert(coho_smiles_finish(&x) == COHO_OK);
+		assert(x.atom_count == 20 * atoms);
+	}
+	x.flags = 0;
+
+	assert(check_events(&x, "Clc1ccccc1Br") == 1);
+	assert(check_events(&x, "C1CC(N)(O)C1.[NH4+].c1cc2ccccc2cc1") == 3);
+	assert(check_events(&x, "C(\\F)=C/F.C%(100)CC%(100)") == 2);
+	assert(check_events(&x, "c1ccccc1-c1ccccc1C(c2ccccc2)(=O)") == 1);
+
+	/* A handler can stop the parse. */
+	memset(&h, 0, sizeof(h));
+	memset(&e, 0, sizeof(e));
+	h.ud = &e;
+	h.on_atom = on_atom;
+	e.stop_at = 3;
+	assert(coho_smiles_read_events(&x, "CCOCC", 0, &h) == COHO_STOPPED);
+	assert(e.atom_count == 3);
+	assert(x.error_position == 3);
+
+	/* Feeding stops at an error until the string is finished. */
+	assert(coho_smiles_feed(&x, "C(", 2) == COHO_OK);
+	assert(coho_smiles_feed(&x, ")C", 2) == COHO_ERROR);
+	assert(coho_smiles_feed(&x, "C", 1) == COHO_ERROR);
+	assert(coho_smiles_finish(&x) == COHO_ERROR);
+	assert(x.error_position == 2);
+	assert(coho_smiles_feed(&x, "CCO", 3) == COHO_OK);
+	assert(coho_smiles_finish(&x) == COHO_OK);
+	assert(x.atom_count == 3);
+
 	coho_smiles_free(&x);
 	return 0;
 }
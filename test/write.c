@@ -0,0 +1,195 @@
+/*
+ * Checks writing of SMILES, in the order read and canonically.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coho.h"
+#include "counter.h"
+
+/*
+ * Spellings of the same molecules, each list ending with NULL.
+ */
+static const char *same[][6] = {
+	{"CCO", "OCC", "C(O)C", "[CH3][CH2][OH]", NULL},
+	{"c1ccccc1", "c:1:c:c:c:c:c1", "c1ccccc:1", NULL},
+	{"OC(=O)c1ccccc1", "c1ccccc1C(O)=O", "c1cc(C(=O)O)ccc1",
+	    "O=C(O)c1ccccc1", NULL},
+	{"CC(=O)Oc1ccccc1C(=O)O", "OC(=O)c1ccccc1OC(C)=O",
+	    "c1cccc(OC(=O)C)c1C(O)=O", NULL},
+	{"C[C@H](N)C(=O)O", "N[C@@H](C)C(=O)O", "OC(=O)[C@@H](N)C",
+	    "[C@@H](C)(N)C(=O)O", "C[C@@H](C(=O)O)N", NULL},
+	{"F/C=C/F", "F\\C=C\\F", "C(\\F)=C/F", NULL},
+	{"F/C=C\\F", "F\\C=C/F", "C(/F)=C/F", NULL},
+	{"[Na+].[Cl-]", "[Cl-].[Na+]", NULL},
+	{"C1CC2CCC1CC2", "C12CCC(CC1)CC2", "C1(CC2)CCC2CC1", NULL},
+	{"c1ccc2[nH]ccc2c1", "c1cc2cc[nH]c2cc1", "[nH]1ccc2ccccc12", NULL},
+	/* meso compounds */
+	{"C[C@H](Cl)[C@@H](C)Cl", "C[C@@H](Cl)[C@H](C)Cl", NULL},
+	{"O[C@H](C(=O)O)[C@@H](O)C(=O)O", "O[C@@H](C(=O)O)[C@H](O)C(=O)O",
+	    NULL},
+	{"C[C@H]1CC[C@@H](C)CC1", "C[C@@H]1CC[C@H](C)CC1", NULL},
+};
+
+/*
+ * Molecules with their canonical strings.
+ */
+static const char *canonical[][2] = {
+	{"OCC", "CCO"},
+	{"[CH4]", "C"},
+	{"[13CH4]", "[13CH4]"},
+	{"C1CC1C1CC1", "C1CC1C1CC1"},
+	{"c1ccccc1-c1ccccc1", "c1ccc(cc1)-c1ccccc1"},
+	{"[O-][n+]1ccccc1", "[O-][n+]1ccccc1"},
+	{"[NH4+]", "[NH4+]"},
+	{"[Fe+2]", "[Fe+2]"},
+	{"O=[CH2:7]", "[CH2:7]=O"},
+	{"C%10CC%10", "C1CC1"},
+};
+
+/*
+ * Molecules with the strings they are written as in the order read.
+ */
+static const char *written[][2] = {
+	{"OCC", "OCC"},
+	{"C(C)(C)O", "C(C)(C)O"},
+	{"[CH4]", "C"},
+	{"[13CH3][C@@H](F)Cl", "[13CH3][C@@H](F)Cl"},
+	{"N[C@](C)(F)C(=O)O", "N[C@](C)(F)C(=O)O"},
+	{"[C@@H]1(F)CCC1", "[C@@H]1(F)CCC1"},
+	{"F\\C=C\\F", "F\\C=C\\F"},
+	{"C(\\F)=C/F", "C(\\F)=C/F"},
+	{"[O-][n+]1ccccc1", "[O-][n+]1ccccc1"},
+	{"C%10CC%10", "C1CC1"},
+	{"c1ccccc1-c1ccccc1", "c1ccccc1-c1ccccc1"},
+	{"[Na+].[Cl-]", "[Na+].[Cl-]"},
+	{"[2H]O[2H]", "[2H]O[2H]"},
+	{"[Fe+2].[OH-:3]", "[Fe+2].[OH-:3]"},
+	{"C1CC2CCC1CC2", "C1CC2CCC1CC2"},
+};
+
+/*
+ * Writes smi as canonical SMILES to w, checking that it reads back to
+ * the same string.
+ */
+static void write(struct coho_smiles_writer *w, struct coho_smiles *x,
+    const char *smi)
+{
+	char buf[256];
+
+	assert(coho_smiles_read(x, smi, strlen(smi)) == COHO_OK);
+	assert(coho_smiles_write_canonical(w, x) == COHO_OK);
+	assert(w->length == strlen(w->smiles));
+	assert(w->length < sizeof(buf));
+	strcpy(buf, w->smiles);
+
+	assert(coho_smiles_read(x, buf, w->length) == COHO_OK);
+	assert(coho_smiles_write_canonical(w, x) == COHO_OK);
+	assert(strcmp(w->smiles, buf) == 0);
+}
+
+/*
+ * Writes smi in the order read, checking that the string reads back to
+ * the same atoms and the same canonical SMILES.
+ */
+static void write_read(struct coho_smiles_writer *w, struct coho_smiles *x,
+    const char *smi)
+{
+	const struct coho_smiles_atom *a, *b;
+	struct coho_smiles y;
+	char buf[256];
+	int i;
+
+	assert(coho_smiles_read(x, smi, strlen(smi)) == COHO_OK);
+	assert(coho_smiles_write_canonical(w, x) == COHO_OK);
+	strcpy(buf, w->smiles);
+	assert(coho_smiles_write(w, x) == COHO_OK);
+	assert(w->length == strlen(w->smiles));
+
+	coho_smiles_init(&y);
+	assert(coho_smiles_read(&y, w->smiles, w->length) == COHO_OK);
+	assert(y.atom_count == x->atom_count);
+	assert(y.bond_count == x->bond_count);
+	for (i = 0; i < x->atom_count; i++) {
+		a = &x->atoms[i];
+		b = &y.atoms[i];
+		assert(a->atomic_number == b->atomic_number);
+		assert(a->isotope == b->isotope);
+		assert(a->charge == b->charge);
+		assert(a->atom_class == b->atom_class);
+		assert(a->is_aromatic == b->is_aromatic);
+		assert(coho_smiles_hydrogen_count(x, i) ==
+		    coho_smiles_hydrogen_count(&y, i));
+	}
+	assert(coho_smiles_write_canonical(w, &y) == COHO_OK);
+	assert(strcmp(w->smiles, buf) == 0);
+	coho_smiles_free(&y);
+}
+
+int main(void)
+{
+	struct coho_allocator a;
+	struct coho_smiles_writer w;
+	struct counter c;
+	struct coho_smiles x;
+	char first[256];
+	size_t i, k;
+
+	coho_smiles_init(&x);
+	coho_smiles_writer_init(&w);
+
+	for (i = 0; i < sizeof(same) / sizeof(same[0]); i++) {
+		write(&w, &x, same[i][0]);
+		strcpy(first, w.smiles);
+		for (k = 1; same[i][k] != NULL; k++) {
+			write(&w, &x, same[i][k]);
+			assert(strcmp(w.smiles, first) == 0);
+		}
+	}
+
+	for (i = 0; i < sizeof(canonical) / sizeof(canonical[0]); i++) {
+		write(&w, &x, canonical[i][0]);
+		assert(strcmp(w.smiles, canonical[i][1]) == 0);
+	}
+
+	for (i = 0; i < sizeof(written) / sizeof(written[0]); i++) {
+		write_read(&w, &x, written[i][0]);
+		assert(coho_smiles_write(&w, &x) == COHO_OK);
+		assert(strcmp(w.smiles, written[i][1]) == 0);
+	}
+	for (i = 0; i < sizeof(same) / sizeof(same[0]); i++) {
+		for (k = 0; same[i][k] != NULL; k++)
+			write_read(&w, &x, same[i][k]);
+	}
+
+	/* Enantiomers and stereoisomers stay apart. */
+	write(&w, &x, "C[C@@H](N)C(=O)O");
+	strcpy(first, w.smiles);
+	write(&w, &x, same[4][0]);
+	assert(strcmp(w.smiles, first) != 0);
+	write(&w, &x, same[6][0]);
+	strcpy(first, w.smiles);
+	write(&w, &x, same[5][0]);
+	assert(strcmp(w.smiles, first) != 0);
+	coho_smiles_writer_free(&w);
+
+	/* Once warmed up, writing allocates nothing. */
+	counter_init(&c, &a, (size_t)-1);
+	coho_smiles_writer_init_with_allocator(&w, &a);
+	write(&w, &x, same[3][0]);
+	k = c.allocs + c.reallocs;
+	for (i = 0; i < 100; i++) {
+		write(&w, &x, same[i % 4][0]);
+		assert(coho_smiles_write(&w, &x) == COHO_OK);
+	}
+	assert(c.allocs + c.reallocs == k);
+	assert(w.allocator.held > 0);
+	coho_smiles_writer_free(&w);
+	assert(w.allocator.held == 0);
+
+	coho_smiles_free(&x);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * coho-index [-k interval] file ...
+ *
+ * Writes an index of the records of each SMILES file to the file's name
+ * with ".idx" appended.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coho.h"
+
+static void usage(void);
+
+int main(int argc, char *argv[])
+{
+	struct coho_smiles_index idx;
+	char path[4096], *end;
+	unsigned long interval = 1024;
+	int c, i, rc = 0;
+
+	while ((c = getopt(argc, argv, "k:")) != -1) {
+		switch (c) {
+		case 'k':
+			errno = 0;
+			interval = strtoul(optarg, &end, 10);
+			if (errno || *end != '\0' || interval == 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+
+	for (i = 0; i < argc; i++) {
+		if ((size_t)snprintf(path, sizeof(path), "%s.idx", argv[i]) >=
+		    sizeof(path)) {
+			fprintf(stderr, "coho-index: %s: name too long\n",
+			    argv[i]);
+			rc = 1;
+			continue;
+		}
+		if (coho_smiles_index_build(&idx, argv[i], interval) == -1 ||
+		    coho_smiles_index_write(&idx, path) == -1) {
+			fprintf(stderr, "coho-index: %s: %s\n", argv[i],
+			    strerror(errno));
+			rc = 1;
+		} else {
+			printf("%s: %zu records\n", argv[i], idx.records);
+		}
+		coho_smiles_index_free(&idx);
+	}
+	return rc;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: coho-index [-k interval] file ...\n");
+	exit(1);
+}
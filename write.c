@@ -0,0 +1,703 @@
+/*
+ * Copyright (c) 2017-2019 Ben Cornett <ben@lantern.is>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writing of SMILES strings.
+ *
+ * A molecule is written by a depth-first search that starts each
+ * component at its lowest-ranked atom and visits neighbors in order of
+ * rank, atoms being ranked either canonically or in the order they
+ * were read.  A first pass finds the spanning tree and the bonds that close
+ * rings; a second writes atoms, ring bond digits and branches, the last
+ * child of an atom being written without parentheses.  Ring bond digits
+ * are reused once closed, lowest first.
+ *
+ * Reversing every '/' and '\' around a double bond leaves its meaning
+ * unchanged, so when writing canonically the marks of each set of
+ * bonds that bear on the same double bonds are reversed if need be to
+ * make the first one written a '/'.
+ *
+ * Atoms that refinement leaves tied are symmetric, as a rule, so which
+ * of them is ranked first makes no difference, except where stereo
+ * marks tell them apart: in meso compounds, for one, each choice gives
+ * a string that another order of atoms might give instead.  Molecules
+ * with stereo marks are therefore written once for every way of
+ * breaking the ties, up to MAX_TIE_BREAKS, and the smallest string is
+ * kept.
+ *
+ * No string is longer than SMILES_CAP() of its atoms and bonds, so that
+ * much space is reserved up front and writing needs no further checks.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "coho.h"
+#include "internal.h"
+
+#define MAX_RING_DIGIT	99999
+#define MAX_TIE_BREAKS	256
+
+/*
+ * Bytes needed to write a molecule: 32 per atom for its brackets and
+ * their contents, the bond to it and a branch or dot, 20 per bond for
+ * a pair of ring bond digits, and a NUL.
+ */
+#define SMILES_CAP(atoms, bonds)	(32 * (atoms) + 20 * (bonds) + 1)
+
+/*
+ * Scratch arrays of writer w and their lengths (see internal.h).
+ */
+#define ARRAYS(X) \
+	X(w, smiles, SMILES_CAP(w->atoms_cap, w->bonds_cap)) \
+	X(w, ranks, w->atoms_cap) \
+	X(w, keys, w->atoms_cap) \
+	X(w, order, w->atoms_cap) \
+	X(w, parent_bonds, w->atoms_cap) \
+	X(w, child_counts, w->atoms_cap) \
+	X(w, stack, w->atoms_cap) \
+	X(w, tie_path, w->atoms_cap) \
+	X(w, tie_sizes, w->atoms_cap) \
+	X(w, best_path, w->atoms_cap) \
+	X(w, best, SMILES_CAP(w->atoms_cap, w->bonds_cap)) \
+	X(w, neighbor_atoms, 2 * w->bonds_cap) \
+	X(w, neighbor_bonds, 2 * w->bonds_cap) \
+	X(w, ring_digits, w->bonds_cap) \
+	X(w, digits_used, w->bonds_cap + 1) \
+	X(w, stereo_groups, w->bonds_cap) \
+	X(w, stereo_flips, w->bonds_cap)
+
+static void find_tree(struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+static void free_arrays(struct coho_smiles_writer *);
+static void group_stereo(struct coho_smiles_writer *,
+    const struct coho_smiles *);
+static int has_stereo(const struct coho_smiles *);
+static int odd_chirality(const struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+static char *put_atom(char *, const struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+static char *put_bond(char *, struct coho_smiles_writer *,
+    const struct coho_smiles *, int, int);
+static char *put_int(char *, int);
+static char *put_ring_bonds(char *, struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+static void sort_neighbors(struct coho_smiles_writer *,
+    const struct coho_smiles *);
+static int stereo_group(struct coho_smiles_writer *, int);
+static int write_smiles(struct coho_smiles_writer *,
+    const struct coho_smiles *, int);
+
+/*
+ * Writes x, which must hold a parsed molecule, as SMILES to w->smiles,
+ * keeping the order in which its atoms were read, and its branches and
+ * ring bonds.  The string may still differ from the one read: ring bond
+ * digits are renumbered, and atoms are written in brackets and bond
+ * symbols written only where needed.
+ * Returns COHO_OK, COHO_NOMEM or COHO_ERROR as described for
+ * coho_smiles_write_canonical().
+ */
+int coho_smiles_write(struct coho_smiles_writer *w,
+    const struct coho_smiles *x)
+{
+	int i;
+
+	if (coho_smiles_writer_reserve(w, x->atom_count, x->bond_count))
+		return COHO_NOMEM;
+	for (i = 0; i < x->atom_count; i++) {
+		w->ranks[i] = i;
+		w->order[i] = i;
+	}
+	return write_smiles(w, x, 0);
+}
+
+/*
+ * Writes x, which must hold a parsed molecule, as canonical SMILES to
+ * w->smiles, so that molecules differing only in the order their atoms
+ * were written give the same string.
+ * Returns COHO_OK, COHO_NOMEM if memory could not be allocated, or
+ * COHO_ERROR if the molecule needs more than 99999 ring bond digits at
+ * once.
+ */
+int coho_smiles_write_canonical(struct coho_smiles_writer *w,
+    const struct coho_smiles *x)
+{
+	int i, rc, depth, best_depth, tries;
+
+	if (coho_smiles_writer_reserve(w, x->atom_count, x->bond_count))
+		return COHO_NOMEM;
+	if (!has_stereo(x)) {
+		coho_rank_atoms(w, x, NULL, 0, NULL);
+		return write_smiles(w, x, 1);
+	}
+
+	/*
+	 * Count through the choices of tie-break like an odometer, the
+	 * deepest level turning fastest.  Changing a choice can change
+	 * the ties below it, so those start again from 0.
+	 */
+	depth = coho_rank_atoms(w, x, NULL, 0, w->tie_sizes);
+	memset(w->tie_path, 0, depth * sizeof(w->tie_path[0]));
+	best_depth = -1;
+	for (tries = 1; ; tries++) {
+		if ((rc = write_smiles(w, x, 1)) != COHO_OK)
+			return rc;
+		if (best_depth < 0 || strcmp(w->smiles, w->best) < 0) {
+			memcpy(w->best, w->smiles, w->length + 1);
+			memcpy(w->best_path, w->tie_path,
+			    depth * sizeof(w->tie_path[0]));
+			best_depth = depth;
+		}
+		if (tries == MAX_TIE_BREAKS)
+			break;
+		for (i = depth - 1;
+		    i >= 0 && w->tie_path[i] + 1 == w->tie_sizes[i]; i--)
+			;
+		if (i < 0)
+			break;
+		w->tie_path[i]++;
+		depth = coho_rank_atoms(w, x, w->tie_path, i + 1,
+		    w->tie_sizes);
+		memset(w->tie_path + i + 1, 0,
+		    (depth - i - 1) * sizeof(w->tie_path[0]));
+	}
+
+	/* The ranks are left as for the string written. */
+	if (depth != best_depth || memcmp(w->tie_path, w->best_path,
+	    depth * sizeof(w->tie_path[0])) != 0) {
+		coho_rank_atoms(w, x, w->best_path, best_depth, NULL);
+		return write_smiles(w, x, 1);
+	}
+	return COHO_OK;
+}
+
+void coho_smiles_writer_free(struct coho_smiles_writer *w)
+{
+	free_arrays(w);
+}
+
+void coho_smiles_writer_init(struct coho_smiles_writer *w)
+{
+	struct coho_allocator a;
+
+	coho_allocator_init(&a);
+	coho_smiles_writer_init_with_allocator(w, &a);
+}
+
+/*
+ * Initializes a writer that obtains all of its memory from allocator.
+ */
+void coho_smiles_writer_init_with_allocator(struct coho_smiles_writer *w,
+    const struct coho_allocator *allocator)
+{
+	w->allocator = *allocator;
+	w->allocator.held = 0;
+	w->length = 0;
+	w->atoms_cap = 0;
+	w->bonds_cap = 0;
+
+	ARRAYS(SCRATCH_INIT)
+}
+
+/*
+ * Ensures that the writer has room for a molecule of the given numbers
+ * of atoms and bonds.
+ * Returns 0 on success or -1 if memory could not be allocated, in which
+ * case the writer holds no memory.
+ */
+int coho_smiles_writer_reserve(struct coho_smiles_writer *w, size_t atoms,
+    size_t bonds)
+{
+	size_t atoms_cap, bonds_cap;
+
+	if (atoms <= w->atoms_cap && bonds <= w->bonds_cap && w->smiles != NULL)
+		return 0;
+
+	atoms_cap = coho_scratch_cap(w->atoms_cap, atoms);
+	bonds_cap = coho_scratch_cap(w->bonds_cap, bonds);
+	free_arrays(w);
+	w->atoms_cap = atoms_cap;
+	w->bonds_cap = bonds_cap;
+	ARRAYS(SCRATCH_ALLOC)
+	w->smiles[0] = '\0';
+	return 0;
+
+fail:
+	free_arrays(w);
+	return -1;
+}
+
+/*
+ * Finds the spanning tree of the depth-first search, setting the parent
+ * bond and number of children of each atom, and marks the ring bonds.
+ * Unless canonical is set, bonds read as ring bonds stay ring bonds, so
+ * that branches are written as they were read.
+ */
+static void find_tree(struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int canonical)
+{
+	struct coho_smiles_write_frame *f;
+	int i, j, r, top, v, u, b;
+
+	for (i = 0; i < x->atom_count; i++) {
+		w->parent_bonds[i] = -2;
+		w->child_counts[i] = 0;
+	}
+	for (i = 0; i < x->bond_count; i++)
+		w->ring_digits[i] = -2;
+
+	for (r = 0; r < x->atom_count; r++) {
+		v = w->order[r];
+		if (w->parent_bonds[v] != -2)
+			continue;
+		w->parent_bonds[v] = -1;
+		top = 0;
+		w->stack[0].atom = v;
+		w->stack[0].next = x->neighbor_offsets[v];
+
+		while (top >= 0) {
+			f = &w->stack[top];
+			v = f->atom;
+			if (f->next == x->neighbor_offsets[v + 1]) {
+				top--;
+				continue;
+			}
+			j = f->next++;
+			u = w->neighbor_atoms[j];
+			b = w->neighbor_bonds[j];
+			if (b == w->parent_bonds[v])
+				continue;
+			if (w->parent_bonds[u] == -2 &&
+			    (canonical || !x->bonds[b].is_ring)) {
+				w->parent_bonds[u] = b;
+				w->ring_digits[b] = -1;
+				w->child_counts[v]++;
+				f = &w->stack[++top];
+				f->atom = u;
+				f->next = x->neighbor_offsets[u];
+			} else if (w->ring_digits[b] == -2) {
+				w->ring_digits[b] = 0;
+			}
+		}
+	}
+}
+
+static void free_arrays(struct coho_smiles_writer *w)
+{
+	ARRAYS(SCRATCH_FREE)
+	w->atoms_cap = 0;
+	w->bonds_cap = 0;
+	w->length = 0;
+}
+
+/*
+ * Puts the single bonds with stereo marks next to the same double bond
+ * in the same group, so that their marks are reversed together.
+ */
+static void group_stereo(struct coho_smiles_writer *w,
+    const struct coho_smiles *x)
+{
+	const struct coho_smiles_bond *d;
+	int i, j, k, e, b, first, g;
+
+	for (i = 0; i < x->bond_count; i++) {
+		w->stereo_groups[i] = i;
+		w->stereo_flips[i] = 0;
+	}
+	for (i = 0; i < x->bond_count; i++) {
+		d = &x->bonds[i];
+		if (d->order != COHO_SMILES_BOND_DOUBLE)
+			continue;
+		first = -1;
+		for (k = 0; k < 2; k++) {
+			e = k ? d->atom1 : d->atom0;
+			for (j = x->neighbor_offsets[e];
+			    j < x->neighbor_offsets[e + 1]; j++) {
+				b = x->neighbor_bonds[j];
+				if (x->bonds[b].stereo ==
+				    COHO_SMILES_BOND_STEREO_UNSPECIFIED)
+					continue;
+				if (first == -1) {
+					first = stereo_group(w, b);
+					continue;
+				}
+				if ((g = stereo_group(w, b)) != first)
+					w->stereo_groups[g] = first;
+			}
+		}
+	}
+}
+
+/*
+ * Returns 1 if the neighbors of chiral atom v are written in an order
+ * that is an odd permutation of the order in which they were read, so
+ * that its chirality must be inverted, or else 0.
+ * Neighbors are read in the order of x's neighbor list, with any
+ * hydrogens of the brackets following the preceding atom, or first if
+ * there is none.  They are written with the parent first, then the
+ * hydrogens, ring bonds and children.
+ */
+/*
+ * Returns whether x has chiral atoms or bonds marked '/' or '\'.
+ */
+static int has_stereo(const struct coho_smiles *x)
+{
+	int i;
+
+	for (i = 0; i < x->atom_count; i++)
+		if (x->atoms[i].chirality[0] != '\0')
+			return 1;
+	for (i = 0; i < x->bond_count; i++)
+		if (x->bonds[i].stereo != 0)
+			return 1;
+	return 0;
+}
+
+static int odd_chirality(const struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int v)
+{
+	int in[8], out[8];
+	int i, j, k, b, n = 0, m = 0, odd = 0;
+	int first = x->neighbor_offsets[v], last = x->neighbor_offsets[v + 1];
+	int hydrogens = coho_smiles_hydrogen_count(x, v) > 0;
+
+	if (last - first + hydrogens > 8)
+		return 0;
+
+	/* Hydrogens are represented by -1. */
+	if (first < last && x->neighbor_atoms[first] < v &&
+	    !x->bonds[x->neighbor_bonds[first]].is_ring)
+		in[n++] = x->neighbor_bonds[first++];
+	if (hydrogens)
+		in[n++] = -1;
+	for (i = first; i < last; i++)
+		in[n++] = x->neighbor_bonds[i];
+	first = x->neighbor_offsets[v];
+
+	if (w->parent_bonds[v] >= 0)
+		out[m++] = w->parent_bonds[v];
+	if (hydrogens)
+		out[m++] = -1;
+	for (i = first; i < last; i++) {
+		if (w->ring_digits[w->neighbor_bonds[i]] >= 0)
+			out[m++] = w->neighbor_bonds[i];
+	}
+	for (i = first; i < last; i++) {
+		b = w->neighbor_bonds[i];
+		if (b != w->parent_bonds[v] && w->ring_digits[b] == -1)
+			out[m++] = b;
+	}
+
+	/* Count the pairs whose order differs. */
+	for (i = 0; i < n; i++) {
+		for (j = i + 1; j < n; j++) {
+			for (k = 0; out[k] != in[i] && out[k] != in[j]; k++)
+				;
+			if (out[k] == in[j])
+				odd = !odd;
+		}
+	}
+	return odd;
+}
+
+/*
+ * Writes atom v to p, in brackets unless it is in the organic subset
+ * and has only the hydrogens that implies.
+ * Returns the end of what was written.
+ */
+static char *put_atom(char *p, const struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int v)
+{
+	const struct coho_smiles_atom *a = &x->atoms[v];
+	const char *symbol = coho_smiles_element_symbol(a->atomic_number);
+	int hydrogens = coho_smiles_hydrogen_count(x, v);
+	int chirality = 0;
+
+	if (a->chirality[0] != '\0')
+		chirality = (a->chirality[1] == '@') ^ odd_chirality(w, x, v);
+
+	if (a->isotope < 0 && a->charge == 0 && a->chirality[0] == '\0' &&
+	    a->atom_class < 0 &&
+	    coho_smiles_organic_hydrogen_count(x, v) == hydrogens) {
+		*p++ = a->is_aromatic ? symbol[0] - 'A' + 'a' : symbol[0];
+		if (symbol[1] != '\0')
+			*p++ = symbol[1];
+		return p;
+	}
+
+	*p++ = '[';
+	if (a->isotope >= 0)
+		p = put_int(p, a->isotope);
+	if (a->is_aromatic && symbol[0] >= 'A' && symbol[0] <= 'Z')
+		*p++ = symbol[0] - 'A' + 'a';
+	else
+		*p++ = symbol[0];
+	if (symbol[1] != '\0')
+		*p++ = symbol[1];
+	if (a->chirality[0] != '\0') {
+		*p++ = '@';
+		if (chirality)
+			*p++ = '@';
+	}
+	if (hydrogens > 0) {
+		*p++ = 'H';
+		if (hydrogens > 1)
+			p = put_int(p, hydrogens);
+	}
+	if (a->charge != 0) {
+		*p++ = a->charge > 0 ? '+' : '-';
+		if (a->charge > 1 || a->charge < -1)
+			p = put_int(p, a->charge > 0 ? a->charge : -a->charge);
+	}
+	if (a->atom_class >= 0) {
+		*p++ = ':';
+		p = put_int(p, a->atom_class);
+	}
+	*p++ = ']';
+	return p;
+}
+
+/*
+ * Writes the symbol of bond b, as written from atom v, to p.
+ * Single bonds between aromatic atoms and aromatic bonds between others
+ * are the only ones whose symbol may not be left out.
+ * Returns the end of what was written.
+ */
+static char *put_bond(char *p, struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int b, int v)
+{
+	const struct coho_smiles_bond *bond = &x->bonds[b];
+	int aromatic = x->atoms[bond->atom0].is_aromatic &&
+	    x->atoms[bond->atom1].is_aromatic;
+	int up, g;
+
+	switch (bond->order) {
+	case COHO_SMILES_BOND_SINGLE:
+		if (bond->stereo != COHO_SMILES_BOND_STEREO_UNSPECIFIED) {
+			up = bond->stereo == COHO_SMILES_BOND_STEREO_UP;
+			if (bond->atom0 != v)
+				up = !up;
+			g = stereo_group(w, b);
+			if (w->stereo_flips[g] == 0)
+				w->stereo_flips[g] = up ? 1 : 2;
+			if (w->stereo_flips[g] == 2)
+				up = !up;
+			*p++ = up ? '/' : '\\';
+		} else if (aromatic) {
+			*p++ = '-';
+		}
+		break;
+	case COHO_SMILES_BOND_DOUBLE:
+		*p++ = '=';
+		break;
+	case COHO_SMILES_BOND_TRIPLE:
+		*p++ = '#';
+		break;
+	case COHO_SMILES_BOND_QUAD:
+		*p++ = '$';
+		break;
+	case COHO_SMILES_BOND_AROMATIC:
+		if (!aromatic)
+			*p++ = ':';
+		break;
+	}
+	return p;
+}
+
+/*
+ * Writes nonnegative integer n to p in decimal.
+ * Returns the end of what was written.
+ */
+static char *put_int(char *p, int n)
+{
+	char buf[16];
+	int i = 0;
+
+	do {
+		buf[i++] = '0' + n % 10;
+		n /= 10;
+	} while (n > 0);
+	while (i > 0)
+		*p++ = buf[--i];
+	return p;
+}
+
+/*
+ * Writes the ring bond digits of atom v to p, in the order of w's
+ * neighbor list, opening a ring bond with the lowest free digit
+ * and writing its symbol there, or closing one and freeing its digit.
+ * Returns the end of what was written, or NULL if there are no digits
+ * left.
+ */
+static char *put_ring_bonds(char *p, struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int v)
+{
+	int i, b, d;
+
+	for (i = x->neighbor_offsets[v]; i < x->neighbor_offsets[v + 1];
+	    i++) {
+		b = w->neighbor_bonds[i];
+		if ((d = w->ring_digits[b]) == -1)
+			continue;
+		if (d == 0) {
+			for (d = 1; w->digits_used[d]; d++)
+				;
+			if (d > MAX_RING_DIGIT)
+				return NULL;
+			w->digits_used[d] = 1;
+			w->ring_digits[b] = d;
+			p = put_bond(p, w, x, b, v);
+		} else {
+			w->digits_used[d] = 0;
+		}
+
+		if (d < 10) {
+			*p++ = '0' + d;
+		} else if (d < 100) {
+			*p++ = '%';
+			p = put_int(p, d);
+		} else {
+			*p++ = '%';
+			*p++ = '(';
+			p = put_int(p, d);
+			*p++ = ')';
+		}
+	}
+	return p;
+}
+
+/*
+ * Copies the neighbor lists of x to w, sorting each by rank.
+ */
+static void sort_neighbors(struct coho_smiles_writer *w,
+    const struct coho_smiles *x)
+{
+	int i, j, k, u, b;
+
+	for (i = 0; i < x->atom_count; i++) {
+		for (j = x->neighbor_offsets[i];
+		    j < x->neighbor_offsets[i + 1]; j++) {
+			u = x->neighbor_atoms[j];
+			b = x->neighbor_bonds[j];
+			for (k = j; k > x->neighbor_offsets[i] &&
+			    w->ranks[w->neighbor_atoms[k - 1]] > w->ranks[u];
+			    k--) {
+				w->neighbor_atoms[k] = w->neighbor_atoms[k - 1];
+				w->neighbor_bonds[k] = w->neighbor_bonds[k - 1];
+			}
+			w->neighbor_atoms[k] = u;
+			w->neighbor_bonds[k] = b;
+		}
+	}
+}
+
+/*
+ * Returns the group of stereo bond b.
+ */
+static int stereo_group(struct coho_smiles_writer *w, int b)
+{
+	while (w->stereo_groups[b] != b)
+		b = w->stereo_groups[b] = w->stereo_groups[w->stereo_groups[b]];
+	return b;
+}
+
+/*
+ * Writes x to w->smiles, ordered by w->ranks and w->order, normalizing
+ * stereo marks if canonical is set.
+ * Returns COHO_OK, COHO_NOMEM or COHO_ERROR as described for
+ * coho_smiles_write_canonical().
+ */
+static int write_smiles(struct coho_smiles_writer *w,
+    const struct coho_smiles *x, int canonical)
+{
+	struct coho_smiles_write_frame *f;
+	char *p;
+	int r, top, v, u, b, n;
+
+	if (coho_smiles_writer_reserve(w, x->atom_count, x->bond_count))
+		return COHO_NOMEM;
+
+	if (canonical) {
+		sort_neighbors(w, x);
+	} else {
+		n = x->neighbor_offsets[x->atom_count];
+		memcpy(w->neighbor_atoms, x->neighbor_atoms,
+		    n * sizeof(w->neighbor_atoms[0]));
+		memcpy(w->neighbor_bonds, x->neighbor_bonds,
+		    n * sizeof(w->neighbor_bonds[0]));
+	}
+	find_tree(w, x, canonical);
+	group_stereo(w, x);
+	if (!canonical)
+		memset(w->stereo_flips, 1, x->bond_count);
+	memset(w->digits_used, 0, x->bond_count + 1);
+
+	p = w->smiles;
+	for (r = 0; r < x->atom_count; r++) {
+		v = w->order[r];
+		if (w->parent_bonds[v] != -1)
+			continue;
+		if (p != w->smiles)
+			*p++ = '.';
+
+		top = 0;
+		f = &w->stack[0];
+		f->atom = v;
+		f->next = x->neighbor_offsets[v];
+		f->children = w->child_counts[v];
+		f->paren = 0;
+		p = put_atom(p, w, x, v);
+		if ((p = put_ring_bonds(p, w, x, v)) == NULL)
+			goto toomany;
+
+		while (top >= 0) {
+			f = &w->stack[top];
+			v = f->atom;
+			if (f->children == 0) {
+				if (f->paren)
+					*p++ = ')';
+				top--;
+				continue;
+			}
+			do {
+				u = w->neighbor_atoms[f->next];
+				b = w->neighbor_bonds[f->next++];
+			} while (w->parent_bonds[u] != b);
+
+			f->children--;
+			f = &w->stack[++top];
+			f->atom = u;
+			f->next = x->neighbor_offsets[u];
+			f->children = w->child_counts[u];
+			f->paren = w->stack[top - 1].children > 0;
+			if (f->paren)
+				*p++ = '(';
+			p = put_bond(p, w, x, b, v);
+			p = put_atom(p, w, x, u);
+			if ((p = put_ring_bonds(p, w, x, u)) == NULL)
+				goto toomany;
+		}
+	}
+
+	*p = '\0';
+	w->length = p - w->smiles;
+	return COHO_OK;
+
+toomany:
+	w->smiles[0] = '\0';
+	w->length = 0;
+	return COHO_ERROR;
+}